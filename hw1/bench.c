@@ -0,0 +1,254 @@
+#define _GNU_SOURCE
+#include "fileUtils.h"
+#include "directoryUtils.h"
+#include "outputBuffer.h"
+#include "logger.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define BENCH_DEFAULT_SIZES "1000,100000,1000000"
+#define BENCH_MAX_SIZES 16
+#define BENCH_BATCH 1000
+#define BENCH_LIST_WORK 1000000
+#define BENCH_MIN_REPEATS 5
+#define BENCH_MAX_REPEATS 200
+
+typedef void (*CommandFunc)(char *args[], size_t argc);
+
+static uint64_t now_ns(void){
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+static int compare_u64(const void *a, const void *b){
+	uint64_t left = *(const uint64_t *)a;
+	uint64_t right = *(const uint64_t *)b;
+	return left < right ? -1 : left > right;
+}
+
+static double percentile_us(const uint64_t *sorted, size_t count, double fraction){
+	size_t index = (size_t)(fraction * (double)(count - 1) + 0.5);
+	return (double)sorted[index] / 1000.0;
+}
+
+static void report(const char *operation, size_t entries, uint64_t *latencies, size_t count, size_t items, uint64_t elapsed){
+	qsort(latencies, count, sizeof(uint64_t), compare_u64);
+	double seconds = (double)elapsed / 1e9;
+	printf("%-24s %9zu %9zu %12.0f %10.1f %10.1f %10.1f %10.1f\n", operation, entries, count,
+		seconds > 0 ? (double)items / seconds : 0.0,
+		percentile_us(latencies, count, 0.50), percentile_us(latencies, count, 0.90),
+		percentile_us(latencies, count, 0.99), (double)latencies[count - 1] / 1000.0);
+	fflush(stdout);
+}
+
+/* Runs func once per group of per_call names and reports per call latency and names per second. */
+static void bench_calls(const char *operation, CommandFunc func, char **names, size_t num_names, size_t per_call, char *extra, uint64_t *latencies){
+	char **args = malloc((per_call + 1) * sizeof(char *));
+	if(args == NULL){
+		return;
+	}
+	size_t calls = 0;
+	uint64_t start = now_ns();
+	for(size_t i = 0; i < num_names; i += per_call){
+		size_t count = num_names - i < per_call ? num_names - i : per_call;
+		memcpy(args, names + i, count * sizeof(char *));
+		size_t argc = count;
+		if(extra){
+			args[argc++] = extra;
+		}
+		uint64_t before = now_ns();
+		func(args, argc);
+		latencies[calls++] = now_ns() - before;
+	}
+	uint64_t elapsed = now_ns() - start;
+	report(operation, num_names, latencies, calls, num_names, elapsed);
+	free(args);
+}
+
+static void bench_repeated(const char *operation, CommandFunc func, char **args, size_t argc, size_t entries, uint64_t *latencies){
+	size_t repeats = BENCH_LIST_WORK / entries;
+	repeats = repeats < BENCH_MIN_REPEATS ? BENCH_MIN_REPEATS : (repeats > BENCH_MAX_REPEATS ? BENCH_MAX_REPEATS : repeats);
+	char *scratch[4];
+	uint64_t start = now_ns();
+	for(size_t i = 0; i < repeats; ++i){
+		memcpy(scratch, args, argc * sizeof(char *));
+		uint64_t before = now_ns();
+		func(scratch, argc);
+		latencies[i] = now_ns() - before;
+	}
+	uint64_t elapsed = now_ns() - start;
+	report(operation, entries, latencies, repeats, repeats * entries, elapsed);
+}
+
+/* Every phase starts in an empty directory, filesystems slow down on directories that just lost many entries. */
+static int enter_phase(const char *name){
+	if(mkdir(name, 0755) == -1 || chdir(name) == -1){
+		fprintf(stderr, "Error : Could not create the directory %s (%s)\n", name, strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+static void leave_phase(const char *name, char **names, char **dirs, size_t entries){
+	for(size_t i = 0; i < entries; ++i){
+		unlink(names[i]);
+		rmdir(dirs[i]);
+	}
+	if(chdir("..") == -1 || rmdir(name) == -1){
+		fprintf(stderr, "Error : Could not remove the directory %s\n", name);
+	}
+}
+
+static int run_phases(size_t entries, char **names, char **dirs, uint64_t *latencies){
+	char text[] = "benchmark";
+	if(enter_phase("single") == -1){
+		return -1;
+	}
+	bench_calls("createFile", create_file, names, entries, 1, NULL, latencies);
+	bench_calls("appendToFile", append_to_file, names, entries, 1, text, latencies);
+	char *list_args[] = {"."};
+	bench_repeated("listDir", list_dir, list_args, 1, entries, latencies);
+	char *extension_args[] = {".", ".txt"};
+	bench_repeated("listFilesByExtension", list_dir_by_extension, extension_args, 2, entries, latencies);
+	bench_calls("deleteFile", delete_file, names, entries, 1, NULL, latencies);
+	leave_phase("single", names, dirs, entries);
+
+	if(enter_phase("batch") == -1){
+		return -1;
+	}
+	char label[64];
+	snprintf(label, sizeof(label), "createFile x%d", BENCH_BATCH);
+	bench_calls(label, create_file, names, entries, BENCH_BATCH, NULL, latencies);
+	snprintf(label, sizeof(label), "deleteFile x%d", BENCH_BATCH);
+	bench_calls(label, delete_file, names, entries, BENCH_BATCH, NULL, latencies);
+	leave_phase("batch", names, dirs, entries);
+
+	if(enter_phase("dirs") == -1){
+		return -1;
+	}
+	for(size_t i = 0; i < entries; ++i){
+		mkdir(dirs[i], 0755);
+	}
+	bench_calls("deleteDir", delete_dir, dirs, entries, 1, NULL, latencies);
+	leave_phase("dirs", names, dirs, entries);
+	return 0;
+}
+
+static int bench_size(size_t entries){
+	char **names = calloc(entries, sizeof(char *));
+	char **dirs = calloc(entries, sizeof(char *));
+	uint64_t *latencies = malloc((entries + BENCH_MAX_REPEATS) * sizeof(uint64_t));
+	int status = -1;
+	if(names && dirs && latencies){
+		status = 0;
+		for(size_t i = 0; i < entries && status == 0; ++i){
+			char name[32];
+			snprintf(name, sizeof(name), "f%07zu%s", i, (i % 2) ? ".c" : ".txt");
+			names[i] = strdup(name);
+			snprintf(name, sizeof(name), "d%07zu", i);
+			dirs[i] = strdup(name);
+			if(names[i] == NULL || dirs[i] == NULL){
+				status = -1;
+			}
+		}
+	}
+	if(status == -1){
+		fprintf(stderr, "Memory allocation failed!\n");
+	}else{
+		status = run_phases(entries, names, dirs, latencies);
+	}
+	for(size_t i = 0; names && dirs && i < entries; ++i){
+		free(names[i]);
+		free(dirs[i]);
+	}
+	free(names);
+	free(dirs);
+	free(latencies);
+	return status;
+}
+
+static size_t parse_sizes(const char *list, size_t *sizes){
+	size_t count = 0;
+	const char *cursor = list;
+	while(*cursor && count < BENCH_MAX_SIZES){
+		char *end;
+		unsigned long long value = strtoull(cursor, &end, 10);
+		if(end == cursor || value == 0){
+			return 0;
+		}
+		if(*end == 'k' || *end == 'K'){
+			value *= 1000;
+			end++;
+		}else if(*end == 'm' || *end == 'M'){
+			value *= 1000000;
+			end++;
+		}
+		sizes[count++] = (size_t)value;
+		if(*end == ','){
+			end++;
+		}else if(*end != '\0'){
+			return 0;
+		}
+		cursor = end;
+	}
+	return count;
+}
+
+int main(int argc, char *argv[]){
+	const char *size_list = BENCH_DEFAULT_SIZES;
+	const char *base = getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp";
+	for(int i = 1; i < argc; ++i){
+		if(strncmp(argv[i], "--sizes=", 8) == 0){
+			size_list = argv[i] + 8;
+		}else if(strncmp(argv[i], "--dir=", 6) == 0){
+			base = argv[i] + 6;
+		}else{
+			fprintf(stderr, "Usage: %s [--sizes=1000,100000,1000000] [--dir=path]\n", argv[0]);
+			return 1;
+		}
+	}
+	size_t sizes[BENCH_MAX_SIZES];
+	size_t num_sizes = parse_sizes(size_list, sizes);
+	if(num_sizes == 0){
+		fprintf(stderr, "Error : Invalid size list %s\n", size_list);
+		return 1;
+	}
+	char root[4096];
+	snprintf(root, sizeof(root), "%s/fileManagerBench.XXXXXX", base);
+	if(mkdtemp(root) == NULL || chdir(root) == -1){
+		fprintf(stderr, "Error : Could not create a directory under %s (%s)\n", base, strerror(errno));
+		return 1;
+	}
+	/* Command output would dominate the timings, only the report goes to stdout. */
+	int null_fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+	if(null_fd == -1){
+		fprintf(stderr, "Error : Could not open /dev/null\n");
+		return 1;
+	}
+	set_output_fd(null_fd);
+	if(logger_open() == -1){
+		fprintf(stderr, "Error : Could not open the logs file\n");
+	}
+
+	printf("Benchmark directory %s\n", root);
+	printf("%-24s %9s %9s %12s %10s %10s %10s %10s\n", "operation", "entries", "calls", "items/s", "p50 us", "p90 us", "p99 us", "max us");
+	int status = 0;
+	for(size_t i = 0; i < num_sizes && status == 0; ++i){
+		status = bench_size(sizes[i]);
+	}
+	logger_shutdown();
+	unlink(LOG_FILE);
+	unlink(LOG_INDEX_FILE);
+	if(chdir("/") == -1 || rmdir(root) == -1){
+		fprintf(stderr, "Error : Could not remove %s\n", root);
+	}
+	return status == 0 ? 0 : 1;
+}
@@ -0,0 +1,177 @@
+#define _GNU_SOURCE
+#include "bulkCreate.h"
+#include "uring.h"
+#include "logger.h"
+#include "outputBuffer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/stat.h>
+
+/* A stage whose completion was never seen. */
+#define STAGE_PENDING INT_MIN
+
+enum{
+	STAGE_OPEN,
+	STAGE_WRITE,
+	STAGE_CLOSE,
+	NUM_STAGES
+};
+
+typedef struct{
+	int results[NUM_STAGES];
+} CreateStatus;
+
+static void create_one_file(const char *filename, const char *content, size_t content_len, CreateStatus *status){
+	int file_descriptor = open(filename, O_CREAT | O_EXCL | O_WRONLY | O_CLOEXEC, S_IRUSR | S_IWUSR);
+	status->results[STAGE_OPEN] = file_descriptor == -1 ? -errno : 0;
+	status->results[STAGE_WRITE] = 0;
+	if(file_descriptor == -1){
+		return;
+	}
+	ssize_t bytes_written = write(file_descriptor, content, content_len);
+	status->results[STAGE_WRITE] = bytes_written == -1 ? -errno : (int)bytes_written;
+	close(file_descriptor);
+}
+
+static void report_file(const char *filename, const CreateStatus *status, size_t content_len, size_t *created){
+	int open_result = status->results[STAGE_OPEN];
+	int write_result = status->results[STAGE_WRITE];
+	if(open_result >= 0 && write_result >= 0 && (size_t)write_result != content_len){
+		write_result = -EIO;
+	}
+	if(open_result == -EEXIST){
+		print_message("Error: File %s already exists.\n", filename);
+	}else if(open_result < 0){
+		print_message("Error creating the file %s.\n", filename);
+	}else if(write_result < 0){
+		print_message("Error writing to the file %s.\n", filename);
+	}else{
+		log_operation(LOG_OP_CREATE_FILE, 0, filename, NULL);
+		(*created)++;
+	}
+}
+
+static void queue_create(Uring *ring, const char *filename, unsigned slot, const char *content, size_t content_len, size_t index){
+	struct io_uring_sqe *sqe = uring_get_sqe(ring);
+	sqe->opcode = IORING_OP_OPENAT;
+	sqe->fd = AT_FDCWD;
+	sqe->addr = (unsigned long)filename;
+	sqe->open_flags = O_CREAT | O_EXCL | O_WRONLY | O_CLOEXEC;
+	sqe->len = S_IRUSR | S_IWUSR;
+	sqe->file_index = slot + 1;
+	sqe->flags = IOSQE_IO_LINK;
+	sqe->user_data = index * NUM_STAGES + STAGE_OPEN;
+
+	sqe = uring_get_sqe(ring);
+	sqe->opcode = IORING_OP_WRITE;
+	sqe->fd = (int)slot;
+	sqe->addr = (unsigned long)content;
+	sqe->len = (unsigned)content_len;
+	sqe->off = 0;
+	sqe->flags = IOSQE_FIXED_FILE | IOSQE_IO_LINK;
+	sqe->user_data = index * NUM_STAGES + STAGE_WRITE;
+
+	sqe = uring_get_sqe(ring);
+	sqe->opcode = IORING_OP_CLOSE;
+	sqe->file_index = slot + 1;
+	sqe->user_data = index * NUM_STAGES + STAGE_CLOSE;
+}
+
+static unsigned collect_completions(Uring *ring, CreateStatus *status){
+	unsigned seen = 0;
+	struct io_uring_cqe *cqe;
+	while((cqe = uring_peek_cqe(ring)) != NULL){
+		size_t index = (size_t)(cqe->user_data / NUM_STAGES);
+		status[index].results[cqe->user_data % NUM_STAGES] = cqe->res;
+		uring_cqe_seen(ring);
+		seen++;
+	}
+	return seen;
+}
+
+/*
+ * On failure every completion that did arrive is still recorded, stages
+ * never seen are left at STAGE_PENDING.
+ */
+static int run_batch(Uring *ring, char *args[], size_t count, const char *content, size_t content_len, CreateStatus *status){
+	for(size_t i = 0; i < count; ++i){
+		for(int stage = 0; stage < NUM_STAGES; ++stage){
+			status[i].results[stage] = STAGE_PENDING;
+		}
+		queue_create(ring, args[i], (unsigned)i, content, content_len, i);
+	}
+	unsigned expected = (unsigned)(count * NUM_STAGES);
+	unsigned seen = 0;
+	if(uring_submit_and_wait(ring, expected) == -1){
+		collect_completions(ring, status);
+		return -1;
+	}
+	while(seen < expected){
+		unsigned collected = collect_completions(ring, status);
+		seen += collected;
+		if(collected == 0 && uring_submit_and_wait(ring, expected - seen) == -1){
+			collect_completions(ring, status);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+void create_files_bulk(char *args[], size_t argc, const char *content){
+	size_t content_len = strlen(content);
+	size_t created = 0;
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	Uring ring;
+	int use_ring = getenv("FILEMANAGER_NO_URING") == NULL && uring_init(&ring, BULK_CREATE_RING_ENTRIES) == 0;
+	if(use_ring && uring_register_sparse_files(&ring, BULK_CREATE_BATCH) == -1){
+		uring_exit(&ring);
+		use_ring = 0;
+	}
+
+	CreateStatus status[BULK_CREATE_BATCH];
+	size_t done = 0;
+	while(use_ring && done < argc){
+		size_t count = argc - done < BULK_CREATE_BATCH ? argc - done : BULK_CREATE_BATCH;
+		int failed = run_batch(&ring, args + done, count, content, content_len, status) == -1;
+		if(failed){
+			/* The ring is in an unknown state, let the synchronous path finish the job. */
+			uring_exit(&ring);
+			use_ring = 0;
+		}
+		for(size_t i = 0; i < count; ++i){
+			int open_result = status[i].results[STAGE_OPEN];
+			if(open_result == STAGE_PENDING){
+				/* Never opened by the ring, so it is created here instead. */
+				create_one_file(args[done + i], content, content_len, &status[i]);
+			}else if(open_result >= 0 && (status[i].results[STAGE_WRITE] == STAGE_PENDING || status[i].results[STAGE_CLOSE] == STAGE_PENDING)){
+				/* Created by the ring, but whether its content was written is unknown. */
+				status[i].results[STAGE_WRITE] = -EIO;
+			}else if(open_result == -EINVAL || open_result == -EOPNOTSUPP){
+				/* Kernels without direct descriptors for openat reject the chain before creating anything. */
+				create_one_file(args[done + i], content, content_len, &status[i]);
+			}
+			report_file(args[done + i], &status[i], content_len, &created);
+		}
+		done += count;
+	}
+	if(use_ring){
+		uring_exit(&ring);
+	}
+
+	for(; done < argc; ++done){
+		create_one_file(args[done], content, content_len, &status[0]);
+		report_file(args[done], &status[0], content_len, &created);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	double seconds = (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+	print_message("Created %zu files in %.3f s (%.0f files/s)\n", created, seconds, seconds > 0 ? (double)created / seconds : 0.0);
+}
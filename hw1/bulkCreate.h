@@ -0,0 +1,12 @@
+#include <stddef.h>
+#ifndef BULKCREATE_H
+#define BULKCREATE_H
+
+#define BULK_CREATE_THRESHOLD 256
+#define BULK_CREATE_BATCH 256
+/* Every file is an openat, write and close linked together. */
+#define BULK_CREATE_RING_ENTRIES (BULK_CREATE_BATCH * 4)
+
+void create_files_bulk(char *args[], size_t argc, const char *content);
+
+#endif
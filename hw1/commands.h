@@ -0,0 +1,12 @@
+#include <stddef.h>
+#ifndef COMMANDS_H
+#define COMMANDS_H
+
+typedef struct{
+	char *command;
+	void (*func)(char *args[], size_t argc);
+} Command;
+
+const Command *find_command(const char *name);
+
+#endif
@@ -0,0 +1,232 @@
+#define _GNU_SOURCE
+#include "copyUtils.h"
+#include "directoryUtils.h"
+#include "threadPool.h"
+#include "logger.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <linux/fs.h>
+
+typedef struct{
+	atomic_llong bytes;
+	atomic_long files;
+} CopyStats;
+
+static int copy_with_buffer(int src_fd, int dst_fd, off_t offset){
+	char *buffer = malloc(COPY_BUFFER_SIZE);
+	if(buffer == NULL){
+		return -1;
+	}
+	int result = 0;
+	for(;;){
+		ssize_t bytes_read = pread(src_fd, buffer, COPY_BUFFER_SIZE, offset);
+		if(bytes_read == -1 && errno == EINTR){
+			continue;
+		}
+		if(bytes_read <= 0){
+			result = bytes_read == 0 ? 0 : -1;
+			break;
+		}
+		if(write_all(dst_fd, buffer, (size_t)bytes_read) == -1){
+			result = -1;
+			break;
+		}
+		offset += bytes_read;
+	}
+	free(buffer);
+	return result;
+}
+
+int copy_file_contents(int src_fd, int dst_fd, long long size){
+	if(size > 0 && ioctl(dst_fd, FICLONE, src_fd) == 0){
+		return 0;
+	}
+	loff_t offset = 0;
+	while(offset < size){
+		size_t chunk = size - offset < COPY_CHUNK_SIZE ? (size_t)(size - offset) : COPY_CHUNK_SIZE;
+		ssize_t copied = copy_file_range(src_fd, &offset, dst_fd, NULL, chunk, 0);
+		if(copied > 0){
+			continue;
+		}
+		if(copied == 0){
+			break;
+		}
+		if(errno == EINTR){
+			continue;
+		}
+		if(errno != EXDEV && errno != ENOSYS && errno != EINVAL && errno != EOPNOTSUPP){
+			return -1;
+		}
+		if(lseek(dst_fd, offset, SEEK_SET) == -1){
+			return -1;
+		}
+		return copy_with_buffer(src_fd, dst_fd, offset);
+	}
+	return copy_with_buffer(src_fd, dst_fd, offset);
+}
+
+static int copy_one(const char *source, const char *destination, CopyStats *stats, OutputBuffer *out){
+	int src_fd = open(source, O_RDONLY | O_CLOEXEC);
+	if(src_fd == -1){
+		out_printf(out, "Error : File %s not found\n", source);
+		return -1;
+	}
+	struct stat statbuf;
+	if(fstat(src_fd, &statbuf) == -1 || !S_ISREG(statbuf.st_mode)){
+		out_printf(out, "Error : %s is not a regular file\n", source);
+		close(src_fd);
+		return -1;
+	}
+	int dst_fd = open(destination, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, statbuf.st_mode & 07777);
+	if(dst_fd == -1){
+		if(errno == EEXIST){
+			out_printf(out, "Error : File %s already exists\n", destination);
+		}else{
+			out_printf(out, "Error : Could not create the file %s\n", destination);
+		}
+		close(src_fd);
+		return -1;
+	}
+	int result = copy_file_contents(src_fd, dst_fd, (long long)statbuf.st_size);
+	if(close(dst_fd) == -1){
+		result = -1;
+	}
+	close(src_fd);
+	if(result == -1){
+		out_printf(out, "Error : Could not copy %s to %s\n", source, destination);
+		unlink(destination);
+		return -1;
+	}
+	atomic_fetch_add(&stats->bytes, (long long)statbuf.st_size);
+	return 0;
+}
+
+static void copy_task(char *args[], void *context, OutputBuffer *out){
+	CopyStats *stats = (CopyStats *)context;
+	if(copy_one(args[0], args[1], stats, out) == 0){
+		atomic_fetch_add(&stats->files, 1);
+		log_operation(LOG_OP_COPY_FILE, 0, args[0], args[1]);
+	}
+}
+
+static void move_task(char *args[], void *context, OutputBuffer *out){
+	CopyStats *stats = (CopyStats *)context;
+	char *source = args[0];
+	char *destination = args[1];
+	struct stat statbuf;
+	if(lstat(source, &statbuf) == -1){
+		out_printf(out, "Error : File %s not found\n", source);
+		return;
+	}
+	int renamed = renameat2(AT_FDCWD, source, AT_FDCWD, destination, RENAME_NOREPLACE);
+	int error = errno;
+	/* Without renameat2 the destination can only be checked beforehand. */
+	if(renamed == -1 && error == ENOSYS){
+		if(access(destination, F_OK) == 0){
+			error = EEXIST;
+		}else{
+			renamed = rename(source, destination);
+			error = errno;
+		}
+	}
+	/* A rename within one filesystem copies nothing, across filesystems the data is copied. */
+	if(renamed == -1){
+		if(error == EEXIST){
+			out_printf(out, "Error : File %s already exists\n", destination);
+			return;
+		}
+		if(error != EXDEV){
+			out_printf(out, "Error : Could not move %s to %s (%s)\n", source, destination, strerror(error));
+			return;
+		}
+		if(copy_one(source, destination, stats, out) == -1){
+			return;
+		}
+		if(unlink(source) == -1){
+			out_printf(out, "Error : Copied %s to %s but could not remove the source\n", source, destination);
+			return;
+		}
+	}
+	atomic_fetch_add(&stats->files, 1);
+	log_operation(LOG_OP_MOVE_FILE, 0, source, destination);
+}
+
+static char *join_path(const char *directory, const char *source){
+	const char *base = strrchr(source, '/');
+	base = base ? base + 1 : source;
+	size_t dir_len = strlen(directory);
+	int needs_slash = dir_len > 0 && directory[dir_len - 1] != '/';
+	char *path = malloc(dir_len + needs_slash + strlen(base) + 1);
+	if(path){
+		sprintf(path, "%s%s%s", directory, needs_slash ? "/" : "", base);
+	}
+	return path;
+}
+
+static void run_transfer(char *args[], size_t argc, TaskFunc task, int move){
+	if(argc < 2){
+		print_message("Error : Invalid number of arguments\n");
+		return;
+	}
+	char *destination = args[argc - 1];
+	size_t num_sources = argc - 1;
+	int into_directory = directory_exists(destination);
+	if(num_sources > 1 && !into_directory){
+		print_message("Error : Directory %s not found\n", destination);
+		return;
+	}
+
+	char **pairs = calloc(num_sources * 2, sizeof(char *));
+	if(pairs == NULL){
+		print_message("Memory allocation failed!\n");
+		return;
+	}
+	size_t num_pairs = 0;
+	for(size_t i = 0; i < num_sources; ++i){
+		char *target = into_directory ? join_path(destination, args[i]) : strdup(destination);
+		if(target == NULL){
+			print_message("Memory allocation failed!\n");
+			break;
+		}
+		pairs[num_pairs * 2] = args[i];
+		pairs[num_pairs * 2 + 1] = target;
+		num_pairs++;
+	}
+
+	CopyStats stats;
+	atomic_init(&stats.bytes, 0);
+	atomic_init(&stats.files, 0);
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	run_tasks(task, pairs, num_pairs, 2, &stats);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	double seconds = (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+	long long bytes = atomic_load(&stats.bytes);
+	long files = atomic_load(&stats.files);
+	if(files > 0){
+		print_message("%s %ld files, %lld bytes copied in %.3f s (%.1f MB/s)\n", move ? "Moved" : "Copied", files, bytes, seconds,
+			seconds > 0 ? (double)bytes / seconds / (1024.0 * 1024.0) : 0.0);
+	}
+
+	for(size_t i = 0; i < num_pairs; ++i){
+		free(pairs[i * 2 + 1]);
+	}
+	free(pairs);
+}
+
+void copy_file(char *args[], size_t argc){
+	run_transfer(args, argc, copy_task, 0);
+}
+
+void move_file(char *args[], size_t argc){
+	run_transfer(args, argc, move_task, 1);
+}
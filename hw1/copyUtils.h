@@ -0,0 +1,13 @@
+#include <stddef.h>
+#ifndef COPYUTILS_H
+#define COPYUTILS_H
+
+#define COPY_BUFFER_SIZE (1024 * 1024)
+#define COPY_CHUNK_SIZE (64 * 1024 * 1024)
+
+void copy_file(char *args[], size_t argc);
+void move_file(char *args[], size_t argc);
+
+int copy_file_contents(int src_fd, int dst_fd, long long size);
+
+#endif
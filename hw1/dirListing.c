@@ -0,0 +1,410 @@
+#define _GNU_SOURCE
+#include "dirListing.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+typedef struct{
+	char *name;
+	unsigned char type;
+	long long size;
+} ListEntry;
+
+typedef struct{
+	ListEntry *entries;
+	size_t count;
+	size_t capacity;
+	size_t bytes;
+	FILE **runs;
+	size_t num_runs;
+} SortState;
+
+typedef struct{
+	FILE *run;
+	ListEntry entry;
+	size_t name_capacity;
+} RunReader;
+
+int dir_reader_open(DirReader *reader, int parent_fd, const char *path){
+	int fd = openat(parent_fd, path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if(fd == -1){
+		return -1;
+	}
+	if(dir_reader_from_fd(reader, fd) == -1){
+		close(fd);
+		return -1;
+	}
+	reader->owns_fd = 1;
+	return 0;
+}
+
+int dir_reader_from_fd(DirReader *reader, int fd){
+	reader->buffer = malloc(DIR_READ_BUFFER_SIZE);
+	if(reader->buffer == NULL){
+		return -1;
+	}
+	reader->fd = fd;
+	reader->owns_fd = 0;
+	reader->position = 0;
+	reader->length = 0;
+	reader->error = 0;
+	return 0;
+}
+
+DirEntry *dir_reader_next(DirReader *reader){
+	if(reader->position >= reader->length){
+		long bytes_read = syscall(SYS_getdents64, reader->fd, reader->buffer, DIR_READ_BUFFER_SIZE);
+		if(bytes_read <= 0){
+			if(bytes_read == -1){
+				reader->error = errno;
+			}
+			reader->length = 0;
+			reader->position = 0;
+			return NULL;
+		}
+		reader->length = bytes_read;
+		reader->position = 0;
+	}
+	DirEntry *entry = (DirEntry *)(reader->buffer + reader->position);
+	reader->position += entry->d_reclen;
+	return entry;
+}
+
+void dir_reader_close(DirReader *reader){
+	if(reader->owns_fd){
+		close(reader->fd);
+	}
+	free(reader->buffer);
+	reader->buffer = NULL;
+}
+
+int is_dot_entry(const char *name){
+	return name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'));
+}
+
+static int parse_size(const char *str, size_t *result){
+	char *endptr;
+	unsigned long long value = strtoull(str, &endptr, 10);
+	if(endptr == str){
+		return -1;
+	}
+	switch(*endptr){
+		case 'G': case 'g': value *= 1024;  /* fall through */
+		case 'M': case 'm': value *= 1024;  /* fall through */
+		case 'K': case 'k': value *= 1024; endptr++; break;
+		case '\0': break;
+		default: return -1;
+	}
+	if(*endptr != '\0' || value == 0){
+		return -1;
+	}
+	*result = (size_t)value;
+	return 0;
+}
+
+int parse_list_option(char *arg, ListOptions *options){
+	if(strcmp(arg, "--type") == 0){
+		options->show_type = 1;
+	}else if(strcmp(arg, "--size") == 0){
+		options->show_size = 1;
+	}else if(strcmp(arg, "--sort") == 0){
+		options->sorted = 1;
+	}else if(strncmp(arg, "--mem-budget=", 13) == 0){
+		if(parse_size(arg + 13, &options->memory_budget) == -1){
+			return -1;
+		}
+		options->sorted = 1;
+	}else{
+		return -1;
+	}
+	return 0;
+}
+
+static char type_char(unsigned char type){
+	switch(type){
+		case DT_DIR: return 'd';
+		case DT_REG: return 'f';
+		case DT_LNK: return 'l';
+		case DT_FIFO: return 'p';
+		case DT_SOCK: return 's';
+		case DT_CHR: return 'c';
+		case DT_BLK: return 'b';
+		default: return '?';
+	}
+}
+
+static unsigned char mode_to_type(mode_t mode){
+	switch(mode & S_IFMT){
+		case S_IFDIR: return DT_DIR;
+		case S_IFREG: return DT_REG;
+		case S_IFLNK: return DT_LNK;
+		case S_IFIFO: return DT_FIFO;
+		case S_IFSOCK: return DT_SOCK;
+		case S_IFCHR: return DT_CHR;
+		case S_IFBLK: return DT_BLK;
+		default: return DT_UNKNOWN;
+	}
+}
+
+unsigned char resolve_entry_type(int dir_fd, const char *name, unsigned char type){
+	if(type != DT_UNKNOWN){
+		return type;
+	}
+	struct statx stx;
+	if(statx(dir_fd, name, AT_SYMLINK_NOFOLLOW | AT_STATX_DONT_SYNC, STATX_TYPE, &stx) == -1 || !(stx.stx_mask & STATX_TYPE)){
+		return DT_UNKNOWN;
+	}
+	return mode_to_type(stx.stx_mode);
+}
+
+static void fill_metadata(int dir_fd, const char *name, const ListOptions *options, unsigned char *type, long long *size){
+	*size = -1;
+	int need_type = options->show_type && *type == DT_UNKNOWN;
+	if(!need_type && !options->show_size){
+		return;
+	}
+	unsigned int mask = (need_type ? STATX_TYPE : 0) | (options->show_size ? STATX_SIZE : 0);
+	struct statx stx;
+	if(statx(dir_fd, name, AT_SYMLINK_NOFOLLOW | AT_STATX_DONT_SYNC, mask, &stx) == -1){
+		return;
+	}
+	if(need_type && (stx.stx_mask & STATX_TYPE)){
+		*type = mode_to_type(stx.stx_mode);
+	}
+	if(options->show_size && (stx.stx_mask & STATX_SIZE)){
+		*size = (long long)stx.stx_size;
+	}
+}
+
+static void emit_entry(OutputBuffer *out, const ListOptions *options, const char *name, unsigned char type, long long size){
+	if(options->show_type){
+		char prefix[2] = {type_char(type), '\t'};
+		out_write(out, prefix, sizeof(prefix));
+	}
+	if(options->show_size){
+		if(size >= 0){
+			out_printf(out, "%lld\t", size);
+		}else{
+			out_write(out, "-\t", 2);
+		}
+	}
+	size_t len = strlen(name);
+	out_write(out, name, len);
+	out_write(out, "\n", 1);
+}
+
+static int compare_entries(const void *a, const void *b){
+	return strcmp(((const ListEntry *)a)->name, ((const ListEntry *)b)->name);
+}
+
+static void sort_state_clear(SortState *state){
+	for(size_t i = 0; i < state->count; ++i){
+		free(state->entries[i].name);
+	}
+	state->count = 0;
+	state->bytes = 0;
+}
+
+static int spill_run(SortState *state){
+	FILE **runs = realloc(state->runs, (state->num_runs + 1) * sizeof(FILE *));
+	if(runs == NULL){
+		return -1;
+	}
+	state->runs = runs;
+	FILE *run = tmpfile();
+	if(run == NULL){
+		return -1;
+	}
+	qsort(state->entries, state->count, sizeof(ListEntry), compare_entries);
+	for(size_t i = 0; i < state->count; ++i){
+		ListEntry *entry = &state->entries[i];
+		uint32_t name_len = (uint32_t)strlen(entry->name);
+		if(fwrite(&name_len, sizeof(name_len), 1, run) != 1 ||
+			fwrite(&entry->type, sizeof(entry->type), 1, run) != 1 ||
+			fwrite(&entry->size, sizeof(entry->size), 1, run) != 1 ||
+			fwrite(entry->name, 1, name_len, run) != name_len){
+			fclose(run);
+			return -1;
+		}
+	}
+	if(fflush(run) != 0 || fseek(run, 0, SEEK_SET) != 0){
+		fclose(run);
+		return -1;
+	}
+	state->runs[state->num_runs++] = run;
+	sort_state_clear(state);
+	return 0;
+}
+
+static int add_sorted_entry(SortState *state, const ListOptions *options, const char *name, unsigned char type, long long size){
+	if(state->count == state->capacity){
+		size_t new_capacity = state->capacity ? state->capacity * 2 : 1024;
+		ListEntry *entries = realloc(state->entries, new_capacity * sizeof(ListEntry));
+		if(entries == NULL){
+			return -1;
+		}
+		state->entries = entries;
+		state->capacity = new_capacity;
+	}
+	char *copy = strdup(name);
+	if(copy == NULL){
+		return -1;
+	}
+	state->entries[state->count].name = copy;
+	state->entries[state->count].type = type;
+	state->entries[state->count].size = size;
+	state->count++;
+	state->bytes += sizeof(ListEntry) + strlen(name) + 1;
+	if(state->bytes >= options->memory_budget){
+		return spill_run(state);
+	}
+	return 0;
+}
+
+static int run_reader_next(RunReader *reader){
+	uint32_t name_len;
+	if(fread(&name_len, sizeof(name_len), 1, reader->run) != 1){
+		return 0;
+	}
+	if(name_len + 1 > reader->name_capacity){
+		char *name = realloc(reader->entry.name, name_len + 1);
+		if(name == NULL){
+			return -1;
+		}
+		reader->entry.name = name;
+		reader->name_capacity = name_len + 1;
+	}
+	if(fread(&reader->entry.type, sizeof(reader->entry.type), 1, reader->run) != 1 ||
+		fread(&reader->entry.size, sizeof(reader->entry.size), 1, reader->run) != 1 ||
+		fread(reader->entry.name, 1, name_len, reader->run) != name_len){
+		return -1;
+	}
+	reader->entry.name[name_len] = '\0';
+	return 1;
+}
+
+static void heap_sift_down(RunReader **heap, size_t size, size_t index){
+	for(;;){
+		size_t smallest = index;
+		size_t left = 2 * index + 1;
+		size_t right = left + 1;
+		if(left < size && strcmp(heap[left]->entry.name, heap[smallest]->entry.name) < 0){
+			smallest = left;
+		}
+		if(right < size && strcmp(heap[right]->entry.name, heap[smallest]->entry.name) < 0){
+			smallest = right;
+		}
+		if(smallest == index){
+			return;
+		}
+		RunReader *tmp = heap[index];
+		heap[index] = heap[smallest];
+		heap[smallest] = tmp;
+		index = smallest;
+	}
+}
+
+static int merge_runs(SortState *state, const ListOptions *options, OutputBuffer *out){
+	RunReader *readers = calloc(state->num_runs, sizeof(RunReader));
+	RunReader **heap = calloc(state->num_runs, sizeof(RunReader *));
+	int result = 0;
+	if(readers == NULL || heap == NULL){
+		free(readers);
+		free(heap);
+		return -1;
+	}
+	size_t heap_size = 0;
+	for(size_t i = 0; i < state->num_runs; ++i){
+		readers[i].run = state->runs[i];
+		setvbuf(readers[i].run, NULL, _IOFBF, 256 * 1024);
+		int status = run_reader_next(&readers[i]);
+		if(status == 1){
+			heap[heap_size++] = &readers[i];
+		}else if(status == -1){
+			result = -1;
+		}
+	}
+	for(size_t i = heap_size; i-- > 0;){
+		heap_sift_down(heap, heap_size, i);
+	}
+	while(heap_size > 0 && result == 0){
+		RunReader *top = heap[0];
+		emit_entry(out, options, top->entry.name, top->entry.type, top->entry.size);
+		int status = run_reader_next(top);
+		if(status == 1){
+			heap_sift_down(heap, heap_size, 0);
+		}else{
+			if(status == -1){
+				result = -1;
+			}
+			heap[0] = heap[--heap_size];
+			heap_sift_down(heap, heap_size, 0);
+		}
+	}
+	for(size_t i = 0; i < state->num_runs; ++i){
+		free(readers[i].entry.name);
+	}
+	free(readers);
+	free(heap);
+	return result;
+}
+
+static void sort_state_free(SortState *state){
+	sort_state_clear(state);
+	free(state->entries);
+	for(size_t i = 0; i < state->num_runs; ++i){
+		fclose(state->runs[i]);
+	}
+	free(state->runs);
+}
+
+long list_directory(const char *path, const ListOptions *options, OutputBuffer *out){
+	DirReader reader;
+	if(dir_reader_open(&reader, AT_FDCWD, path) == -1){
+		return -1;
+	}
+
+	SortState state;
+	memset(&state, 0, sizeof(state));
+	long count = 0;
+	int failed = 0;
+	DirEntry *entry;
+	while((entry = dir_reader_next(&reader)) != NULL){
+		if(is_dot_entry(entry->d_name)){
+			continue;
+		}
+		unsigned char type = entry->d_type;
+		long long size = -1;
+		fill_metadata(reader.fd, entry->d_name, options, &type, &size);
+		count++;
+		if(!options->sorted){
+			emit_entry(out, options, entry->d_name, type, size);
+		}else if(add_sorted_entry(&state, options, entry->d_name, type, size) == -1){
+			failed = 1;
+			break;
+		}
+	}
+	if(reader.error){
+		failed = 1;
+	}
+	dir_reader_close(&reader);
+
+	if(options->sorted && !failed){
+		if(state.num_runs == 0){
+			qsort(state.entries, state.count, sizeof(ListEntry), compare_entries);
+			for(size_t i = 0; i < state.count; ++i){
+				emit_entry(out, options, state.entries[i].name, state.entries[i].type, state.entries[i].size);
+			}
+		}else if(spill_run(&state) == -1 || merge_runs(&state, options, out) == -1){
+			failed = 1;
+		}
+	}
+	sort_state_free(&state);
+	return failed ? -1 : count;
+}
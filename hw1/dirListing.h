@@ -0,0 +1,44 @@
+#include <stddef.h>
+#include <stdint.h>
+#include "outputBuffer.h"
+#ifndef DIRLISTING_H
+#define DIRLISTING_H
+
+#define DIR_READ_BUFFER_SIZE (1024 * 1024)
+#define DEFAULT_SORT_MEMORY_BUDGET (64UL * 1024 * 1024)
+
+typedef struct{
+	uint64_t d_ino;
+	int64_t d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[];
+} DirEntry;
+
+typedef struct{
+	int fd;
+	int owns_fd;
+	char *buffer;
+	long position;
+	long length;
+	int error;
+} DirReader;
+
+typedef struct{
+	int show_type;
+	int show_size;
+	int sorted;
+	size_t memory_budget;
+} ListOptions;
+
+int dir_reader_open(DirReader *reader, int parent_fd, const char *path);
+int dir_reader_from_fd(DirReader *reader, int fd);
+DirEntry *dir_reader_next(DirReader *reader);
+void dir_reader_close(DirReader *reader);
+int is_dot_entry(const char *name);
+unsigned char resolve_entry_type(int dir_fd, const char *name, unsigned char type);
+
+int parse_list_option(char *arg, ListOptions *options);
+long list_directory(const char *path, const ListOptions *options, OutputBuffer *out);
+
+#endif
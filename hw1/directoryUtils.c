@@ -1,14 +1,22 @@
+#define _POSIX_C_SOURCE 200809L
 #include "directoryUtils.h"
 #include "fileUtils.h"
+#include "threadPool.h"
+#include "logger.h"
+#include "dirListing.h"
+#include "treeWalk.h"
+#include "extensionSet.h"
+#include "extensionCache.h"
+#include "utilities.h"
 #include <stdio.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <stddef.h>
 #include <dirent.h>
 #include <unistd.h>
-#include <sys/wait.h>
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
 
 void create_dir(char *args[], size_t argc){
 	if(argc == 0){
@@ -18,13 +26,29 @@ void create_dir(char *args[], size_t argc){
 	for(size_t i = 0; i < argc; ++i){
 		char *dirname = args[i];
 		if(directory_exists(dirname)){
-			printf("Error : Directory %s already exists\n", dirname);
+			print_message("Error : Directory %s already exists\n", dirname);
 			continue;
 		}
 		if(mkdir(args[i], 0755) == 0){
-			write_log("Directory %s created successfully.", dirname);
+			log_operation(LOG_OP_CREATE_DIR, 0, dirname, NULL);
 		}else{
-			printf("Error creating directory %s\n", dirname);
+			print_message("Error creating directory %s\n", dirname);
+		}
+	}
+}
+
+static void delete_dir_task(char *args[], void *context, OutputBuffer *out){
+	(void)context;
+	char *dirname = args[0];
+	if(!directory_exists(dirname)){
+		out_printf(out, "Error : Directory %s not found\n", dirname);
+	}else if(is_dir_empty(dirname) == 0){
+		out_printf(out, "Error : Directory %s is not empty\n", dirname);
+	}else{
+		if(rmdir(dirname) == 0){
+			log_operation(LOG_OP_DELETE_DIR, 0, dirname, NULL);
+		}else{
+			out_printf(out, "Error : Could not delete the directory %s\n", dirname);
 		}
 	}
 }
@@ -34,118 +58,235 @@ void delete_dir(char * args[], size_t argc){
 		no_directory_message();
 		return;
 	}
-	
+	/* Deleting x/y before x only works in argument order */
+	if(paths_overlap(args, argc)){
+		run_tasks_in_order(delete_dir_task, args, argc, 1, NULL);
+	}else{
+		run_tasks(delete_dir_task, args, argc, 1, NULL);
+	}
+}
+
+static void list_dir_task(char *args[], void *context, OutputBuffer *out){
+	ListOptions *list_options = (ListOptions *)context;
+	char * dirname = args[0];
+	if(!directory_exists(dirname)){
+		out_printf(out, "Error : Directory %s not found\n", dirname);
+		return;
+	}
+	long count = list_directory(dirname, list_options, out);
+	if(count == -1){
+		out_printf(out, "Could not read the directory %s\n", dirname);
+	}else if(count == 0){
+		out_printf(out, "Directory %s is empty\n", dirname);
+	}else{
+		log_operation(LOG_OP_LIST_DIR, 0, dirname, NULL);
+	}
+}
+
+void list_dir(char *args[], size_t argc){
+	ListOptions list_options;
+	memset(&list_options, 0, sizeof(list_options));
+	list_options.memory_budget = DEFAULT_SORT_MEMORY_BUDGET;
+
+	size_t num_dirs = 0;
 	for(size_t i = 0; i < argc; ++i){
-		pid_t pid = fork();
-		if(pid < 0){
-			printf("Error : fork failed!\n");
-		}else if(pid == 0){
-			char *dirname = args[i];
-			if(!directory_exists(dirname)){
-				printf("Error : Directory %s not found\n", dirname);
-			}else if(is_dir_empty(dirname) == 0){
-				printf("Error : Directory %s is not empty\n", dirname);
-			}else{
-				if(rmdir(dirname) == 0){
-					write_log("Directory %s deleted successfully.", dirname);
-				}else{
-					printf("Error : Could not delete the directory %s\n", dirname);
-				}
+		if(strncmp(args[i], "--", 2) == 0){
+			if(parse_list_option(args[i], &list_options) == -1){
+				print_message("Error : Unknown option %s\n", args[i]);
+				return;
 			}
-			exit(0);
 		}else{
-			wait(NULL);
+			args[num_dirs++] = args[i];
 		}
 	}
+	if(num_dirs == 0){
+		no_directory_message();
+		return;
+	}
+	run_tasks(list_dir_task, args, num_dirs, 1, &list_options);
 }
 
-void list_dir(char *args[], size_t argc){
-	if(argc == 0){
-		no_directory_message();
+static void print_extension_counts(OutputBuffer *out, const ExtensionSet *set, const size_t *counts, const char *path){
+	for(size_t i = 0; i < set->count; ++i){
+		out_printf(out, "%zu entries with the extension %s found in %s\n", counts[i], set->names[i], path);
+	}
+}
+
+static void list_dir_by_extension_task(char *args[], void *context, OutputBuffer *out){
+	int use_extension_cache = *(int *)context;
+	char* path = args[0];
+	char *target_extension = args[1];
+	if(!directory_exists(path)){
+		out_printf(out, "Error : Directory %s not found\n", path);
 		return;
 	}
-	
-	for(size_t i = 0; i < argc; ++i){
-		pid_t pid = fork();
-	
-		if(pid < 0){
-			printf("Error : fork failed!\n");
-		}else if(pid == 0){
-			char * dirname = args[i];
-			if(!directory_exists(dirname)){
-				printf("Error : Directory %s not found\n", dirname);
-			}else if(is_dir_empty(dirname) != 0){
-				printf("Directory %s is empty\n", dirname);
-			}else{
-				struct dirent *entry;
-				DIR *dir = opendir(dirname);
-				if(dir == NULL){
-					printf("Could not read the directory %s\n", dirname);
-					exit(1);
-				}
-				while((entry = readdir(dir)) != NULL){
-					printf("%s\n", entry->d_name);
-				}
-				write_log("Entries of %s is displayed.", dirname);
-				closedir(dir);
-				exit(0);
-			}
+	ExtensionSet set;
+	if(ext_set_init(&set, target_extension) == -1){
+		out_printf(out, "Error : Invalid extension list %s\n", target_extension);
+		return;
+	}
+	size_t counts[MAX_EXTENSIONS] = {0};
+	size_t total = 0;
+	if(use_extension_cache){
+		long cached = ext_cache_query(path, &set, out, counts);
+		if(cached == -1){
+			out_printf(out, "Could not read the directory %s\n", path);
+		}else if(cached == 0){
+			out_printf(out, "Error : No files with the extension %s found in %s\n", target_extension, path);
 		}else{
-			wait(NULL);
+			if(set.count > 1){
+				print_extension_counts(out, &set, counts, path);
+			}
+			log_operation(LOG_OP_LIST_BY_EXTENSION, 0, path, target_extension);
+		}
+		ext_set_free(&set);
+		return;
+	}
+	DirReader reader;
+	if(dir_reader_open(&reader, AT_FDCWD, path) == -1){
+		out_printf(out, "Could not read the directory %s\n", path);
+		ext_set_free(&set);
+		return;
+	}
+	DirEntry *entry;
+	while((entry = dir_reader_next(&reader)) != NULL){
+		int index = ext_set_match(&set, entry->d_name);
+		if(index >= 0 && !is_dot_entry(entry->d_name)){
+			out_printf(out, "%s\n", entry->d_name);
+			counts[index]++;
+			total++;
+		}
+	}
+	dir_reader_close(&reader);
+	if(total == 0){
+		out_printf(out, "Error : No files with the extension %s found in %s\n", target_extension, path);
+	}else{
+		if(set.count > 1){
+			print_extension_counts(out, &set, counts, path);
 		}
+		log_operation(LOG_OP_LIST_BY_EXTENSION, 0, path, target_extension);
 	}
+	ext_set_free(&set);
+}
+
+typedef struct{
+	ExtensionSet set;
+	pthread_mutex_t output_lock;
+} ExtensionSearch;
 
+typedef struct{
+	OutputBuffer out;
+	size_t counts[MAX_EXTENSIONS];
+} ExtensionWorker;
+
+static int extension_search_entry(WalkWorker *worker, WalkDir *dir, const char *name, unsigned char type, void *user){
+	(void)type;
+	ExtensionSearch *search = (ExtensionSearch *)user;
+	ExtensionWorker *state = (ExtensionWorker *)worker->data;
+	int index = ext_set_match(&search->set, name);
+	if(index >= 0){
+		state->counts[index]++;
+		out_printf(&state->out, "%s/%s\n", dir->path, name);
+	}
+	return 1;
 }
 
-void list_dir_by_extension(char *args[], size_t argc){
-	if((argc % 2) != 0){
-		printf("Error : Invalid number of arguments\n");
+static void extension_search_error(WalkWorker *worker, const char *path, int error, void *user){
+	(void)user;
+	ExtensionWorker *state = (ExtensionWorker *)worker->data;
+	out_printf(&state->out, "Error : Could not read the directory %s (%s)\n", path, strerror(error));
+}
+
+static void list_dir_by_extension_recursive(char *path, char *target_extension){
+	if(!directory_exists(path)){
+		print_message("Error : Directory %s not found\n", path);
 		return;
 	}
-	
-	for(size_t i = 0; i < argc; i += 2){
-		pid_t pid = fork();
-		
-		if(pid < 0){
-			printf("Error : Fork failed\n");
-		}else if(pid == 0){
-			char* path = args[i];
-			char *target_extension = args[i + 1];
-			if(!directory_exists(path)){
-				printf("Error : Directory %s not found\n", path);
-			}else if(is_dir_empty(path) != 0){
-				printf("Directory %s is not empty\n", path);
-			}else{
-				struct dirent *entry;
-				DIR *dir = opendir(path);	
-				if(dir == NULL){
-					printf("Could not read the directory %s\n", path);
-					exit(1);
-				}
-				int count = 0;
-				while((entry = readdir(dir)) != NULL){
-					char *entry_extension = get_file_extension(entry->d_name);
-					if(entry_extension && strcmp(entry_extension, target_extension) == 0){
-						printf("%s\n", entry->d_name);
-						count++;
-					}
-				}
-				if(count == 0){
-					printf("Error : No files with the extension %s found in %s\n", target_extension, path);
-				}else{
-					write_log("Entries with the extension %s of %s is displayed.", target_extension, path);
-				}
-				closedir(dir);
-				exit(0);	 
-			}
+	ExtensionSearch search;
+	if(ext_set_init(&search.set, target_extension) == -1){
+		print_message("Error : Invalid extension list %s\n", target_extension);
+		return;
+	}
+	size_t num_threads = pool_default_threads();
+	WalkWorker *workers = calloc(num_threads, sizeof(WalkWorker));
+	ExtensionWorker *states = calloc(num_threads, sizeof(ExtensionWorker));
+	if(workers == NULL || states == NULL){
+		print_message("Memory allocation failed!\n");
+		free(workers);
+		free(states);
+		ext_set_free(&search.set);
+		return;
+	}
+	pthread_mutex_init(&search.output_lock, NULL);
+	for(size_t i = 0; i < num_threads; ++i){
+		out_init(&states[i].out, output_fd());
+		states[i].out.flush_lock = &search.output_lock;
+		workers[i].data = &states[i];
+	}
+
+	WalkOptions options;
+	memset(&options, 0, sizeof(options));
+	options.num_threads = num_threads;
+	options.user = &search;
+	options.on_entry = extension_search_entry;
+	options.on_error = extension_search_error;
+	fflush(stdout);
+	tree_walk(&path, 1, &options, workers);
+
+	size_t counts[MAX_EXTENSIONS] = {0};
+	size_t total = 0;
+	for(size_t i = 0; i < num_threads; ++i){
+		out_flush(&states[i].out);
+		out_free(&states[i].out);
+		for(size_t j = 0; j < search.set.count; ++j){
+			counts[j] += states[i].counts[j];
+			total += states[i].counts[j];
+		}
+	}
+	if(total == 0){
+		print_message("Error : No files with the extension %s found in %s\n", target_extension, path);
+	}else{
+		OutputBuffer out;
+		out_init(&out, output_fd());
+		print_extension_counts(&out, &search.set, counts, path);
+		out_flush(&out);
+		out_free(&out);
+		log_operation(LOG_OP_LIST_BY_EXTENSION, LOG_FLAG_RECURSIVE, path, target_extension);
+	}
+	pthread_mutex_destroy(&search.output_lock);
+	free(workers);
+	free(states);
+	ext_set_free(&search.set);
+}
+
+void list_dir_by_extension(char *args[], size_t argc){
+	int recursive = 0;
+	int use_extension_cache = 0;
+	size_t num_args = 0;
+	for(size_t i = 0; i < argc; ++i){
+		if(strcmp(args[i], "-r") == 0 || strcmp(args[i], "--recursive") == 0){
+			recursive = 1;
+		}else if(strcmp(args[i], "--cache") == 0){
+			use_extension_cache = 1;
 		}else{
-			wait(NULL);
+			args[num_args++] = args[i];
 		}
 	}
+	if(num_args == 0 || (num_args % 2) != 0){
+		print_message("Error : Invalid number of arguments\n");
+		return;
+	}
+	if(!recursive){
+		run_tasks(list_dir_by_extension_task, args, num_args / 2, 2, &use_extension_cache);
+		return;
+	}
+	for(size_t i = 0; i < num_args; i += 2){
+		list_dir_by_extension_recursive(args[i], args[i + 1]);
+	}
 }
 
 void no_directory_message(){
-	printf("Error : Directory name is not provided\n");
+	print_message("Error : Directory name is not provided\n");
 }
 
 int directory_exists(char *path){
@@ -154,20 +295,20 @@ int directory_exists(char *path){
 }
 
 int is_dir_empty(char *path){
-	struct dirent* entry;
-	int count = 0;
-	
-	DIR *dir = opendir(path);
-	if(!dir){return -1;}
-	
-	while((entry = readdir(dir)) != NULL){
-		if(++count > 2){
-			closedir(dir);
-			return 0;
+	DirReader reader;
+	if(dir_reader_open(&reader, AT_FDCWD, path) == -1){
+		return -1;
+	}
+	DirEntry *entry;
+	int empty = 1;
+	while((entry = dir_reader_next(&reader)) != NULL){
+		if(!is_dot_entry(entry->d_name)){
+			empty = 0;
+			break;
 		}
 	}
-	closedir(dir);
-	return 1;
+	dir_reader_close(&reader);
+	return empty;
 }
 
 char *get_file_extension(char *filename){
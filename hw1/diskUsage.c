@@ -0,0 +1,298 @@
+#define _GNU_SOURCE
+#include "diskUsage.h"
+#include "directoryUtils.h"
+#include "treeWalk.h"
+#include "threadPool.h"
+#include "outputBuffer.h"
+#include "logger.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <time.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+
+typedef struct{
+	atomic_ullong bytes;
+	atomic_ullong files;
+	atomic_ullong dirs;
+} DuDir;
+
+typedef struct{
+	InodeSet inodes;
+	pthread_mutex_t output_lock;
+	int summary;
+	int apparent;
+	int human;
+	long max_depth;
+	unsigned long long root_bytes;
+	unsigned long long root_files;
+	unsigned long long root_dirs;
+} DiskUsage;
+
+typedef struct{
+	OutputBuffer out;
+} DuWorker;
+
+static uint64_t inode_hash(uint64_t dev, uint64_t ino){
+	uint64_t hash = ino ^ (dev * 0x9e3779b97f4a7c15ULL);
+	hash ^= hash >> 30;
+	hash *= 0xbf58476d1ce4e5b9ULL;
+	hash ^= hash >> 27;
+	hash *= 0x94d049bb133111ebULL;
+	hash ^= hash >> 31;
+	return hash;
+}
+
+void inode_set_init(InodeSet *set){
+	for(size_t i = 0; i < INODE_SET_STRIPES; ++i){
+		pthread_mutex_init(&set->stripes[i].mutex, NULL);
+		set->stripes[i].keys = NULL;
+		set->stripes[i].count = 0;
+		set->stripes[i].capacity = 0;
+	}
+}
+
+void inode_set_free(InodeSet *set){
+	for(size_t i = 0; i < INODE_SET_STRIPES; ++i){
+		pthread_mutex_destroy(&set->stripes[i].mutex);
+		free(set->stripes[i].keys);
+	}
+}
+
+static int stripe_grow(InodeStripe *stripe){
+	size_t new_capacity = stripe->capacity ? stripe->capacity * 2 : INODE_STRIPE_INITIAL_CAPACITY;
+	InodeKey *keys = calloc(new_capacity, sizeof(InodeKey));
+	if(keys == NULL){
+		return -1;
+	}
+	size_t mask = new_capacity - 1;
+	for(size_t i = 0; i < stripe->capacity; ++i){
+		InodeKey *key = &stripe->keys[i];
+		if(key->dev == 0 && key->ino == 0){
+			continue;
+		}
+		size_t slot = inode_hash(key->dev, key->ino) & mask;
+		while(keys[slot].dev != 0 || keys[slot].ino != 0){
+			slot = (slot + 1) & mask;
+		}
+		keys[slot] = *key;
+	}
+	free(stripe->keys);
+	stripe->keys = keys;
+	stripe->capacity = new_capacity;
+	return 0;
+}
+
+/* Returns 1 the first time an inode is seen, 0 afterwards. */
+int inode_set_insert(InodeSet *set, uint64_t dev, uint64_t ino){
+	uint64_t hash = inode_hash(dev, ino);
+	InodeStripe *stripe = &set->stripes[hash >> 56];
+	pthread_mutex_lock(&stripe->mutex);
+	if((stripe->count + 1) * 4 > stripe->capacity * 3 && stripe_grow(stripe) == -1){
+		pthread_mutex_unlock(&stripe->mutex);
+		return -1;
+	}
+	size_t mask = stripe->capacity - 1;
+	size_t slot = hash & mask;
+	int inserted = 1;
+	while(stripe->keys[slot].dev != 0 || stripe->keys[slot].ino != 0){
+		if(stripe->keys[slot].dev == dev && stripe->keys[slot].ino == ino){
+			inserted = 0;
+			break;
+		}
+		slot = (slot + 1) & mask;
+	}
+	if(inserted){
+		stripe->keys[slot].dev = dev;
+		stripe->keys[slot].ino = ino;
+		stripe->count++;
+	}
+	pthread_mutex_unlock(&stripe->mutex);
+	return inserted;
+}
+
+static void format_size(unsigned long long bytes, int human, char *buffer, size_t size){
+	if(!human){
+		snprintf(buffer, size, "%llu", bytes);
+		return;
+	}
+	const char *units = "BKMGTPE";
+	double value = (double)bytes;
+	size_t unit = 0;
+	while(value >= 1024.0 && unit < strlen(units) - 1){
+		value /= 1024.0;
+		unit++;
+	}
+	if(unit == 0){
+		snprintf(buffer, size, "%llu", bytes);
+	}else if(value < 10.0){
+		snprintf(buffer, size, "%.1f%c", value, units[unit]);
+	}else{
+		snprintf(buffer, size, "%.0f%c", value, units[unit]);
+	}
+}
+
+static unsigned long long usage_of(const DiskUsage *usage, const struct statx *stx){
+	return usage->apparent ? stx->stx_size : stx->stx_blocks * 512ULL;
+}
+
+static void du_dir_open(WalkWorker *worker, WalkDir *dir, void *user){
+	(void)worker;
+	DiskUsage *usage = (DiskUsage *)user;
+	DuDir *totals = (DuDir *)dir->data;
+	struct statx stx;
+	if(statx(dir->fd, "", AT_EMPTY_PATH | AT_STATX_DONT_SYNC, usage->apparent ? STATX_SIZE : STATX_BLOCKS, &stx) == 0){
+		atomic_fetch_add_explicit(&totals->bytes, usage_of(usage, &stx), memory_order_relaxed);
+	}
+	atomic_fetch_add_explicit(&totals->dirs, 1, memory_order_relaxed);
+}
+
+static int du_entry(WalkWorker *worker, WalkDir *dir, const char *name, unsigned char type, void *user){
+	(void)worker;
+	if(type == DT_DIR){
+		return 1;
+	}
+	DiskUsage *usage = (DiskUsage *)user;
+	DuDir *totals = (DuDir *)dir->data;
+	struct statx stx;
+	unsigned int mask = (usage->apparent ? STATX_SIZE : STATX_BLOCKS) | STATX_NLINK | STATX_INO;
+	if(statx(dir->fd, name, AT_SYMLINK_NOFOLLOW | AT_STATX_DONT_SYNC, mask, &stx) == -1){
+		return 0;
+	}
+	if(stx.stx_nlink > 1){
+		uint64_t dev = ((uint64_t)stx.stx_dev_major << 32) | stx.stx_dev_minor;
+		if(inode_set_insert(&usage->inodes, dev, stx.stx_ino) == 0){
+			return 0;
+		}
+	}
+	atomic_fetch_add_explicit(&totals->bytes, usage_of(usage, &stx), memory_order_relaxed);
+	atomic_fetch_add_explicit(&totals->files, 1, memory_order_relaxed);
+	return 0;
+}
+
+static void du_dir_done(WalkWorker *worker, WalkDir *dir, void *user){
+	DiskUsage *usage = (DiskUsage *)user;
+	DuWorker *state = (DuWorker *)worker->data;
+	DuDir *totals = (DuDir *)dir->data;
+	unsigned long long bytes = atomic_load(&totals->bytes);
+	unsigned long long files = atomic_load(&totals->files);
+	unsigned long long dirs = atomic_load(&totals->dirs);
+	if(dir->parent){
+		DuDir *parent = (DuDir *)dir->parent->data;
+		atomic_fetch_add_explicit(&parent->bytes, bytes, memory_order_relaxed);
+		atomic_fetch_add_explicit(&parent->files, files, memory_order_relaxed);
+		atomic_fetch_add_explicit(&parent->dirs, dirs, memory_order_relaxed);
+	}else{
+		usage->root_bytes = bytes;
+		usage->root_files = files;
+		usage->root_dirs = dirs;
+	}
+	if(usage->summary || (usage->max_depth >= 0 && dir->depth > usage->max_depth)){
+		return;
+	}
+	char size[32];
+	format_size(bytes, usage->human, size, sizeof(size));
+	out_printf(&state->out, "%s\t%s\n", size, dir->path);
+}
+
+static void du_error(WalkWorker *worker, const char *path, int error, void *user){
+	(void)user;
+	DuWorker *state = (DuWorker *)worker->data;
+	out_printf(&state->out, "Error : Could not read the directory %s (%s)\n", path, strerror(error));
+}
+
+static void disk_usage_of(char *path, DiskUsage *usage, WalkWorker *workers, DuWorker *states, size_t num_threads){
+	if(!directory_exists(path)){
+		print_message("Error : Directory %s not found\n", path);
+		return;
+	}
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	usage->root_bytes = usage->root_files = usage->root_dirs = 0;
+
+	WalkOptions options;
+	memset(&options, 0, sizeof(options));
+	options.num_threads = num_threads;
+	options.dir_data_size = sizeof(DuDir);
+	options.user = usage;
+	options.on_dir_open = du_dir_open;
+	options.on_entry = du_entry;
+	options.on_dir_done = du_dir_done;
+	options.on_error = du_error;
+	fflush(stdout);
+	tree_walk(&path, 1, &options, workers);
+	for(size_t i = 0; i < num_threads; ++i){
+		out_flush(&states[i].out);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	double seconds = (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+	char size[32];
+	format_size(usage->root_bytes, usage->human, size, sizeof(size));
+	if(usage->summary){
+		print_message("%s\t%s\n", size, path);
+	}
+	print_message("Total for %s : %s in %llu files and %llu directories (scanned in %.3f s)\n", path, size, usage->root_files, usage->root_dirs, seconds);
+	log_operation(LOG_OP_DISK_USAGE, 0, path, NULL);
+}
+
+void disk_usage(char *args[], size_t argc){
+	DiskUsage usage;
+	memset(&usage, 0, sizeof(usage));
+	usage.max_depth = -1;
+	size_t num_paths = 0;
+	for(size_t i = 0; i < argc; ++i){
+		if(strcmp(args[i], "-s") == 0 || strcmp(args[i], "--summary") == 0){
+			usage.summary = 1;
+		}else if(strcmp(args[i], "-h") == 0 || strcmp(args[i], "--human") == 0){
+			usage.human = 1;
+		}else if(strcmp(args[i], "--apparent") == 0){
+			usage.apparent = 1;
+		}else if(strncmp(args[i], "--max-depth=", 12) == 0){
+			char *end;
+			usage.max_depth = strtol(args[i] + 12, &end, 10);
+			if(*end != '\0' || end == args[i] + 12 || usage.max_depth < 0){
+				print_message("Error : Invalid depth %s\n", args[i] + 12);
+				return;
+			}
+		}else{
+			args[num_paths++] = args[i];
+		}
+	}
+	if(num_paths == 0){
+		no_directory_message();
+		return;
+	}
+
+	size_t num_threads = pool_default_threads();
+	WalkWorker *workers = calloc(num_threads, sizeof(WalkWorker));
+	DuWorker *states = calloc(num_threads, sizeof(DuWorker));
+	if(workers == NULL || states == NULL){
+		print_message("Memory allocation failed!\n");
+		free(workers);
+		free(states);
+		return;
+	}
+	inode_set_init(&usage.inodes);
+	pthread_mutex_init(&usage.output_lock, NULL);
+	for(size_t i = 0; i < num_threads; ++i){
+		out_init(&states[i].out, output_fd());
+		states[i].out.flush_lock = &usage.output_lock;
+		workers[i].data = &states[i];
+	}
+	for(size_t i = 0; i < num_paths; ++i){
+		disk_usage_of(args[i], &usage, workers, states, num_threads);
+	}
+	for(size_t i = 0; i < num_threads; ++i){
+		out_free(&states[i].out);
+	}
+	pthread_mutex_destroy(&usage.output_lock);
+	inode_set_free(&usage.inodes);
+	free(workers);
+	free(states);
+}
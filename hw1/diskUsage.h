@@ -0,0 +1,33 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#ifndef DISKUSAGE_H
+#define DISKUSAGE_H
+
+#define INODE_SET_STRIPES 256
+#define INODE_STRIPE_INITIAL_CAPACITY 1024
+
+typedef struct{
+	uint64_t dev;
+	uint64_t ino;
+} InodeKey;
+
+typedef struct{
+	pthread_mutex_t mutex;
+	InodeKey *keys;
+	size_t count;
+	size_t capacity;
+} InodeStripe;
+
+/* Hardlinked inodes seen so far, split into independently locked stripes so walkers rarely contend. */
+typedef struct{
+	InodeStripe stripes[INODE_SET_STRIPES];
+} InodeSet;
+
+void inode_set_init(InodeSet *set);
+void inode_set_free(InodeSet *set);
+int inode_set_insert(InodeSet *set, uint64_t dev, uint64_t ino);
+
+void disk_usage(char *args[], size_t argc);
+
+#endif
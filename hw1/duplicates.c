@@ -0,0 +1,565 @@
+#define _GNU_SOURCE
+#include "duplicates.h"
+#include "diskUsage.h"
+#include "directoryUtils.h"
+#include "treeWalk.h"
+#include "threadPool.h"
+#include "outputBuffer.h"
+#include "logger.h"
+#include "utilities.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define XXH_PRIME1 0x9E3779B185EBCA87ULL
+#define XXH_PRIME2 0xC2B2AE3D27D4EB4FULL
+#define XXH_PRIME3 0x165667B19E3779F9ULL
+#define XXH_PRIME4 0x85EBCA77C2B2AE63ULL
+#define XXH_PRIME5 0x27D4EB2F165667C5ULL
+
+enum{
+	STAGE_EDGES,
+	STAGE_FULL,
+	STAGE_VERIFY
+};
+
+typedef struct{
+	DupFile *files;
+	size_t count;
+	size_t capacity;
+} DupList;
+
+typedef struct{
+	InodeSet inodes;
+} DupSearch;
+
+typedef struct{
+	DupList list;
+	int failed;
+} DupWorker;
+
+typedef struct{
+	DupFile *files;
+	size_t count;
+	int stage;
+} HashJob;
+
+static uint64_t rotl64(uint64_t value, int bits){
+	return (value << bits) | (value >> (64 - bits));
+}
+
+static uint64_t read64(const unsigned char *p){
+	uint64_t value;
+	memcpy(&value, p, sizeof(value));
+	return value;
+}
+
+static uint32_t read32(const unsigned char *p){
+	uint32_t value;
+	memcpy(&value, p, sizeof(value));
+	return value;
+}
+
+static uint64_t xxh_round(uint64_t acc, uint64_t input){
+	acc += input * XXH_PRIME2;
+	acc = rotl64(acc, 31);
+	return acc * XXH_PRIME1;
+}
+
+static uint64_t xxh_merge(uint64_t acc, uint64_t value){
+	acc ^= xxh_round(0, value);
+	return acc * XXH_PRIME1 + XXH_PRIME4;
+}
+
+uint64_t xxh64(const void *data, size_t len, uint64_t seed){
+	const unsigned char *p = (const unsigned char *)data;
+	const unsigned char *end = p + len;
+	uint64_t hash;
+	if(len >= 32){
+		uint64_t v1 = seed + XXH_PRIME1 + XXH_PRIME2;
+		uint64_t v2 = seed + XXH_PRIME2;
+		uint64_t v3 = seed;
+		uint64_t v4 = seed - XXH_PRIME1;
+		const unsigned char *limit = end - 32;
+		do{
+			v1 = xxh_round(v1, read64(p));
+			v2 = xxh_round(v2, read64(p + 8));
+			v3 = xxh_round(v3, read64(p + 16));
+			v4 = xxh_round(v4, read64(p + 24));
+			p += 32;
+		}while(p <= limit);
+		hash = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+		hash = xxh_merge(hash, v1);
+		hash = xxh_merge(hash, v2);
+		hash = xxh_merge(hash, v3);
+		hash = xxh_merge(hash, v4);
+	}else{
+		hash = seed + XXH_PRIME5;
+	}
+	hash += (uint64_t)len;
+	while(p + 8 <= end){
+		hash ^= xxh_round(0, read64(p));
+		hash = rotl64(hash, 27) * XXH_PRIME1 + XXH_PRIME4;
+		p += 8;
+	}
+	if(p + 4 <= end){
+		hash ^= (uint64_t)read32(p) * XXH_PRIME1;
+		hash = rotl64(hash, 23) * XXH_PRIME2 + XXH_PRIME3;
+		p += 4;
+	}
+	while(p < end){
+		hash ^= (*p) * XXH_PRIME5;
+		hash = rotl64(hash, 11) * XXH_PRIME1;
+		p++;
+	}
+	hash ^= hash >> 33;
+	hash *= XXH_PRIME2;
+	hash ^= hash >> 29;
+	hash *= XXH_PRIME3;
+	hash ^= hash >> 32;
+	return hash;
+}
+
+static int dup_list_push(DupList *list, char *path, uint64_t size){
+	if(list->count == list->capacity){
+		size_t new_capacity = list->capacity ? list->capacity * 2 : DUP_INITIAL_CAPACITY;
+		DupFile *files = realloc(list->files, new_capacity * sizeof(DupFile));
+		if(files == NULL){
+			return -1;
+		}
+		list->files = files;
+		list->capacity = new_capacity;
+	}
+	DupFile *file = &list->files[list->count++];
+	file->path = path;
+	file->size = size;
+	file->hash = 0;
+	file->match = 0;
+	file->error = 0;
+	return 0;
+}
+
+static int dup_entry(WalkWorker *worker, WalkDir *dir, const char *name, unsigned char type, void *user){
+	if(type == DT_DIR){
+		return 1;
+	}
+	if(type != DT_REG){
+		return 0;
+	}
+	DupSearch *search = (DupSearch *)user;
+	DupWorker *state = (DupWorker *)worker->data;
+	struct statx stx;
+	if(statx(dir->fd, name, AT_SYMLINK_NOFOLLOW | AT_STATX_DONT_SYNC, STATX_SIZE | STATX_NLINK | STATX_INO, &stx) == -1 || stx.stx_size == 0){
+		return 0;
+	}
+	/* Only the first path to an inode is a candidate, whatever its link count, so no file is its own duplicate. */
+	uint64_t dev = ((uint64_t)stx.stx_dev_major << 32) | stx.stx_dev_minor;
+	if(inode_set_insert(&search->inodes, dev, stx.stx_ino) == 0){
+		return 0;
+	}
+	size_t dir_len = strlen(dir->path);
+	int needs_slash = dir_len > 0 && dir->path[dir_len - 1] != '/';
+	size_t name_len = strlen(name);
+	char *path = malloc(dir_len + needs_slash + name_len + 1);
+	if(path == NULL || dup_list_push(&state->list, path, stx.stx_size) == -1){
+		free(path);
+		state->failed = 1;
+		return 0;
+	}
+	memcpy(path, dir->path, dir_len);
+	if(needs_slash){
+		path[dir_len] = '/';
+	}
+	memcpy(path + dir_len + needs_slash, name, name_len + 1);
+	return 0;
+}
+
+static void dup_error(WalkWorker *worker, const char *path, int error, void *user){
+	(void)worker;
+	(void)user;
+	print_message("Error : Could not read the directory %s (%s)\n", path, strerror(error));
+}
+
+static int hash_edges(int fd, DupFile *file){
+	unsigned char buffer[2 * DUP_EDGE_BLOCK_SIZE];
+	size_t head = file->size <= sizeof(buffer) ? (size_t)file->size : DUP_EDGE_BLOCK_SIZE;
+	ssize_t got = pread(fd, buffer, head, 0);
+	if(got != (ssize_t)head){
+		return -1;
+	}
+	size_t total = head;
+	if(file->size > sizeof(buffer)){
+		got = pread(fd, buffer + head, DUP_EDGE_BLOCK_SIZE, (off_t)(file->size - DUP_EDGE_BLOCK_SIZE));
+		if(got != DUP_EDGE_BLOCK_SIZE){
+			return -1;
+		}
+		total += DUP_EDGE_BLOCK_SIZE;
+	}
+	file->hash = xxh64(buffer, total, file->size);
+	return 0;
+}
+
+static int hash_contents(int fd, DupFile *file){
+	void *data = mmap(NULL, (size_t)file->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if(data == MAP_FAILED){
+		return -1;
+	}
+	madvise(data, (size_t)file->size, MADV_SEQUENTIAL);
+	file->hash = xxh64(data, (size_t)file->size, file->size);
+	munmap(data, (size_t)file->size);
+	return 0;
+}
+
+static int open_candidate(DupFile *file){
+	int fd = open(file->path, O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+	if(fd == -1){
+		file->error = errno;
+	}
+	return fd;
+}
+
+/* Returns 1 when both files hold the same bytes, 0 when they differ, -1 when either could not be read. */
+static int compare_contents(DupFile *left, DupFile *right, unsigned char *buffers){
+	int left_fd = open_candidate(left);
+	if(left_fd == -1){
+		return -1;
+	}
+	int right_fd = open_candidate(right);
+	if(right_fd == -1){
+		close(left_fd);
+		return -1;
+	}
+	int result = 1;
+	for(uint64_t offset = 0; offset < left->size && result == 1;){
+		size_t chunk = left->size - offset < DUP_COMPARE_BLOCK_SIZE ? (size_t)(left->size - offset) : DUP_COMPARE_BLOCK_SIZE;
+		ssize_t left_got = pread(left_fd, buffers, chunk, (off_t)offset);
+		ssize_t right_got = pread(right_fd, buffers + DUP_COMPARE_BLOCK_SIZE, chunk, (off_t)offset);
+		if(left_got != (ssize_t)chunk){
+			left->error = left_got == -1 ? errno : EIO;
+			result = -1;
+		}else if(right_got != (ssize_t)chunk){
+			right->error = right_got == -1 ? errno : EIO;
+			result = -1;
+		}else if(memcmp(buffers, buffers + DUP_COMPARE_BLOCK_SIZE, chunk) != 0){
+			result = 0;
+		}
+		offset += chunk;
+	}
+	close(left_fd);
+	close(right_fd);
+	return result;
+}
+
+/*
+ * A matching hash is only a strong hint, so the files of one hash group are
+ * compared byte for byte against the first file of every distinct content.
+ */
+static void verify_group(DupFile *files, size_t count){
+	unsigned char *buffers = malloc(2 * DUP_COMPARE_BLOCK_SIZE);
+	if(buffers == NULL){
+		for(size_t i = 0; i < count; ++i){
+			files[i].error = ENOMEM;
+		}
+		return;
+	}
+	for(size_t i = 0; i < count; ++i){
+		files[i].match = i;
+		for(size_t j = 0; j < i && !files[i].error; ++j){
+			if(files[j].error || files[j].match != j){
+				continue;
+			}
+			if(compare_contents(&files[j], &files[i], buffers) == 1){
+				files[i].match = j;
+				break;
+			}
+		}
+	}
+	free(buffers);
+}
+
+static void hash_job(void *arg){
+	HashJob *job = (HashJob *)arg;
+	if(job->stage == STAGE_VERIFY){
+		verify_group(job->files, job->count);
+		return;
+	}
+	for(size_t i = 0; i < job->count; ++i){
+		DupFile *file = &job->files[i];
+		int fd = open(file->path, O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+		if(fd == -1){
+			file->error = errno;
+			continue;
+		}
+		int result = job->stage == STAGE_EDGES ? hash_edges(fd, file) : hash_contents(fd, file);
+		if(result == -1){
+			file->error = errno ? errno : EIO;
+		}
+		close(fd);
+	}
+}
+
+/* Hashes every file in the list, DUP_HASH_CHUNK files per pool task. */
+static void hash_files(ThreadPool *pool, DupFile *files, size_t count, int stage){
+	size_t num_jobs = (count + DUP_HASH_CHUNK - 1) / DUP_HASH_CHUNK;
+	HashJob *jobs = malloc(num_jobs * sizeof(HashJob));
+	if(jobs == NULL){
+		HashJob job = {files, count, stage};
+		hash_job(&job);
+		return;
+	}
+	for(size_t i = 0; i < num_jobs; ++i){
+		jobs[i].files = files + i * DUP_HASH_CHUNK;
+		jobs[i].count = i + 1 == num_jobs ? count - i * DUP_HASH_CHUNK : DUP_HASH_CHUNK;
+		jobs[i].stage = stage;
+		if(pool == NULL || pool_submit(pool, hash_job, &jobs[i]) == -1){
+			hash_job(&jobs[i]);
+		}
+	}
+	if(pool){
+		pool_wait(pool);
+	}
+	free(jobs);
+}
+
+/* Verifies every hash group, one pool task per group. */
+static void verify_files(ThreadPool *pool, DupFile *files, size_t count){
+	size_t num_groups = 0;
+	for(size_t i = 0; i < count; ++i){
+		if(i == 0 || files[i].size != files[i - 1].size || files[i].hash != files[i - 1].hash){
+			num_groups++;
+		}
+	}
+	HashJob *jobs = malloc((num_groups ? num_groups : 1) * sizeof(HashJob));
+	size_t group = 0;
+	for(size_t i = 0; i < count;){
+		size_t j = i + 1;
+		while(j < count && files[j].size == files[i].size && files[j].hash == files[i].hash){
+			j++;
+		}
+		HashJob local = {files + i, j - i, STAGE_VERIFY};
+		if(jobs == NULL){
+			hash_job(&local);
+		}else{
+			jobs[group] = local;
+			if(pool == NULL || pool_submit(pool, hash_job, &jobs[group]) == -1){
+				hash_job(&jobs[group]);
+			}
+			group++;
+		}
+		i = j;
+	}
+	if(pool){
+		pool_wait(pool);
+	}
+	free(jobs);
+}
+
+static int compare_by_size(const void *a, const void *b){
+	const DupFile *left = (const DupFile *)a;
+	const DupFile *right = (const DupFile *)b;
+	if(left->size != right->size){
+		return left->size < right->size ? -1 : 1;
+	}
+	return strcmp(left->path, right->path);
+}
+
+static int compare_by_hash(const void *a, const void *b){
+	const DupFile *left = (const DupFile *)a;
+	const DupFile *right = (const DupFile *)b;
+	if(left->size != right->size){
+		return left->size < right->size ? -1 : 1;
+	}
+	if(left->hash != right->hash){
+		return left->hash < right->hash ? -1 : 1;
+	}
+	if(left->match != right->match){
+		return left->match < right->match ? -1 : 1;
+	}
+	return strcmp(left->path, right->path);
+}
+
+static int same_group(const DupFile *a, const DupFile *b, int use_hash){
+	return a->size == b->size && (!use_hash || (a->hash == b->hash && a->match == b->match));
+}
+
+/*
+ * Keeps only files that share their size (and hash) with at least one other
+ * file, compacting the survivors to the front of the array.
+ */
+static size_t keep_collisions(DupFile *files, size_t count, int use_hash){
+	size_t readable = 0;
+	for(size_t i = 0; i < count; ++i){
+		if(files[i].error){
+			free(files[i].path);
+		}else{
+			files[readable++] = files[i];
+		}
+	}
+	size_t kept = 0;
+	for(size_t i = 0; i < readable;){
+		size_t j = i + 1;
+		while(j < readable && same_group(&files[i], &files[j], use_hash)){
+			j++;
+		}
+		if(j - i > 1){
+			for(size_t k = i; k < j; ++k){
+				files[kept++] = files[k];
+			}
+		}else{
+			free(files[i].path);
+		}
+		i = j;
+	}
+	return kept;
+}
+
+void find_duplicates(char *args[], size_t argc){
+	if(argc == 0){
+		no_directory_message();
+		return;
+	}
+	for(size_t i = 0; i < argc; ++i){
+		if(!directory_exists(args[i])){
+			print_message("Error : Directory %s not found\n", args[i]);
+			return;
+		}
+	}
+	/* A root named twice or inside another would be walked twice. */
+	int roots = drop_nested_paths(args, argc);
+	if(roots == -1){
+		print_message("Memory allocation failed!\n");
+		return;
+	}
+	argc = (size_t)roots;
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	size_t num_threads = pool_default_threads();
+	WalkWorker *workers = calloc(num_threads, sizeof(WalkWorker));
+	DupWorker *states = calloc(num_threads, sizeof(DupWorker));
+	DupSearch *search = malloc(sizeof(DupSearch));
+	if(workers == NULL || states == NULL || search == NULL){
+		print_message("Memory allocation failed!\n");
+		free(workers);
+		free(states);
+		free(search);
+		return;
+	}
+	inode_set_init(&search->inodes);
+	for(size_t i = 0; i < num_threads; ++i){
+		workers[i].data = &states[i];
+	}
+	WalkOptions options;
+	memset(&options, 0, sizeof(options));
+	options.num_threads = num_threads;
+	options.user = search;
+	options.on_entry = dup_entry;
+	options.on_error = dup_error;
+	tree_walk(args, argc, &options, workers);
+
+	DupList all = {NULL, 0, 0};
+	int failed = 0;
+	for(size_t i = 0; i < num_threads; ++i){
+		failed |= states[i].failed;
+		all.count += states[i].list.count;
+	}
+	all.files = malloc((all.count ? all.count : 1) * sizeof(DupFile));
+	if(all.files == NULL){
+		failed = 1;
+	}
+	size_t cursor = 0;
+	for(size_t i = 0; i < num_threads; ++i){
+		for(size_t j = 0; j < states[i].list.count; ++j){
+			if(all.files){
+				all.files[cursor++] = states[i].list.files[j];
+			}else{
+				free(states[i].list.files[j].path);
+			}
+		}
+		free(states[i].list.files);
+	}
+	free(states);
+	free(workers);
+	inode_set_free(&search->inodes);
+	free(search);
+	if(failed){
+		print_message("Memory allocation failed!\n");
+		if(all.files){
+			for(size_t i = 0; i < all.count; ++i){
+				free(all.files[i].path);
+			}
+			free(all.files);
+		}
+		return;
+	}
+	size_t scanned = all.count;
+
+	qsort(all.files, all.count, sizeof(DupFile), compare_by_size);
+	size_t count = keep_collisions(all.files, all.count, 0);
+	size_t size_candidates = count;
+
+	ThreadPool *pool = num_threads > 1 ? pool_create(num_threads) : NULL;
+	hash_files(pool, all.files, count, STAGE_EDGES);
+	qsort(all.files, count, sizeof(DupFile), compare_by_hash);
+	count = keep_collisions(all.files, count, 1);
+	size_t edge_candidates = count;
+
+	/* Files small enough to fit in the edge blocks were hashed whole already. */
+	size_t first_large = 0;
+	while(first_large < count && all.files[first_large].size <= 2 * DUP_EDGE_BLOCK_SIZE){
+		first_large++;
+	}
+	hash_files(pool, all.files + first_large, count - first_large, STAGE_FULL);
+	qsort(all.files, count, sizeof(DupFile), compare_by_hash);
+	count = keep_collisions(all.files, count, 1);
+
+	/* Files are deleted on the strength of this report, so matches are confirmed byte for byte. */
+	verify_files(pool, all.files, count);
+	if(pool){
+		pool_destroy(pool);
+	}
+	qsort(all.files, count, sizeof(DupFile), compare_by_hash);
+	count = keep_collisions(all.files, count, 1);
+
+	OutputBuffer out;
+	out_init(&out, output_fd());
+	size_t groups = 0;
+	size_t redundant = 0;
+	unsigned long long wasted = 0;
+	for(size_t i = 0; i < count;){
+		size_t j = i + 1;
+		while(j < count && same_group(&all.files[i], &all.files[j], 1)){
+			j++;
+		}
+		groups++;
+		redundant += j - i - 1;
+		wasted += (unsigned long long)(j - i - 1) * all.files[i].size;
+		out_printf(&out, "Duplicate group %zu (%zu files, %llu bytes each):\n", groups, j - i, (unsigned long long)all.files[i].size);
+		for(size_t k = i; k < j; ++k){
+			out_printf(&out, "  %s\n", all.files[k].path);
+			free(all.files[k].path);
+		}
+		i = j;
+	}
+	free(all.files);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	double seconds = (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+	if(groups == 0){
+		out_printf(&out, "No duplicate files found\n");
+	}else{
+		out_printf(&out, "%zu redundant files in %zu groups, %llu bytes wasted\n", redundant, groups, wasted);
+	}
+	out_printf(&out, "Scanned %zu files, %zu shared a size, %zu matched on the first/last blocks (%.3f s)\n", scanned, size_candidates, edge_candidates, seconds);
+	out_flush(&out);
+	out_free(&out);
+	for(size_t i = 0; i < argc; ++i){
+		log_operation(LOG_OP_FIND_DUPLICATES, 0, args[i], NULL);
+	}
+}
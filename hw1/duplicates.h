@@ -0,0 +1,22 @@
+#include <stddef.h>
+#include <stdint.h>
+#ifndef DUPLICATES_H
+#define DUPLICATES_H
+
+#define DUP_EDGE_BLOCK_SIZE 4096
+#define DUP_HASH_CHUNK 64
+#define DUP_INITIAL_CAPACITY 4096
+#define DUP_COMPARE_BLOCK_SIZE (64 * 1024)
+
+typedef struct{
+	char *path;
+	uint64_t size;
+	uint64_t hash;
+	size_t match;	/* index of the first file in its hash group with the same bytes */
+	int error;
+} DupFile;
+
+uint64_t xxh64(const void *data, size_t len, uint64_t seed);
+void find_duplicates(char *args[], size_t argc);
+
+#endif
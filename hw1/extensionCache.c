@@ -0,0 +1,310 @@
+#define _GNU_SOURCE
+#include "extensionCache.h"
+#include "dirListing.h"
+#include "directoryUtils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+typedef struct{
+	char *name;
+	size_t name_len;
+	const char *extension;
+	size_t ext_len;
+	uint64_t hash;
+	size_t order;
+} CacheEntry;
+
+typedef struct{
+	CacheEntry *entries;
+	size_t count;
+	size_t capacity;
+} CacheEntries;
+
+static int cache_directory(char *buffer, size_t size){
+	const char *base = getenv("FILEMANAGER_CACHE_DIR");
+	int written;
+	if(base){
+		written = snprintf(buffer, size, "%s", base);
+	}else if((base = getenv("XDG_CACHE_HOME")) != NULL){
+		written = snprintf(buffer, size, "%s/%s", base, EXT_CACHE_DIR_NAME);
+	}else if((base = getenv("HOME")) != NULL){
+		written = snprintf(buffer, size, "%s/.cache", base);
+		if(written > 0 && (size_t)written < size){
+			mkdir(buffer, 0700);
+		}
+		written = snprintf(buffer, size, "%s/.cache/%s", base, EXT_CACHE_DIR_NAME);
+	}else{
+		written = snprintf(buffer, size, "/tmp/%s-cache-%d", EXT_CACHE_DIR_NAME, (int)getuid());
+	}
+	if(written < 0 || (size_t)written >= size){
+		return -1;
+	}
+	if(mkdir(buffer, 0700) == -1 && errno != EEXIST){
+		return -1;
+	}
+	return 0;
+}
+
+static int compare_cache_entries(const void *a, const void *b){
+	const CacheEntry *left = (const CacheEntry *)a;
+	const CacheEntry *right = (const CacheEntry *)b;
+	if(left->hash != right->hash){
+		return left->hash < right->hash ? -1 : 1;
+	}
+	size_t min_len = left->ext_len < right->ext_len ? left->ext_len : right->ext_len;
+	int cmp = memcmp(left->extension, right->extension, min_len);
+	if(cmp != 0 || left->ext_len != right->ext_len){
+		return cmp != 0 ? cmp : (left->ext_len < right->ext_len ? -1 : 1);
+	}
+	return left->order < right->order ? -1 : (left->order > right->order);
+}
+
+static int same_group(const CacheEntry *a, const CacheEntry *b){
+	return a->hash == b->hash && a->ext_len == b->ext_len && memcmp(a->extension, b->extension, a->ext_len) == 0;
+}
+
+static int collect_entries(int dir_fd, CacheEntries *entries){
+	DirReader reader;
+	if(dir_reader_from_fd(&reader, dir_fd) == -1){
+		return -1;
+	}
+	DirEntry *entry;
+	int result = 0;
+	while((entry = dir_reader_next(&reader)) != NULL){
+		if(is_dot_entry(entry->d_name)){
+			continue;
+		}
+		char *extension = get_file_extension(entry->d_name);
+		if(extension == NULL){
+			continue;
+		}
+		if(entries->count == entries->capacity){
+			size_t new_capacity = entries->capacity ? entries->capacity * 2 : 1024;
+			CacheEntry *grown = realloc(entries->entries, new_capacity * sizeof(CacheEntry));
+			if(grown == NULL){
+				result = -1;
+				break;
+			}
+			entries->entries = grown;
+			entries->capacity = new_capacity;
+		}
+		CacheEntry *cached = &entries->entries[entries->count];
+		cached->name_len = strlen(entry->d_name);
+		cached->name = strdup(entry->d_name);
+		if(cached->name == NULL){
+			result = -1;
+			break;
+		}
+		cached->extension = cached->name + (extension - entry->d_name);
+		cached->ext_len = cached->name_len - (size_t)(extension - entry->d_name);
+		cached->hash = hash_string(cached->extension, cached->ext_len);
+		cached->order = entries->count;
+		entries->count++;
+	}
+	if(reader.error){
+		result = -1;
+	}
+	dir_reader_close(&reader);
+	return result;
+}
+
+static char *build_image(const ExtCacheHeader *base_header, CacheEntries *entries, size_t *image_size){
+	qsort(entries->entries, entries->count, sizeof(CacheEntry), compare_cache_entries);
+	size_t num_groups = 0;
+	size_t strings_size = 0;
+	for(size_t i = 0; i < entries->count; ++i){
+		if(i == 0 || !same_group(&entries->entries[i - 1], &entries->entries[i])){
+			num_groups++;
+			strings_size += entries->entries[i].ext_len;
+		}
+		strings_size += entries->entries[i].name_len + 1;
+	}
+	size_t size = sizeof(ExtCacheHeader) + num_groups * sizeof(ExtCacheGroup) + strings_size;
+	char *image = malloc(size);
+	if(image == NULL){
+		return NULL;
+	}
+	ExtCacheHeader *header = (ExtCacheHeader *)image;
+	*header = *base_header;
+	header->num_groups = (uint32_t)num_groups;
+	header->total_size = size;
+	ExtCacheGroup *groups = (ExtCacheGroup *)(image + sizeof(ExtCacheHeader));
+	size_t cursor = sizeof(ExtCacheHeader) + num_groups * sizeof(ExtCacheGroup);
+
+	size_t group_index = 0;
+	for(size_t i = 0; i < entries->count;){
+		CacheEntry *first = &entries->entries[i];
+		ExtCacheGroup *group = &groups[group_index++];
+		group->hash = first->hash;
+		group->ext_offset = (uint32_t)cursor;
+		group->ext_len = (uint32_t)first->ext_len;
+		memcpy(image + cursor, first->extension, first->ext_len);
+		cursor += first->ext_len;
+		group->names_offset = cursor;
+		group->count = 0;
+		size_t j = i;
+		while(j < entries->count && same_group(first, &entries->entries[j])){
+			memcpy(image + cursor, entries->entries[j].name, entries->entries[j].name_len);
+			cursor += entries->entries[j].name_len;
+			image[cursor++] = '\n';
+			group->count++;
+			j++;
+		}
+		group->names_len = cursor - group->names_offset;
+		i = j;
+	}
+	*image_size = size;
+	return image;
+}
+
+static int validate_image(const char *image, size_t size, const ExtCacheHeader *expected){
+	if(size < sizeof(ExtCacheHeader)){
+		return -1;
+	}
+	const ExtCacheHeader *header = (const ExtCacheHeader *)image;
+	if(memcmp(header->magic, EXT_CACHE_MAGIC, sizeof(header->magic)) != 0 ||
+		header->dev != expected->dev || header->ino != expected->ino ||
+		header->mtime_sec != expected->mtime_sec || header->mtime_nsec != expected->mtime_nsec ||
+		header->ctime_sec != expected->ctime_sec || header->ctime_nsec != expected->ctime_nsec ||
+		header->total_size != size ||
+		sizeof(ExtCacheHeader) + (uint64_t)header->num_groups * sizeof(ExtCacheGroup) > size){
+		return -1;
+	}
+	const ExtCacheGroup *groups = (const ExtCacheGroup *)(image + sizeof(ExtCacheHeader));
+	for(uint32_t i = 0; i < header->num_groups; ++i){
+		if((uint64_t)groups[i].ext_offset + groups[i].ext_len > size || groups[i].names_offset + groups[i].names_len > size){
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static long query_image(const char *image, const ExtensionSet *set, OutputBuffer *out, size_t *counts){
+	const ExtCacheHeader *header = (const ExtCacheHeader *)image;
+	const ExtCacheGroup *groups = (const ExtCacheGroup *)(image + sizeof(ExtCacheHeader));
+	long total = 0;
+	for(size_t i = 0; i < set->count; ++i){
+		uint64_t hash = hash_string(set->names[i], set->lengths[i]);
+		size_t low = 0;
+		size_t high = header->num_groups;
+		while(low < high){
+			size_t middle = low + (high - low) / 2;
+			if(groups[middle].hash < hash){
+				low = middle + 1;
+			}else{
+				high = middle;
+			}
+		}
+		counts[i] = 0;
+		for(size_t g = low; g < header->num_groups && groups[g].hash == hash; ++g){
+			if(groups[g].ext_len == set->lengths[i] && memcmp(image + groups[g].ext_offset, set->names[i], set->lengths[i]) == 0){
+				out_write(out, image + groups[g].names_offset, groups[g].names_len);
+				counts[i] = groups[g].count;
+				total += (long)groups[g].count;
+				break;
+			}
+		}
+	}
+	return total;
+}
+
+static void save_image(const char *cache_path, const char *image, size_t size){
+	char temp_path[4096];
+	if(snprintf(temp_path, sizeof(temp_path), "%s.XXXXXX", cache_path) >= (int)sizeof(temp_path)){
+		return;
+	}
+	int fd = mkstemp(temp_path);
+	if(fd == -1){
+		return;
+	}
+	int ok = write_all(fd, image, size) == 0;
+	if(close(fd) == -1){
+		ok = 0;
+	}
+	if(!ok || rename(temp_path, cache_path) == -1){
+		unlink(temp_path);
+	}
+}
+
+static long query_cache_file(const char *cache_path, const ExtCacheHeader *expected, const ExtensionSet *set, OutputBuffer *out, size_t *counts){
+	int fd = open(cache_path, O_RDONLY | O_CLOEXEC);
+	if(fd == -1){
+		return -1;
+	}
+	struct stat statbuf;
+	long result = -1;
+	if(fstat(fd, &statbuf) == 0 && statbuf.st_size >= (off_t)sizeof(ExtCacheHeader)){
+		char *image = mmap(NULL, (size_t)statbuf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if(image != MAP_FAILED){
+			if(validate_image(image, (size_t)statbuf.st_size, expected) == 0){
+				result = query_image(image, set, out, counts);
+			}
+			munmap(image, (size_t)statbuf.st_size);
+		}
+	}
+	close(fd);
+	return result;
+}
+
+long ext_cache_query(const char *path, const ExtensionSet *set, OutputBuffer *out, size_t *counts){
+	int dir_fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if(dir_fd == -1){
+		return -1;
+	}
+	struct statx stx;
+	if(statx(dir_fd, "", AT_EMPTY_PATH, STATX_INO | STATX_MTIME | STATX_CTIME, &stx) == -1){
+		close(dir_fd);
+		return -1;
+	}
+	ExtCacheHeader expected;
+	memset(&expected, 0, sizeof(expected));
+	memcpy(expected.magic, EXT_CACHE_MAGIC, sizeof(expected.magic));
+	expected.dev = ((uint64_t)stx.stx_dev_major << 32) | stx.stx_dev_minor;
+	expected.ino = stx.stx_ino;
+	expected.mtime_sec = stx.stx_mtime.tv_sec;
+	expected.mtime_nsec = stx.stx_mtime.tv_nsec;
+	expected.ctime_sec = stx.stx_ctime.tv_sec;
+	expected.ctime_nsec = stx.stx_ctime.tv_nsec;
+
+	char cache_dir[4096];
+	char cache_path[4200];
+	int have_cache_path = cache_directory(cache_dir, sizeof(cache_dir)) == 0 &&
+		snprintf(cache_path, sizeof(cache_path), "%s/%016llx-%016llx.idx", cache_dir,
+			(unsigned long long)expected.dev, (unsigned long long)expected.ino) < (int)sizeof(cache_path);
+
+	long result = -1;
+	if(have_cache_path){
+		result = query_cache_file(cache_path, &expected, set, out, counts);
+	}
+	if(result >= 0){
+		close(dir_fd);
+		return result;
+	}
+
+	CacheEntries entries = {NULL, 0, 0};
+	if(collect_entries(dir_fd, &entries) == 0){
+		size_t size;
+		char *image = build_image(&expected, &entries, &size);
+		if(image){
+			result = query_image(image, set, out, counts);
+			time_t now = time(NULL);
+			if(have_cache_path && now - expected.mtime_sec >= EXT_CACHE_RACY_SECONDS && now - expected.ctime_sec >= EXT_CACHE_RACY_SECONDS){
+				save_image(cache_path, image, size);
+			}
+			free(image);
+		}
+	}
+	for(size_t i = 0; i < entries.count; ++i){
+		free(entries.entries[i].name);
+	}
+	free(entries.entries);
+	close(dir_fd);
+	return result;
+}
@@ -0,0 +1,37 @@
+#include <stddef.h>
+#include <stdint.h>
+#include "extensionSet.h"
+#include "outputBuffer.h"
+#ifndef EXTENSIONCACHE_H
+#define EXTENSIONCACHE_H
+
+#define EXT_CACHE_MAGIC "FMEXTIX1"
+#define EXT_CACHE_DIR_NAME "fileManager"
+/* Directories modified this recently are not cached, their mtime may not have settled yet. */
+#define EXT_CACHE_RACY_SECONDS 2
+
+typedef struct{
+	char magic[8];
+	uint64_t dev;
+	uint64_t ino;
+	int64_t mtime_sec;
+	int64_t ctime_sec;
+	uint32_t mtime_nsec;
+	uint32_t ctime_nsec;
+	uint32_t num_groups;
+	uint32_t reserved;
+	uint64_t total_size;
+} ExtCacheHeader;
+
+typedef struct{
+	uint64_t hash;
+	uint32_t ext_offset;
+	uint32_t ext_len;
+	uint64_t names_offset;
+	uint64_t names_len;
+	uint64_t count;
+} ExtCacheGroup;
+
+long ext_cache_query(const char *path, const ExtensionSet *set, OutputBuffer *out, size_t *counts);
+
+#endif
@@ -0,0 +1,89 @@
+#define _POSIX_C_SOURCE 200809L
+#include "extensionSet.h"
+#include "directoryUtils.h"
+#include <stdlib.h>
+#include <string.h>
+
+uint64_t hash_string(const char *str, size_t len){
+	uint64_t hash = 1469598103934665603ULL;
+	for(size_t i = 0; i < len; ++i){
+		hash ^= (unsigned char)str[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+static int ext_set_lookup(const ExtensionSet *set, const char *extension, size_t len){
+	uint64_t hash = hash_string(extension, len);
+	size_t mask = set->num_slots - 1;
+	for(size_t slot = hash & mask; set->slots[slot] != 0; slot = (slot + 1) & mask){
+		int index = set->slots[slot] - 1;
+		if(set->hashes[slot] == hash && set->lengths[index] == len && memcmp(set->names[index], extension, len) == 0){
+			return index;
+		}
+	}
+	return -1;
+}
+
+int ext_set_init(ExtensionSet *set, const char *list){
+	memset(set, 0, sizeof(ExtensionSet));
+	size_t num_items = 1;
+	for(const char *p = list; *p; ++p){
+		num_items += *p == ',';
+	}
+	if(num_items > MAX_EXTENSIONS){
+		return -1;
+	}
+	set->num_slots = 1;
+	while(set->num_slots < num_items * 2){
+		set->num_slots *= 2;
+	}
+
+	const char *start = list;
+	for(;;){
+		const char *end = strchr(start, ',');
+		size_t len = end ? (size_t)(end - start) : strlen(start);
+		if(len > 0 && ext_set_lookup(set, start, len) == -1){
+			char *name = strndup(start, len);
+			if(name == NULL){
+				ext_set_free(set);
+				return -1;
+			}
+			size_t index = set->count++;
+			set->names[index] = name;
+			set->lengths[index] = len;
+			uint64_t hash = hash_string(name, len);
+			size_t mask = set->num_slots - 1;
+			size_t slot = hash & mask;
+			while(set->slots[slot] != 0){
+				slot = (slot + 1) & mask;
+			}
+			set->slots[slot] = (int)index + 1;
+			set->hashes[slot] = hash;
+		}
+		if(end == NULL){
+			break;
+		}
+		start = end + 1;
+	}
+	return set->count > 0 ? 0 : -1;
+}
+
+void ext_set_free(ExtensionSet *set){
+	for(size_t i = 0; i < set->count; ++i){
+		free(set->names[i]);
+	}
+	set->count = 0;
+}
+
+int ext_set_find(const ExtensionSet *set, const char *extension){
+	return ext_set_lookup(set, extension, strlen(extension));
+}
+
+int ext_set_match(const ExtensionSet *set, const char *filename){
+	char *extension = get_file_extension((char *)filename);
+	if(extension == NULL){
+		return -1;
+	}
+	return ext_set_find(set, extension);
+}
@@ -0,0 +1,23 @@
+#include <stddef.h>
+#include <stdint.h>
+#ifndef EXTENSIONSET_H
+#define EXTENSIONSET_H
+
+#define MAX_EXTENSIONS 64
+
+typedef struct{
+	char *names[MAX_EXTENSIONS];
+	size_t lengths[MAX_EXTENSIONS];
+	size_t count;
+	int slots[MAX_EXTENSIONS * 4];
+	uint64_t hashes[MAX_EXTENSIONS * 4];
+	size_t num_slots;
+} ExtensionSet;
+
+int ext_set_init(ExtensionSet *set, const char *list);
+void ext_set_free(ExtensionSet *set);
+int ext_set_find(const ExtensionSet *set, const char *extension);
+int ext_set_match(const ExtensionSet *set, const char *filename);
+uint64_t hash_string(const char *str, size_t len);
+
+#endif
@@ -8,11 +8,13 @@
 #include "utilities.h"
 #include "fileUtils.h"
 #include "directoryUtils.h"
-
-typedef struct{
-	char *command;
-	void (*func)(char *args[], size_t argc);
-} Command;
+#include "logger.h"
+#include "copyUtils.h"
+#include "diskUsage.h"
+#include "duplicates.h"
+#include "watchDir.h"
+#include "server.h"
+#include "commands.h"
 
 Command commands[] = {
 	{"createDir", create_dir},
@@ -23,20 +25,35 @@ Command commands[] = {
 	{"appendToFile", append_to_file},
 	{"deleteFile", delete_file},
 	{"deleteDir", delete_dir},
-	{"showlogs", show_logs}
+	{"copyFile", copy_file},
+	{"moveFile", move_file},
+	{"diskUsage", disk_usage},
+	{"findDuplicates", find_duplicates},
+	{"watchDir", watch_dir},
+	{"showlogs", show_logs},
+	{"serve", serve},
+	{"client", client}
 };
 #define NUM_COMMANDS (int)(sizeof(commands) / sizeof(commands[0]))
 
+const Command *find_command(const char *name){
+	for(int i = 0; i < NUM_COMMANDS; ++i){
+		if(strcmp(name, commands[i].command) == 0){
+			return &commands[i];
+		}
+	}
+	return NULL;
+}
+
 int main(int argc, char *argv[]){
 	if(argc < 2){
 		print_command_manual();
 		return 0;
 	}else{
-		for(int i = 0; i < NUM_COMMANDS; ++i){
-			if(strcmp(argv[1], commands[i].command) == 0){
-				commands[i].func(argc > 2 ? &argv[2] : NULL, argc - 2);
-				return 0;
-			}
+		const Command *command = find_command(argv[1]);
+		if(command){
+			command->func(argc > 2 ? &argv[2] : NULL, argc - 2);
+			return 0;
 		}
 	}
 	printf("%s: command not found\n", argv[1]);
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include "fileUtils.h"
 #include <stdio.h>
 #include <unistd.h>
@@ -5,183 +6,301 @@
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/file.h>
-#include <sys/wait.h>
 #include "utilities.h"
+#include "threadPool.h"
+#include "logger.h"
+#include "bulkCreate.h"
+#include "groupCommit.h"
 #include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdarg.h>
+#include <errno.h>
+#include <sys/sendfile.h>
 
-#define LOG_FILE "logs.txt"
+#define READ_BUFFER_SIZE (1024 * 1024)
+#define STREAM_CHUNK_SIZE (16 * 1024 * 1024)
 
 void create_file(char *args[], size_t argc){
 	if(argc == 0){
 		no_filename_message();
 		return;
 	}
-	
+
+	int bulk = argc >= BULK_CREATE_THRESHOLD;
+	size_t num_files = 0;
 	for(size_t i = 0; i < argc; ++i){
+		if(strcmp(args[i], "--bulk") == 0){
+			bulk = 1;
+		}else{
+			args[num_files++] = args[i];
+		}
+	}
+	if(num_files == 0){
+		no_filename_message();
+		return;
+	}
+	char *timeStamp = get_timeStamp_string();
+	if(bulk){
+		create_files_bulk(args, num_files, timeStamp);
+		return;
+	}
+
+	for(size_t i = 0; i < num_files; ++i){
 		char *filename = args[i];
 		if(file_exists(filename)){
-			printf("Error: File %s already exists.\n", filename);
+			print_message("Error: File %s already exists.\n", filename);
 		}else{
 			int file_descriptor = open(filename, O_CREAT | O_WRONLY | O_TRUNC, S_IRUSR | S_IWUSR);
 			if(file_descriptor == -1){
-				printf("Error creating the file %s.\n", filename);
+				print_message("Error creating the file %s.\n", filename);
 				continue;
 			}
-			char *timeStamp = get_timeStamp_string();
 			ssize_t bytes_written = write(file_descriptor, timeStamp, strlen(timeStamp));
 			if(bytes_written == -1){
-				printf("Error writing to the file%s.\n", filename);
+				print_message("Error writing to the file%s.\n", filename);
 				close(file_descriptor);
 				continue;
 			}
-			write_log("File %s created successfully.", filename);
+			log_operation(LOG_OP_CREATE_FILE, 0, filename, NULL);
 			close(file_descriptor);
 		}
 	}
 	return;
 }
 
+static int copy_range_loop(int in_fd, int out_fd, off_t offset, off_t remaining, int positional){
+	char *buffer = malloc(READ_BUFFER_SIZE);
+	if(buffer == NULL){
+		return -1;
+	}
+	int result = 0;
+	while(remaining != 0){
+		size_t chunk = READ_BUFFER_SIZE;
+		if(remaining > 0 && (off_t)chunk > remaining){
+			chunk = (size_t)remaining;
+		}
+		ssize_t bytes_read = positional ? pread(in_fd, buffer, chunk, offset) : read(in_fd, buffer, chunk);
+		if(bytes_read == -1){
+			if(errno == EINTR){
+				continue;
+			}
+			result = -1;
+			break;
+		}
+		if(bytes_read == 0){
+			break;
+		}
+		if(write_all(out_fd, buffer, (size_t)bytes_read) == -1){
+			result = -1;
+			break;
+		}
+		offset += bytes_read;
+		if(remaining > 0){
+			remaining -= bytes_read;
+		}
+	}
+	free(buffer);
+	return result;
+}
+
+static int stream_file(int in_fd, int out_fd, off_t offset, off_t length){
+	struct stat statbuf;
+	if(fstat(in_fd, &statbuf) == -1){
+		return -1;
+	}
+	if(!S_ISREG(statbuf.st_mode)){
+		if(offset > 0 && lseek(in_fd, offset, SEEK_SET) == -1){
+			int seek_error = errno;
+			int null_fd = seek_error == ESPIPE ? open("/dev/null", O_WRONLY | O_CLOEXEC) : -1;
+			if(null_fd == -1 || copy_range_loop(in_fd, null_fd, 0, offset, 0) == -1){
+				if(null_fd != -1){
+					close(null_fd);
+				}
+				return -1;
+			}
+			close(null_fd);
+		}
+		return copy_range_loop(in_fd, out_fd, 0, length, 0);
+	}
+
+	off_t end = statbuf.st_size;
+	// Compared as a distance, offset + length overflows for huge lengths
+	if(length >= 0 && offset < end && length < end - offset){
+		end = offset + length;
+	}
+	if(offset >= end){
+		return 0;
+	}
+	if(isatty(out_fd)){
+		return copy_range_loop(in_fd, out_fd, offset, end - offset, 1);
+	}
+
+	int use_splice = 0;
+	while(offset < end){
+		size_t chunk = (size_t)(end - offset) < STREAM_CHUNK_SIZE ? (size_t)(end - offset) : STREAM_CHUNK_SIZE;
+		ssize_t bytes_sent = use_splice ? splice(in_fd, &offset, out_fd, NULL, chunk, SPLICE_F_MORE) : sendfile(out_fd, in_fd, &offset, chunk);
+		if(bytes_sent > 0){
+			continue;
+		}
+		if(bytes_sent == 0){
+			return 0;
+		}
+		if(errno == EINTR){
+			continue;
+		}
+		if(errno != EINVAL && errno != ENOSYS){
+			return -1;
+		}
+		struct stat out_stat;
+		if(!use_splice && fstat(out_fd, &out_stat) == 0 && S_ISFIFO(out_stat.st_mode)){
+			use_splice = 1;
+			continue;
+		}
+		return copy_range_loop(in_fd, out_fd, offset, end - offset, 1);
+	}
+	return 0;
+}
+
+static int parse_offset(const char *str, off_t *result){
+	char *endptr;
+	errno = 0;
+	long long value = strtoll(str, &endptr, 10);
+	if(endptr == str || *endptr != '\0' || errno != 0 || value < 0){
+		return -1;
+	}
+	*result = (off_t)value;
+	return 0;
+}
+
 void read_file(char *args[], size_t argc){
-	if(argc == 0){
+	off_t offset = 0;
+	off_t length = -1;
+	size_t num_files = 0;
+	for(size_t i = 0; i < argc; ++i){
+		off_t *target = NULL;
+		char *option = args[i];
+		char *value = NULL;
+		if(strncmp(args[i], "--offset", 8) == 0){
+			target = &offset;
+			value = args[i] + 8;
+		}else if(strncmp(args[i], "--length", 8) == 0){
+			target = &length;
+			value = args[i] + 8;
+		}else{
+			args[num_files++] = args[i];
+			continue;
+		}
+		if(*value == '='){
+			value++;
+		}else if(*value == '\0' && i + 1 < argc){
+			value = args[++i];
+		}else{
+			value = NULL;
+		}
+		if(value == NULL || parse_offset(value, target) == -1){
+			print_message("Error : Invalid value for %.8s\n", option);
+			return;
+		}
+	}
+	if(num_files == 0){
 		no_filename_message();
 		return;
 	}
-	for(size_t i = 0; i < argc; ++i){
+	for(size_t i = 0; i < num_files; ++i){
 		char *filename = args[i];
-		int file_descriptor = open(filename, O_RDONLY);
+		int file_descriptor = open(filename, O_RDONLY | O_CLOEXEC);
 		if(file_descriptor == -1){
-			printf("Error : File %s not found.\n", filename);
+			print_message("Error : File %s not found.\n", filename);
 			continue;
 		}
-		char read_buffer[500];
-		ssize_t bytes_read;
-		bytes_read = read(file_descriptor, read_buffer, sizeof(read_buffer) - 1);
-		if(bytes_read == -1){
-			printf("Error : Could not read the file %s.\n", filename);
+		fflush(stdout);
+		if(stream_file(file_descriptor, output_fd(), offset, length) == -1){
+			print_message("Error : Could not read the file %s.\n", filename);
 			close(file_descriptor);
 			continue;
-		}		
-		read_buffer[bytes_read] = '\0';
-		printf("%s\n", read_buffer);
-		write_log("Content of the %s is displayed.", filename);
+		}
+		log_operation(LOG_OP_READ_FILE, 0, filename, NULL);
 		close(file_descriptor);
 	}
 	return;	
 }
 
 void append_to_file(char *args[], size_t argc){
+	int sync = getenv("FILEMANAGER_APPEND_SYNC") != NULL;
+	if(argc >= 1 && strcmp(args[0], "--sync") == 0){
+		sync = 1;
+		args++;
+		argc--;
+	}
 	if(!(argc >= 2)){
-		printf("Error : Invalid number of arguments\n");
+		print_message("Error : Invalid number of arguments\n");
 		return;
 	}
 	
 	char *filename = args[0];
 	
 	if(!file_exists(filename)){
-		printf("Error : File %s is not exists\n", filename);
+		print_message("Error : File %s is not exists\n", filename);
 		return;
 	}
-	int file_descriptor = open(filename, O_WRONLY | O_APPEND, 0644);
+	int file_descriptor = open(filename, O_WRONLY | O_APPEND | O_CLOEXEC, 0644);
 	if(file_descriptor == -1){
-		printf("Error : Can not write to %s. File is locked or read-only\n", filename);
+		print_message("Error : Can not write to %s. File is locked or read-only\n", filename);
 		return;
 	}
-	if(flock(file_descriptor, LOCK_EX) == -1){
-		printf("Error : Failed to lock the file %s\n", filename);
+
+	/* Every word is followed by a space, the separators point at one shared byte instead of being copied. */
+	static char separator[] = " ";
+	size_t num_words = argc - 1;
+	struct iovec *iov = malloc(num_words * 2 * sizeof(struct iovec));
+	if(iov == NULL){
+		print_message("Memory allocation failed!\n");
 		close(file_descriptor);
 		return;
 	}
-
-	char *content = concatenate_strings(&args[1], argc - 1);
-	if(content){
-		if(write(file_descriptor, content, sizeof(char) * strlen(content)) == -1){
-			printf("Error : Could not write to file %s\n", filename);
-		}else{
-			write_log("The new content is appended to file %s successfully.", filename);
-		}
-		free(content);
-	} 
-	flock(file_descriptor, LOCK_UN);
+	for(size_t i = 0; i < num_words; ++i){
+		iov[i * 2].iov_base = args[i + 1];
+		iov[i * 2].iov_len = strlen(args[i + 1]);
+		iov[i * 2 + 1].iov_base = separator;
+		iov[i * 2 + 1].iov_len = 1;
+	}
+	int result = group_append(file_descriptor, iov, (int)(num_words * 2), sync);
+	if(result == -EWOULDBLOCK || result == -ENOLCK){
+		print_message("Error : Failed to lock the file %s\n", filename);
+	}else if(result < 0){
+		print_message("Error : Could not write to file %s\n", filename);
+	}else{
+		log_operation(LOG_OP_APPEND_FILE, 0, filename, NULL);
+	}
+	free(iov);
 	close(file_descriptor);
-
 }
 
-void delete_file(char *args[], size_t argc){
-	if(argc == 0){
-		no_filename_message();
-		return;
-	}
-	
-	for(size_t i = 0; i < argc; ++i){
-		pid_t pid = fork();
-		if(pid < 0){
-			printf("Error : Fork failed\n");
-		}else if(pid == 0){
-			char *filename = args[i];
-			if(!file_exists(filename)){
-				printf("Error : File %s not found\n", filename);
-			}else{
-				if(unlink(filename) == 0){
-					write_log("File %s deleted successfully.", filename);
-				}else{
-					printf("File %s could not deleted\n", filename);
-				}
-			}
-			exit(0);
+static void delete_file_task(char *args[], void *context, OutputBuffer *out){
+	(void)context;
+	char *filename = args[0];
+	if(!file_exists(filename)){
+		out_printf(out, "Error : File %s not found\n", filename);
+	}else{
+		if(unlink(filename) == 0){
+			log_operation(LOG_OP_DELETE_FILE, 0, filename, NULL);
 		}else{
-			wait(NULL);
+			out_printf(out, "File %s could not deleted\n", filename);
 		}
 	}
 }
 
-void write_log(char *format, ...){
-	char buffer[480];
-	
-	va_list args;
-	va_start(args, format);
-	vsnprintf(buffer, sizeof(buffer), format, args);
-	va_end(args);
-	
-	int file_descriptor = open(LOG_FILE, O_WRONLY | O_CREAT | O_APPEND, 0644);
-	if(file_descriptor == -1){
-		printf("Error : Could not open the logs file\n");
+void delete_file(char *args[], size_t argc){
+	if(argc == 0){
+		no_filename_message();
 		return;
 	}
-	
-	char *timeStamp = get_timeStamp_string();
-	char log_entry[512];
-	snprintf(log_entry, sizeof(log_entry), "%s %s\n", timeStamp, buffer);
-	write(file_descriptor, log_entry, strlen(log_entry));
-	close(file_descriptor);
-
-}
-
-void show_logs(char *args[], size_t argc){
-	(void)args;
-	(void)argc;
-	if(!file_exists("logs.txt")){
-		printf("Error : There is no log record\n");
+	/* The same file named twice must be deleted once and reported missing once */
+	if(paths_overlap(args, argc)){
+		run_tasks_in_order(delete_file_task, args, argc, 1, NULL);
 	}else{
-		int file_descriptor = open("logs.txt", O_RDONLY);
-		if(file_descriptor == -1){
-			printf("Error : Could not open the logs file\n");
-			return;
-		}
-		char buffer[256];
-		ssize_t bytes_read;
-		
-		while((bytes_read = read(file_descriptor, buffer, sizeof(buffer) - 1)) > 0){
-			buffer[bytes_read] = '\0';
-			write(STDOUT_FILENO, buffer, bytes_read);
-			
-		}
-		if(bytes_read == -1){
-			printf("Error : Could not read the logs file\n");
-		}
-		close(file_descriptor);
+		run_tasks(delete_file_task, args, argc, 1, NULL);
 	}
 }
 
@@ -190,7 +309,7 @@ int file_exists(char *path){
 }
 
 void no_filename_message(){
-	printf("Error : Filename is not provided\n");
+	print_message("Error : Filename is not provided\n");
 }
 
 
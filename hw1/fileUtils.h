@@ -10,7 +10,5 @@ void delete_file(char *args[], size_t argc);
 
 int file_exists(char *path);
 void no_filename_message();
-void show_logs(char *args[], size_t argc);
-void write_log(char *format, ...);
 
 #endif
@@ -0,0 +1,176 @@
+#define _GNU_SOURCE
+#include "groupCommit.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+typedef struct AppendRequest{
+	const struct iovec *iov;
+	int iovcnt;
+	int sync;
+	int done;
+	int result;
+	struct AppendRequest *next;
+} AppendRequest;
+
+/*
+ * Appends waiting on one inode. The first thread to queue becomes the leader
+ * and writes everything queued behind it under a single flock, the others
+ * just wait for their request to be marked done.
+ */
+typedef struct AppendGroup{
+	dev_t dev;
+	ino_t ino;
+	AppendRequest *head;
+	AppendRequest *tail;
+	int has_leader;
+	size_t users;
+	pthread_cond_t done;
+	struct AppendGroup *next;
+} AppendGroup;
+
+static pthread_mutex_t groups_mutex = PTHREAD_MUTEX_INITIALIZER;
+static AppendGroup *groups[GROUP_COMMIT_BUCKETS];
+
+static AppendGroup *acquire_group(dev_t dev, ino_t ino){
+	size_t bucket = ((size_t)ino ^ ((size_t)dev << 7)) % GROUP_COMMIT_BUCKETS;
+	for(AppendGroup *group = groups[bucket]; group; group = group->next){
+		if(group->dev == dev && group->ino == ino){
+			group->users++;
+			return group;
+		}
+	}
+	AppendGroup *group = calloc(1, sizeof(AppendGroup));
+	if(group == NULL){
+		return NULL;
+	}
+	group->dev = dev;
+	group->ino = ino;
+	group->users = 1;
+	pthread_cond_init(&group->done, NULL);
+	group->next = groups[bucket];
+	groups[bucket] = group;
+	return group;
+}
+
+static void release_group(AppendGroup *group){
+	if(--group->users > 0){
+		return;
+	}
+	size_t bucket = ((size_t)group->ino ^ ((size_t)group->dev << 7)) % GROUP_COMMIT_BUCKETS;
+	AppendGroup **link = &groups[bucket];
+	while(*link != group){
+		link = &(*link)->next;
+	}
+	*link = group->next;
+	pthread_cond_destroy(&group->done);
+	free(group);
+}
+
+static int write_vectors(int fd, struct iovec *iov, size_t iovcnt){
+	while(iovcnt > 0){
+		int count = iovcnt > IOV_MAX ? IOV_MAX : (int)iovcnt;
+		ssize_t written = writev(fd, iov, count);
+		if(written == -1){
+			if(errno == EINTR){
+				continue;
+			}
+			return -errno;
+		}
+		while(iovcnt > 0 && (size_t)written >= iov->iov_len){
+			written -= (ssize_t)iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+		if(iovcnt > 0){
+			iov->iov_base = (char *)iov->iov_base + written;
+			iov->iov_len -= (size_t)written;
+		}
+	}
+	return 0;
+}
+
+static int commit_batch(int fd, AppendRequest *batch){
+	size_t total = 0;
+	int sync = 0;
+	for(AppendRequest *request = batch; request; request = request->next){
+		total += (size_t)request->iovcnt;
+		sync |= request->sync;
+	}
+	struct iovec *iov = malloc((total ? total : 1) * sizeof(struct iovec));
+	if(iov == NULL){
+		return -ENOMEM;
+	}
+	size_t count = 0;
+	for(AppendRequest *request = batch; request; request = request->next){
+		memcpy(iov + count, request->iov, (size_t)request->iovcnt * sizeof(struct iovec));
+		count += (size_t)request->iovcnt;
+	}
+	int result = 0;
+	if(flock(fd, LOCK_EX) == -1){
+		result = -errno;
+	}else{
+		result = write_vectors(fd, iov, count);
+		if(result == 0 && sync && fdatasync(fd) == -1){
+			result = -errno;
+		}
+		flock(fd, LOCK_UN);
+	}
+	free(iov);
+	return result;
+}
+
+/* Appends iov to the file behind fd, coalescing with appends from other threads. Returns 0 or -errno. */
+int group_append(int fd, const struct iovec *iov, int iovcnt, int sync){
+	struct stat statbuf;
+	if(fstat(fd, &statbuf) == -1){
+		return -errno;
+	}
+	AppendRequest request = {iov, iovcnt, sync, 0, 0, NULL};
+
+	pthread_mutex_lock(&groups_mutex);
+	AppendGroup *group = acquire_group(statbuf.st_dev, statbuf.st_ino);
+	if(group == NULL){
+		pthread_mutex_unlock(&groups_mutex);
+		request.next = NULL;
+		return commit_batch(fd, &request);
+	}
+	if(group->tail){
+		group->tail->next = &request;
+	}else{
+		group->head = &request;
+	}
+	group->tail = &request;
+
+	while(!request.done && group->has_leader){
+		pthread_cond_wait(&group->done, &groups_mutex);
+	}
+	if(!request.done){
+		group->has_leader = 1;
+		while(group->head){
+			AppendRequest *batch = group->head;
+			group->head = NULL;
+			group->tail = NULL;
+			pthread_mutex_unlock(&groups_mutex);
+			int result = commit_batch(fd, batch);
+			pthread_mutex_lock(&groups_mutex);
+			for(AppendRequest *member = batch; member;){
+				AppendRequest *next = member->next;
+				member->result = result;
+				member->done = 1;
+				member = next;
+			}
+			pthread_cond_broadcast(&group->done);
+		}
+		group->has_leader = 0;
+		pthread_cond_broadcast(&group->done);
+	}
+	release_group(group);
+	pthread_mutex_unlock(&groups_mutex);
+	return request.result;
+}
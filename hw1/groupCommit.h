@@ -0,0 +1,10 @@
+#include <stddef.h>
+#include <sys/uio.h>
+#ifndef GROUPCOMMIT_H
+#define GROUPCOMMIT_H
+
+#define GROUP_COMMIT_BUCKETS 64
+
+int group_append(int fd, const struct iovec *iov, int iovcnt, int sync);
+
+#endif
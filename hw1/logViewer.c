@@ -0,0 +1,398 @@
+#define _GNU_SOURCE
+#include "logger.h"
+#include "outputBuffer.h"
+#include "fileUtils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define LOG_READ_CHUNK_SIZE (1024 * 1024)
+#define LOG_TIME_SLACK 60
+
+typedef struct{
+	int64_t since;
+	int64_t until;
+	unsigned int op_mask;
+	const char *prefix;
+	size_t prefix_len;
+	long tail;
+} LogFilter;
+
+typedef struct{
+	time_t cached_second;
+	char prefix[32];
+	size_t prefix_len;
+	OutputBuffer out;
+} LogRenderer;
+
+typedef struct{
+	char *data;
+	size_t len;
+	size_t cap;
+	size_t *offsets;
+	size_t count;
+} TailRecords;
+
+static int parse_time(const char *value, int64_t *result){
+	char *endptr;
+	long long seconds = strtoll(value, &endptr, 10);
+	if(endptr != value && *endptr == '\0'){
+		*result = seconds;
+		return 0;
+	}
+	const char *formats[] = {"%Y-%m-%d %H:%M:%S", "%Y-%m-%dT%H:%M:%S", "%Y-%m-%d %H:%M", "%Y-%m-%d"};
+	for(size_t i = 0; i < sizeof(formats) / sizeof(formats[0]); ++i){
+		struct tm time_info;
+		memset(&time_info, 0, sizeof(time_info));
+		char *end = strptime(value, formats[i], &time_info);
+		if(end && *end == '\0'){
+			time_info.tm_isdst = -1;
+			*result = (int64_t)mktime(&time_info);
+			return 0;
+		}
+	}
+	return -1;
+}
+
+static int parse_op_mask(const char *value, unsigned int *mask){
+	char *copy = strdup(value);
+	if(copy == NULL){
+		return -1;
+	}
+	char *saveptr;
+	for(char *name = strtok_r(copy, ",", &saveptr); name; name = strtok_r(NULL, ",", &saveptr)){
+		int op = log_op_from_name(name);
+		if(op == -1){
+			free(copy);
+			return -1;
+		}
+		*mask |= 1u << op;
+	}
+	free(copy);
+	return 0;
+}
+
+static int parse_filter(char *args[], size_t argc, LogFilter *filter){
+	filter->since = INT64_MIN;
+	filter->until = INT64_MAX;
+	filter->op_mask = 0;
+	filter->prefix = NULL;
+	filter->prefix_len = 0;
+	filter->tail = 0;
+	for(size_t i = 0; i < argc; ++i){
+		char *option = args[i];
+		char *value = strchr(option, '=');
+		size_t name_len = value ? (size_t)(value - option) : strlen(option);
+		if(value){
+			value++;
+		}else if(i + 1 < argc){
+			value = args[++i];
+		}else{
+			print_message("Error : Missing value for %s\n", option);
+			return -1;
+		}
+		int valid;
+		if(strncmp(option, "--since", name_len) == 0 && name_len == 7){
+			valid = parse_time(value, &filter->since) == 0;
+		}else if(strncmp(option, "--until", name_len) == 0 && name_len == 7){
+			valid = parse_time(value, &filter->until) == 0;
+		}else if(strncmp(option, "--op", name_len) == 0 && name_len == 4){
+			valid = parse_op_mask(value, &filter->op_mask) == 0;
+		}else if(strncmp(option, "--prefix", name_len) == 0 && name_len == 8){
+			filter->prefix = value;
+			filter->prefix_len = strlen(value);
+			valid = 1;
+		}else if(strncmp(option, "--tail", name_len) == 0 && name_len == 6){
+			char *endptr;
+			filter->tail = strtol(value, &endptr, 10);
+			valid = endptr != value && *endptr == '\0' && filter->tail > 0;
+		}else{
+			print_message("Error : Unknown option %.*s\n", (int)name_len, option);
+			return -1;
+		}
+		if(!valid){
+			print_message("Error : Invalid value %s for %.*s\n", value, (int)name_len, option);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static int filter_is_empty(const LogFilter *filter){
+	return filter->since == INT64_MIN && filter->until == INT64_MAX && filter->op_mask == 0 && filter->prefix == NULL && filter->tail == 0;
+}
+
+static int record_matches(const LogRecord *record, const LogFilter *filter){
+	if(record->timestamp < filter->since || record->timestamp > filter->until){
+		return 0;
+	}
+	if(filter->op_mask && !(filter->op_mask & (1u << record->op))){
+		return 0;
+	}
+	if(filter->prefix && (record->path_len < filter->prefix_len || memcmp(record->path, filter->prefix, filter->prefix_len) != 0)){
+		return 0;
+	}
+	return 1;
+}
+
+static void render_record(LogRenderer *renderer, const LogRecord *record){
+	if((time_t)record->timestamp != renderer->cached_second){
+		time_t seconds = (time_t)record->timestamp;
+		struct tm time_info;
+		localtime_r(&seconds, &time_info);
+		renderer->prefix_len = strftime(renderer->prefix, sizeof(renderer->prefix), "[%Y-%m-%d %H:%M:%S] ", &time_info);
+		renderer->cached_second = seconds;
+	}
+	char message[LOG_MESSAGE_SIZE];
+	size_t message_len = render_log_message(record, message, sizeof(message));
+	out_write(&renderer->out, renderer->prefix, renderer->prefix_len);
+	out_write(&renderer->out, message, message_len);
+	out_write(&renderer->out, "\n", 1);
+}
+
+static off_t find_start_offset(int64_t since){
+	off_t start = LOG_FILE_HEADER_SIZE;
+	char index_path[PATH_MAX];
+	if(since == INT64_MIN || log_file_path(LOG_INDEX_FILE, index_path, sizeof(index_path)) == -1){
+		return start;
+	}
+	int index_fd = open(index_path, O_RDONLY | O_CLOEXEC);
+	if(index_fd == -1){
+		return start;
+	}
+	struct stat statbuf;
+	if(fstat(index_fd, &statbuf) == 0){
+		size_t count = (size_t)statbuf.st_size / sizeof(LogIndexEntry);
+		size_t low = 0;
+		size_t high = count;
+		while(low < high){
+			size_t middle = low + (high - low) / 2;
+			LogIndexEntry entry;
+			if(pread(index_fd, &entry, sizeof(entry), (off_t)(middle * sizeof(entry))) != sizeof(entry)){
+				break;
+			}
+			if(entry.timestamp < since - LOG_TIME_SLACK){
+				start = (off_t)entry.offset;
+				low = middle + 1;
+			}else{
+				high = middle;
+			}
+		}
+	}
+	close(index_fd);
+	return start;
+}
+
+static int scan_forward(int fd, off_t file_size, const LogFilter *filter, LogRenderer *renderer){
+	char *buffer = malloc(LOG_READ_CHUNK_SIZE);
+	if(buffer == NULL){
+		return -1;
+	}
+	off_t position = find_start_offset(filter->since);
+	size_t buffered = 0;
+	int result = 0;
+	int done = 0;
+	while(!done && (position < file_size || buffered > 0)){
+		ssize_t bytes_read = 0;
+		if(position < file_size){
+			bytes_read = pread(fd, buffer + buffered, LOG_READ_CHUNK_SIZE - buffered, position);
+			if(bytes_read == -1){
+				result = -1;
+				break;
+			}
+			position += bytes_read;
+		}
+		size_t available = buffered + (size_t)bytes_read;
+		size_t consumed = 0;
+		LogRecord record;
+		while(available - consumed >= LOG_RECORD_HEADER_SIZE){
+			uint16_t length;
+			memcpy(&length, buffer + consumed + 4, 2);
+			if(available - consumed < length){
+				break;
+			}
+			if(parse_log_record(buffer + consumed, available - consumed, &record) == -1){
+				result = -1;
+				done = 1;
+				break;
+			}
+			if(filter->until != INT64_MAX && record.timestamp > filter->until + LOG_TIME_SLACK){
+				done = 1;
+				break;
+			}
+			if(record_matches(&record, filter)){
+				render_record(renderer, &record);
+			}
+			consumed += record.length;
+		}
+		buffered = available - consumed;
+		memmove(buffer, buffer + consumed, buffered);
+		if(bytes_read == 0){
+			break;
+		}
+	}
+	free(buffer);
+	return result;
+}
+
+static int tail_records_add(TailRecords *tail, const char *data, size_t len){
+	if(tail->len + len > tail->cap){
+		size_t new_cap = tail->cap ? tail->cap * 2 : 64 * 1024;
+		while(new_cap < tail->len + len){
+			new_cap *= 2;
+		}
+		char *new_data = realloc(tail->data, new_cap);
+		if(new_data == NULL){
+			return -1;
+		}
+		tail->data = new_data;
+		tail->cap = new_cap;
+	}
+	memcpy(tail->data + tail->len, data, len);
+	tail->offsets[tail->count++] = tail->len;
+	tail->len += len;
+	return 0;
+}
+
+static int scan_backward(int fd, off_t file_size, const LogFilter *filter, LogRenderer *renderer){
+	TailRecords tail;
+	memset(&tail, 0, sizeof(tail));
+	tail.offsets = calloc((size_t)filter->tail, sizeof(size_t));
+	char *buffer = malloc(LOG_READ_CHUNK_SIZE);
+	if(buffer == NULL || tail.offsets == NULL){
+		free(buffer);
+		free(tail.offsets);
+		return -1;
+	}
+	int result = 0;
+	int done = 0;
+	off_t end = file_size;
+	while(!done && end > LOG_FILE_HEADER_SIZE && tail.count < (size_t)filter->tail){
+		off_t block_start = end - LOG_READ_CHUNK_SIZE;
+		if(block_start < LOG_FILE_HEADER_SIZE){
+			block_start = LOG_FILE_HEADER_SIZE;
+		}
+		size_t block_len = (size_t)(end - block_start);
+		if(pread(fd, buffer, block_len, block_start) != (ssize_t)block_len){
+			result = -1;
+			break;
+		}
+		size_t cursor = block_len;
+		while(cursor > 0 && tail.count < (size_t)filter->tail){
+			uint16_t length;
+			if(cursor < LOG_RECORD_TRAILER_SIZE){
+				break;
+			}
+			memcpy(&length, buffer + cursor - LOG_RECORD_TRAILER_SIZE, 2);
+			if(length > cursor){
+				break;
+			}
+			LogRecord record;
+			if(parse_log_record(buffer + cursor - length, length, &record) == -1){
+				result = -1;
+				done = 1;
+				break;
+			}
+			if(filter->since != INT64_MIN && record.timestamp < filter->since - LOG_TIME_SLACK){
+				done = 1;
+				break;
+			}
+			if(record_matches(&record, filter) && tail_records_add(&tail, buffer + cursor - length, length) == -1){
+				result = -1;
+				done = 1;
+				break;
+			}
+			cursor -= length;
+		}
+		if(cursor == block_len && !done && tail.count < (size_t)filter->tail){
+			result = -1;
+			break;
+		}
+		end = block_start + (off_t)cursor;
+	}
+	for(size_t i = tail.count; i-- > 0;){
+		LogRecord record;
+		parse_log_record(tail.data + tail.offsets[i], tail.len - tail.offsets[i], &record);
+		render_record(renderer, &record);
+	}
+	free(buffer);
+	free(tail.data);
+	free(tail.offsets);
+	return result;
+}
+
+static void show_legacy_logs(const char *legacy_path, OutputBuffer *out){
+	int file_descriptor = open(legacy_path, O_RDONLY | O_CLOEXEC);
+	if(file_descriptor == -1){
+		return;
+	}
+	char buffer[64 * 1024];
+	ssize_t bytes_read;
+	while((bytes_read = read(file_descriptor, buffer, sizeof(buffer))) > 0){
+		out_write(out, buffer, (size_t)bytes_read);
+	}
+	close(file_descriptor);
+}
+
+void show_logs(char *args[], size_t argc){
+	LogFilter filter;
+	if(parse_filter(args, argc, &filter) == -1){
+		return;
+	}
+	logger_flush();
+
+	/* The server's workers change directory per request, so the paths come from the logger. */
+	char log_path[PATH_MAX];
+	char legacy_path[PATH_MAX];
+	if(log_file_path(LOG_FILE, log_path, sizeof(log_path)) == -1 ||
+		log_file_path(LEGACY_LOG_FILE, legacy_path, sizeof(legacy_path)) == -1){
+		print_message("Error : Could not open the logs file\n");
+		return;
+	}
+	int has_legacy = file_exists(legacy_path);
+	if(!file_exists(log_path) && !has_legacy){
+		print_message("Error : There is no log record\n");
+		return;
+	}
+
+	LogRenderer renderer;
+	renderer.cached_second = -1;
+	renderer.prefix_len = 0;
+	out_init(&renderer.out, output_fd());
+	if(has_legacy && filter_is_empty(&filter)){
+		show_legacy_logs(legacy_path, &renderer.out);
+	}
+
+	int file_descriptor = open(log_path, O_RDONLY | O_CLOEXEC);
+	if(file_descriptor == -1){
+		if(!has_legacy){
+			print_message("Error : Could not open the logs file\n");
+		}
+		out_flush(&renderer.out);
+		out_free(&renderer.out);
+		return;
+	}
+	struct stat statbuf;
+	char magic[LOG_FILE_HEADER_SIZE];
+	int result = -1;
+	if(fstat(file_descriptor, &statbuf) == 0 &&
+		pread(file_descriptor, magic, sizeof(magic), 0) == (ssize_t)sizeof(magic) &&
+		memcmp(magic, LOG_FILE_MAGIC, LOG_FILE_HEADER_SIZE) == 0){
+		if(filter.tail > 0){
+			result = scan_backward(file_descriptor, statbuf.st_size, &filter, &renderer);
+		}else{
+			result = scan_forward(file_descriptor, statbuf.st_size, &filter, &renderer);
+		}
+	}
+	out_flush(&renderer.out);
+	out_free(&renderer.out);
+	if(result == -1){
+		print_message("Error : Could not read the logs file\n");
+	}
+	close(file_descriptor);
+}
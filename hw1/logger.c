@@ -0,0 +1,392 @@
+#define _DEFAULT_SOURCE
+#include "logger.h"
+#include "outputBuffer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+typedef struct{
+	int fd;
+	int started;
+	int stopping;
+	int has_thread;
+	LogFsyncPolicy fsync_policy;
+	long flush_ms;
+	char *buffer;
+	char *spare;
+	size_t len;
+	int64_t first_timestamp;
+	int index_fd;
+	char directory[PATH_MAX];
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_mutex_t flush_mutex;
+	pthread_cond_t wakeup;
+} Logger;
+
+static Logger logger = {
+	.fd = -1,
+	.index_fd = -1,
+	.mutex = PTHREAD_MUTEX_INITIALIZER,
+	.flush_mutex = PTHREAD_MUTEX_INITIALIZER,
+	.wakeup = PTHREAD_COND_INITIALIZER
+};
+
+static LogFsyncPolicy parse_fsync_policy(const char *value){
+	if(value == NULL || strcmp(value, "never") == 0){
+		return LOG_FSYNC_NEVER;
+	}
+	if(strcmp(value, "always") == 0){
+		return LOG_FSYNC_ALWAYS;
+	}
+	return LOG_FSYNC_ON_FLUSH;
+}
+
+static void append_index_entry(uint64_t offset, int64_t timestamp){
+	if(logger.index_fd == -1){
+		return;
+	}
+	struct stat statbuf;
+	uint64_t last_offset = LOG_FILE_HEADER_SIZE;
+	if(fstat(logger.index_fd, &statbuf) == 0 && statbuf.st_size >= (off_t)sizeof(LogIndexEntry)){
+		LogIndexEntry last;
+		off_t position = statbuf.st_size - statbuf.st_size % (off_t)sizeof(LogIndexEntry) - (off_t)sizeof(LogIndexEntry);
+		if(pread(logger.index_fd, &last, sizeof(last), position) != sizeof(last)){
+			return;
+		}
+		last_offset = last.offset;
+	}
+	if(offset < last_offset + LOG_INDEX_INTERVAL){
+		return;
+	}
+	LogIndexEntry entry = {timestamp, offset};
+	write_all(logger.index_fd, (const char *)&entry, sizeof(entry));
+}
+
+/* Caller holds logger.mutex; it is released while the swapped-out buffer is written. */
+static void flush_locked(void){
+	if(logger.len == 0 || logger.fd == -1){
+		return;
+	}
+	pthread_mutex_lock(&logger.flush_mutex);
+	char *data = logger.buffer;
+	size_t len = logger.len;
+	int64_t first_timestamp = logger.first_timestamp;
+	logger.buffer = logger.spare;
+	logger.spare = data;
+	logger.len = 0;
+	pthread_mutex_unlock(&logger.mutex);
+
+	flock(logger.fd, LOCK_EX);
+	struct stat statbuf;
+	if(fstat(logger.fd, &statbuf) == 0){
+		uint64_t offset = (uint64_t)statbuf.st_size;
+		if(offset == 0 && write_all(logger.fd, LOG_FILE_MAGIC, LOG_FILE_HEADER_SIZE) == 0){
+			offset = LOG_FILE_HEADER_SIZE;
+		}
+		append_index_entry(offset, first_timestamp);
+	}
+	if(write_all(logger.fd, data, len) == -1){
+		fprintf(stderr, "Error : Could not write to the logs file\n");
+	}
+	if(logger.fsync_policy != LOG_FSYNC_NEVER){
+		fdatasync(logger.fd);
+	}
+	flock(logger.fd, LOCK_UN);
+	pthread_mutex_unlock(&logger.flush_mutex);
+	pthread_mutex_lock(&logger.mutex);
+}
+
+static void *flush_thread(void *arg){
+	(void)arg;
+	pthread_mutex_lock(&logger.mutex);
+	while(!logger.stopping){
+		struct timespec deadline;
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_sec += logger.flush_ms / 1000;
+		deadline.tv_nsec += (logger.flush_ms % 1000) * 1000000L;
+		if(deadline.tv_nsec >= 1000000000L){
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000L;
+		}
+		pthread_cond_timedwait(&logger.wakeup, &logger.mutex, &deadline);
+		flush_locked();
+	}
+	pthread_mutex_unlock(&logger.mutex);
+	return NULL;
+}
+
+static int logger_start_locked(void){
+	if(logger.started){
+		return logger.fd == -1 ? -1 : 0;
+	}
+	logger.started = 1;
+	/* Requests served later run in their clients' directories, the log stays where it was opened. */
+	if(getcwd(logger.directory, sizeof(logger.directory)) == NULL){
+		logger.directory[0] = '\0';
+	}
+	char path[PATH_MAX];
+	if(log_file_path(LOG_FILE, path, sizeof(path)) == -1){
+		return -1;
+	}
+	logger.fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+	if(logger.fd == -1){
+		return -1;
+	}
+	if(log_file_path(LOG_INDEX_FILE, path, sizeof(path)) == 0){
+		logger.index_fd = open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+	}
+	logger.buffer = malloc(LOG_BUFFER_SIZE);
+	logger.spare = malloc(LOG_BUFFER_SIZE);
+	if(logger.buffer == NULL || logger.spare == NULL){
+		free(logger.buffer);
+		free(logger.spare);
+		close(logger.fd);
+		logger.fd = -1;
+		return -1;
+	}
+	logger.fsync_policy = parse_fsync_policy(getenv("FILEMANAGER_LOG_FSYNC"));
+	char *flush_ms = getenv("FILEMANAGER_LOG_FLUSH_MS");
+	logger.flush_ms = flush_ms ? strtol(flush_ms, NULL, 10) : LOG_DEFAULT_FLUSH_MS;
+	if(logger.flush_ms <= 0){
+		logger.flush_ms = LOG_DEFAULT_FLUSH_MS;
+	}
+	if(logger.fsync_policy != LOG_FSYNC_ALWAYS && pthread_create(&logger.thread, NULL, flush_thread, NULL) == 0){
+		logger.has_thread = 1;
+	}
+	atexit(logger_shutdown);
+	return 0;
+}
+
+static size_t encode_record(char *buffer, LogOp op, int flags, int64_t timestamp, const char *path, size_t path_len, const char *detail, size_t detail_len){
+	uint32_t magic = LOG_RECORD_MAGIC;
+	uint16_t length = (uint16_t)(LOG_RECORD_HEADER_SIZE + path_len + detail_len + LOG_RECORD_TRAILER_SIZE);
+	uint8_t op_byte = (uint8_t)op;
+	uint8_t flags_byte = (uint8_t)flags;
+	uint16_t path_len16 = (uint16_t)path_len;
+	uint16_t detail_len16 = (uint16_t)detail_len;
+
+	memcpy(buffer, &magic, 4);
+	memcpy(buffer + 4, &length, 2);
+	memcpy(buffer + 6, &op_byte, 1);
+	memcpy(buffer + 7, &flags_byte, 1);
+	memcpy(buffer + 8, &timestamp, 8);
+	memcpy(buffer + 16, &path_len16, 2);
+	memcpy(buffer + 18, &detail_len16, 2);
+	memcpy(buffer + LOG_RECORD_HEADER_SIZE, path, path_len);
+	memcpy(buffer + LOG_RECORD_HEADER_SIZE + path_len, detail, detail_len);
+	memcpy(buffer + length - LOG_RECORD_TRAILER_SIZE, &length, 2);
+	return length;
+}
+
+void log_operation(LogOp op, int flags, const char *path, const char *detail){
+	size_t path_len = path ? strlen(path) : 0;
+	size_t detail_len = detail ? strlen(detail) : 0;
+	if(path_len > LOG_MAX_FIELD_LEN){
+		path_len = LOG_MAX_FIELD_LEN;
+	}
+	if(detail_len > LOG_MAX_FIELD_LEN){
+		detail_len = LOG_MAX_FIELD_LEN;
+	}
+	size_t record_len = LOG_RECORD_HEADER_SIZE + path_len + detail_len + LOG_RECORD_TRAILER_SIZE;
+	int64_t timestamp = (int64_t)time(NULL);
+
+	pthread_mutex_lock(&logger.mutex);
+	if(logger_start_locked() == -1){
+		pthread_mutex_unlock(&logger.mutex);
+		print_message("Error : Could not open the logs file\n");
+		return;
+	}
+	// flush_locked drops the mutex while writing, so other threads may have
+	// refilled the buffer by the time it returns
+	while(logger.len + record_len > LOG_BUFFER_SIZE){
+		flush_locked();
+	}
+	if(logger.len == 0){
+		logger.first_timestamp = timestamp;
+	}
+	logger.len += encode_record(logger.buffer + logger.len, op, flags, timestamp, path, path_len, detail, detail_len);
+
+	if(logger.fsync_policy == LOG_FSYNC_ALWAYS || !logger.has_thread){
+		flush_locked();
+	}else if(logger.len > LOG_BUFFER_SIZE / 2){
+		pthread_cond_signal(&logger.wakeup);
+	}
+	pthread_mutex_unlock(&logger.mutex);
+}
+
+void logger_flush(void){
+	pthread_mutex_lock(&logger.mutex);
+	flush_locked();
+	pthread_mutex_unlock(&logger.mutex);
+}
+
+/* Names a log file in the directory the log was opened in, or the working directory before that. */
+int log_file_path(const char *name, char *path, size_t size){
+	int length;
+	if(logger.directory[0] == '\0'){
+		length = snprintf(path, size, "%s", name);
+	}else{
+		length = snprintf(path, size, "%s/%s", logger.directory, name);
+	}
+	return length < 0 || (size_t)length >= size ? -1 : 0;
+}
+
+int logger_open(void){
+	pthread_mutex_lock(&logger.mutex);
+	int result = logger_start_locked();
+	pthread_mutex_unlock(&logger.mutex);
+	return result;
+}
+
+void logger_shutdown(void){
+	pthread_mutex_lock(&logger.mutex);
+	if(!logger.started || logger.fd == -1){
+		pthread_mutex_unlock(&logger.mutex);
+		return;
+	}
+	logger.stopping = 1;
+	pthread_cond_signal(&logger.wakeup);
+	pthread_mutex_unlock(&logger.mutex);
+	if(logger.has_thread){
+		pthread_join(logger.thread, NULL);
+		logger.has_thread = 0;
+	}
+
+	pthread_mutex_lock(&logger.mutex);
+	flush_locked();
+	close(logger.fd);
+	logger.fd = -1;
+	if(logger.index_fd != -1){
+		close(logger.index_fd);
+		logger.index_fd = -1;
+	}
+	free(logger.buffer);
+	free(logger.spare);
+	logger.buffer = NULL;
+	logger.spare = NULL;
+	pthread_mutex_unlock(&logger.mutex);
+}
+
+static const char *log_op_names[LOG_OP_COUNT] = {
+	[LOG_OP_CREATE_DIR] = "createDir",
+	[LOG_OP_DELETE_DIR] = "deleteDir",
+	[LOG_OP_LIST_DIR] = "listDir",
+	[LOG_OP_LIST_BY_EXTENSION] = "listFilesByExtension",
+	[LOG_OP_CREATE_FILE] = "createFile",
+	[LOG_OP_READ_FILE] = "readFile",
+	[LOG_OP_APPEND_FILE] = "appendToFile",
+	[LOG_OP_DELETE_FILE] = "deleteFile",
+	[LOG_OP_COPY_FILE] = "copyFile",
+	[LOG_OP_MOVE_FILE] = "moveFile",
+	[LOG_OP_DISK_USAGE] = "diskUsage",
+	[LOG_OP_FIND_DUPLICATES] = "findDuplicates",
+	[LOG_OP_WATCH_DIR] = "watchDir"
+};
+
+const char *log_op_name(int op){
+	if(op <= 0 || op >= LOG_OP_COUNT || log_op_names[op] == NULL){
+		return "unknown";
+	}
+	return log_op_names[op];
+}
+
+int log_op_from_name(const char *name){
+	for(int op = 1; op < LOG_OP_COUNT; ++op){
+		if(log_op_names[op] && strcmp(log_op_names[op], name) == 0){
+			return op;
+		}
+	}
+	return -1;
+}
+
+int parse_log_record(const char *data, size_t len, LogRecord *record){
+	uint32_t magic;
+	uint16_t trailer;
+	if(len < LOG_RECORD_HEADER_SIZE + LOG_RECORD_TRAILER_SIZE){
+		return -1;
+	}
+	memcpy(&magic, data, 4);
+	memcpy(&record->length, data + 4, 2);
+	memcpy(&record->op, data + 6, 1);
+	memcpy(&record->flags, data + 7, 1);
+	memcpy(&record->timestamp, data + 8, 8);
+	memcpy(&record->path_len, data + 16, 2);
+	memcpy(&record->detail_len, data + 18, 2);
+	if(magic != LOG_RECORD_MAGIC || record->length > len ||
+		record->length != LOG_RECORD_HEADER_SIZE + record->path_len + record->detail_len + LOG_RECORD_TRAILER_SIZE){
+		return -1;
+	}
+	memcpy(&trailer, data + record->length - LOG_RECORD_TRAILER_SIZE, 2);
+	if(trailer != record->length){
+		return -1;
+	}
+	record->path = data + LOG_RECORD_HEADER_SIZE;
+	record->detail = record->path + record->path_len;
+	return 0;
+}
+
+size_t render_log_message(const LogRecord *record, char *buffer, size_t size){
+	int path_len = record->path_len;
+	int detail_len = record->detail_len;
+	const char *path = record->path;
+	const char *detail = record->detail;
+	int written;
+	switch(record->op){
+		case LOG_OP_CREATE_DIR:
+			written = snprintf(buffer, size, "Directory %.*s created successfully.", path_len, path);
+			break;
+		case LOG_OP_DELETE_DIR:
+			written = snprintf(buffer, size, "Directory %.*s deleted successfully.", path_len, path);
+			break;
+		case LOG_OP_LIST_DIR:
+			written = snprintf(buffer, size, "Entries of %.*s is displayed.", path_len, path);
+			break;
+		case LOG_OP_LIST_BY_EXTENSION:
+			written = snprintf(buffer, size, "Entries with the extension %.*s of %.*s%s is displayed.", detail_len, detail, path_len, path,
+				(record->flags & LOG_FLAG_RECURSIVE) ? " and its subdirectories" : "");
+			break;
+		case LOG_OP_CREATE_FILE:
+			written = snprintf(buffer, size, "File %.*s created successfully.", path_len, path);
+			break;
+		case LOG_OP_READ_FILE:
+			written = snprintf(buffer, size, "Content of the %.*s is displayed.", path_len, path);
+			break;
+		case LOG_OP_APPEND_FILE:
+			written = snprintf(buffer, size, "The new content is appended to file %.*s successfully.", path_len, path);
+			break;
+		case LOG_OP_DELETE_FILE:
+			written = snprintf(buffer, size, "File %.*s deleted successfully.", path_len, path);
+			break;
+		case LOG_OP_COPY_FILE:
+			written = snprintf(buffer, size, "File %.*s copied to %.*s successfully.", path_len, path, detail_len, detail);
+			break;
+		case LOG_OP_MOVE_FILE:
+			written = snprintf(buffer, size, "File %.*s moved to %.*s successfully.", path_len, path, detail_len, detail);
+			break;
+		case LOG_OP_DISK_USAGE:
+			written = snprintf(buffer, size, "Disk usage of %.*s computed successfully.", path_len, path);
+			break;
+		case LOG_OP_FIND_DUPLICATES:
+			written = snprintf(buffer, size, "Duplicate files searched in %.*s successfully.", path_len, path);
+			break;
+		case LOG_OP_WATCH_DIR:
+			written = snprintf(buffer, size, "Directory %.*s watched.", path_len, path);
+			break;
+		default:
+			written = snprintf(buffer, size, "Unknown operation %d on %.*s", record->op, path_len, path);
+			break;
+	}
+	if(written < 0){
+		return 0;
+	}
+	return (size_t)written < size ? (size_t)written : size - 1;
+}
@@ -0,0 +1,80 @@
+#include <stddef.h>
+#include <stdint.h>
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#define LOG_FILE "logs.bin"
+#define LOG_INDEX_FILE "logs.idx"
+#define LEGACY_LOG_FILE "logs.txt"
+#define LOG_BUFFER_SIZE (64 * 1024)
+#define LOG_DEFAULT_FLUSH_MS 200
+#define LOG_INDEX_INTERVAL (64 * 1024)
+
+#define LOG_FILE_MAGIC "FMLOG\0\0\1"
+#define LOG_FILE_HEADER_SIZE 8
+#define LOG_RECORD_MAGIC 0x464d5243u
+#define LOG_RECORD_HEADER_SIZE 20
+#define LOG_RECORD_TRAILER_SIZE 2
+#define LOG_MAX_FIELD_LEN 4095
+#define LOG_MESSAGE_SIZE 8400
+
+#define LOG_FLAG_RECURSIVE 0x01
+
+typedef enum{
+	LOG_OP_CREATE_DIR = 1,
+	LOG_OP_DELETE_DIR,
+	LOG_OP_LIST_DIR,
+	LOG_OP_LIST_BY_EXTENSION,
+	LOG_OP_CREATE_FILE,
+	LOG_OP_READ_FILE,
+	LOG_OP_APPEND_FILE,
+	LOG_OP_DELETE_FILE,
+	LOG_OP_COPY_FILE,
+	LOG_OP_MOVE_FILE,
+	LOG_OP_DISK_USAGE,
+	LOG_OP_FIND_DUPLICATES,
+	LOG_OP_WATCH_DIR,
+	LOG_OP_COUNT
+} LogOp;
+
+typedef enum{
+	LOG_FSYNC_NEVER,
+	LOG_FSYNC_ON_FLUSH,
+	LOG_FSYNC_ALWAYS
+} LogFsyncPolicy;
+
+/*
+ * Record layout: magic u32, length u16, op u8, flags u8, timestamp i64,
+ * path_len u16, detail_len u16, path, detail, length u16.
+ * The trailing copy of the length lets readers walk the log backwards.
+ */
+typedef struct{
+	uint16_t length;
+	uint8_t op;
+	uint8_t flags;
+	int64_t timestamp;
+	uint16_t path_len;
+	uint16_t detail_len;
+	const char *path;
+	const char *detail;
+} LogRecord;
+
+typedef struct{
+	int64_t timestamp;
+	uint64_t offset;
+} LogIndexEntry;
+
+void log_operation(LogOp op, int flags, const char *path, const char *detail);
+int logger_open(void);
+int log_file_path(const char *name, char *path, size_t size);
+void logger_flush(void);
+void logger_shutdown(void);
+
+const char *log_op_name(int op);
+int log_op_from_name(const char *name);
+int parse_log_record(const char *data, size_t len, LogRecord *record);
+size_t render_log_message(const LogRecord *record, char *buffer, size_t size);
+
+void show_logs(char *args[], size_t argc);
+
+#endif
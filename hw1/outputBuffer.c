@@ -0,0 +1,164 @@
+#include "outputBuffer.h"
+#include "threadPool.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <errno.h>
+
+static _Thread_local int thread_output_fd = STDOUT_FILENO;
+
+void out_init(OutputBuffer *out, int fd){
+	out->data = NULL;
+	out->len = 0;
+	out->cap = 0;
+	out->fd = fd;
+	out->flush_lock = NULL;
+	out->owner = NULL;
+	out->index = 0;
+}
+
+void out_free(OutputBuffer *out){
+	free(out->data);
+	out->data = NULL;
+	out->len = 0;
+	out->cap = 0;
+}
+
+static int out_reserve(OutputBuffer *out, size_t extra){
+	if(out->len + extra <= out->cap){
+		return 0;
+	}
+	size_t new_cap = out->cap ? out->cap : 4096;
+	while(new_cap < out->len + extra){
+		new_cap *= 2;
+	}
+	char *new_data = realloc(out->data, new_cap);
+	if(new_data == NULL){
+		return -1;
+	}
+	out->data = new_data;
+	out->cap = new_cap;
+	return 0;
+}
+
+static void out_maybe_flush(OutputBuffer *out){
+	if(out->len < OUTPUT_FLUSH_THRESHOLD){
+		return;
+	}
+	if(out->owner){
+		ordered_try_flush(out);
+	}else{
+		out_flush(out);
+	}
+}
+
+void out_write(OutputBuffer *out, const char *data, size_t len){
+	if(out_reserve(out, len) == -1){
+		out_flush(out);
+		if(out->flush_lock){
+			pthread_mutex_lock(out->flush_lock);
+		}
+		write_all(out->fd, data, len);
+		if(out->flush_lock){
+			pthread_mutex_unlock(out->flush_lock);
+		}
+		return;
+	}
+	memcpy(out->data + out->len, data, len);
+	out->len += len;
+	out_maybe_flush(out);
+}
+
+void out_printf(OutputBuffer *out, const char *format, ...){
+	va_list args;
+	va_start(args, format);
+	char small[512];
+	int needed = vsnprintf(small, sizeof(small), format, args);
+	va_end(args);
+	if(needed < 0){
+		return;
+	}
+	if((size_t)needed < sizeof(small)){
+		out_write(out, small, (size_t)needed);
+		return;
+	}
+	if(out_reserve(out, (size_t)needed + 1) == -1){
+		out_write(out, small, sizeof(small) - 1);
+		return;
+	}
+	va_start(args, format);
+	vsnprintf(out->data + out->len, (size_t)needed + 1, format, args);
+	va_end(args);
+	out->len += (size_t)needed;
+	out_maybe_flush(out);
+}
+
+void out_flush(OutputBuffer *out){
+	if(out->len == 0){
+		return;
+	}
+	if(out->flush_lock){
+		pthread_mutex_lock(out->flush_lock);
+	}
+	fflush(stdout);
+	write_all(out->fd, out->data, out->len);
+	if(out->flush_lock){
+		pthread_mutex_unlock(out->flush_lock);
+	}
+	out->len = 0;
+}
+
+int write_all(int fd, const char *data, size_t len){
+	while(len > 0){
+		ssize_t bytes_written = write(fd, data, len);
+		if(bytes_written == -1){
+			if(errno == EINTR){
+				continue;
+			}
+			return -1;
+		}
+		data += bytes_written;
+		len -= (size_t)bytes_written;
+	}
+	return 0;
+}
+
+int output_fd(void){
+	return thread_output_fd;
+}
+
+void set_output_fd(int fd){
+	thread_output_fd = fd;
+}
+
+void print_message(const char *format, ...){
+	va_list args;
+	va_start(args, format);
+	if(thread_output_fd == STDOUT_FILENO){
+		vprintf(format, args);
+		va_end(args);
+		return;
+	}
+	char buffer[1024];
+	va_list copy;
+	va_copy(copy, args);
+	int needed = vsnprintf(buffer, sizeof(buffer), format, args);
+	va_end(args);
+	if(needed < 0){
+		va_end(copy);
+		return;
+	}
+	if((size_t)needed < sizeof(buffer)){
+		write_all(thread_output_fd, buffer, (size_t)needed);
+	}else{
+		char *large = malloc((size_t)needed + 1);
+		if(large){
+			vsnprintf(large, (size_t)needed + 1, format, copy);
+			write_all(thread_output_fd, large, (size_t)needed);
+			free(large);
+		}
+	}
+	va_end(copy);
+}
@@ -0,0 +1,32 @@
+#include <stddef.h>
+#include <pthread.h>
+#ifndef OUTPUTBUFFER_H
+#define OUTPUTBUFFER_H
+
+#define OUTPUT_FLUSH_THRESHOLD (256 * 1024)
+
+struct OrderedRun;
+
+typedef struct{
+	char *data;
+	size_t len;
+	size_t cap;
+	int fd;
+	pthread_mutex_t *flush_lock;
+	struct OrderedRun *owner;
+	size_t index;
+} OutputBuffer;
+
+void out_init(OutputBuffer *out, int fd);
+void out_free(OutputBuffer *out);
+void out_write(OutputBuffer *out, const char *data, size_t len);
+void out_printf(OutputBuffer *out, const char *format, ...);
+void out_flush(OutputBuffer *out);
+int write_all(int fd, const char *data, size_t len);
+
+/* Where command output goes on the calling thread, stdout unless a server request redirected it. */
+int output_fd(void);
+void set_output_fd(int fd);
+void print_message(const char *format, ...);
+
+#endif
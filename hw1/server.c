@@ -0,0 +1,413 @@
+#define _GNU_SOURCE
+#include "server.h"
+#include "commands.h"
+#include "threadPool.h"
+#include "outputBuffer.h"
+#include "logger.h"
+#include "watchDir.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+typedef struct{
+	int fd;
+	int epoll_fd;
+} Connection;
+
+static _Thread_local int private_fs;
+
+static int socket_path(const char *override, char *buffer, size_t size){
+	const char *runtime_dir = getenv("XDG_RUNTIME_DIR");
+	int written;
+	if(override){
+		written = snprintf(buffer, size, "%s", override);
+	}else if(getenv("FILEMANAGER_SOCKET")){
+		written = snprintf(buffer, size, "%s", getenv("FILEMANAGER_SOCKET"));
+	}else if(runtime_dir){
+		written = snprintf(buffer, size, "%s/%s", runtime_dir, SERVER_SOCKET_NAME);
+	}else{
+		written = snprintf(buffer, size, "/tmp/%s-%d.sock", "fileManager", (int)getuid());
+	}
+	return written > 0 && (size_t)written < size ? 0 : -1;
+}
+
+/* Strips a leading --socket option, returning the number of arguments consumed. */
+static size_t parse_socket_option(char *args[], size_t argc, const char **path){
+	*path = NULL;
+	if(argc >= 1 && strncmp(args[0], "--socket=", 9) == 0){
+		*path = args[0] + 9;
+		return 1;
+	}
+	if(argc >= 2 && strcmp(args[0], "--socket") == 0){
+		*path = args[1];
+		return 2;
+	}
+	return 0;
+}
+
+static int fill_address(struct sockaddr_un *address, const char *path){
+	memset(address, 0, sizeof(*address));
+	address->sun_family = AF_UNIX;
+	if(strlen(path) >= sizeof(address->sun_path)){
+		return -1;
+	}
+	strcpy(address->sun_path, path);
+	return 0;
+}
+
+static int read_full(int fd, void *data, size_t len){
+	char *cursor = (char *)data;
+	while(len > 0){
+		ssize_t bytes_read = read(fd, cursor, len);
+		if(bytes_read == -1 && errno == EINTR){
+			continue;
+		}
+		if(bytes_read <= 0){
+			return -1;
+		}
+		cursor += bytes_read;
+		len -= (size_t)bytes_read;
+	}
+	return 0;
+}
+
+static int enter_directory(const char *path){
+	/* Each worker gets its own working directory so requests from different clients do not race on chdir. */
+	if(!private_fs){
+		if(unshare(CLONE_FS) == -1){
+			return -1;
+		}
+		private_fs = 1;
+	}
+	return chdir(path);
+}
+
+static uint32_t run_request(char *payload, size_t length){
+	char *strings[3];
+	size_t num_strings = 0;
+	for(size_t i = 0; i < length && num_strings < 3; i += strlen(payload + i) + 1){
+		strings[num_strings++] = payload + i;
+	}
+	if(num_strings < 2){
+		print_message("Error : Malformed request\n");
+		return SERVER_STATUS_BAD_REQUEST;
+	}
+	char *cwd = strings[0];
+	char *name = strings[1];
+	size_t argc = 0;
+	for(size_t i = (size_t)(name - payload) + strlen(name) + 1; i < length; i += strlen(payload + i) + 1){
+		argc++;
+	}
+	char **args = calloc(argc + 1, sizeof(char *));
+	if(args == NULL){
+		print_message("Memory allocation failed!\n");
+		return SERVER_STATUS_BAD_REQUEST;
+	}
+	size_t index = 0;
+	for(size_t i = (size_t)(name - payload) + strlen(name) + 1; i < length; i += strlen(payload + i) + 1){
+		args[index++] = payload + i;
+	}
+
+	uint32_t status = SERVER_STATUS_OK;
+	const Command *command = find_command(name);
+	if(command == NULL || command->func == serve || command->func == client){
+		print_message("%s: command not found\n", name);
+		status = SERVER_STATUS_UNKNOWN_COMMAND;
+	}else if(command->func == watch_dir){
+		/* It only returns on a signal, so it would hold a worker and never send its response. */
+		print_message("%s: not available through the server, run it directly\n", name);
+		status = SERVER_STATUS_BAD_REQUEST;
+	}else if(enter_directory(cwd) == -1){
+		print_message("Error : Could not enter the directory %s\n", cwd);
+		status = SERVER_STATUS_BAD_REQUEST;
+	}else{
+		command->func(argc > 0 ? args : NULL, argc);
+	}
+	free(args);
+	return status;
+}
+
+static int send_response(int fd, uint32_t status, int output){
+	off_t length = lseek(output, 0, SEEK_END);
+	if(length == -1){
+		return -1;
+	}
+	ResponseHeader header = {SERVER_RESPONSE_MAGIC, status, (uint64_t)length};
+	if(write_all(fd, (const char *)&header, sizeof(header)) == -1){
+		return -1;
+	}
+	off_t offset = 0;
+	while(offset < length){
+		ssize_t sent = sendfile(fd, output, &offset, (size_t)(length - offset));
+		if(sent == -1 && errno == EINTR){
+			continue;
+		}
+		if(sent <= 0){
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static int serve_request(int fd){
+	RequestHeader header;
+	if(read_full(fd, &header, sizeof(header)) == -1 || header.magic != SERVER_REQUEST_MAGIC || header.length == 0 || header.length > SERVER_MAX_REQUEST){
+		return -1;
+	}
+	char *payload = malloc(header.length);
+	if(payload == NULL || read_full(fd, payload, header.length) == -1 || payload[header.length - 1] != '\0'){
+		free(payload);
+		return -1;
+	}
+	int output = memfd_create("fileManager-output", MFD_CLOEXEC);
+	if(output == -1){
+		free(payload);
+		return -1;
+	}
+	set_output_fd(output);
+	uint32_t status = run_request(payload, header.length);
+	set_output_fd(STDOUT_FILENO);
+	free(payload);
+	int result = send_response(fd, status, output);
+	close(output);
+	return result;
+}
+
+static void serve_connection(void *arg){
+	Connection *connection = (Connection *)arg;
+	if(serve_request(connection->fd) == 0){
+		struct epoll_event event;
+		event.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+		event.data.ptr = connection;
+		if(epoll_ctl(connection->epoll_fd, EPOLL_CTL_MOD, connection->fd, &event) == 0){
+			return;
+		}
+	}
+	epoll_ctl(connection->epoll_fd, EPOLL_CTL_DEL, connection->fd, NULL);
+	close(connection->fd);
+	free(connection);
+}
+
+static void accept_connections(int listen_fd, int epoll_fd){
+	for(;;){
+		int fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+		if(fd == -1){
+			if(errno == EINTR){
+				continue;
+			}
+			return;
+		}
+		struct ucred credentials;
+		socklen_t credentials_len = sizeof(credentials);
+		if(getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &credentials, &credentials_len) == -1 || credentials.uid != getuid()){
+			close(fd);
+			continue;
+		}
+		struct timeval timeout = {SERVER_IO_TIMEOUT_SECONDS, 0};
+		setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+		setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+		Connection *connection = malloc(sizeof(Connection));
+		if(connection == NULL){
+			close(fd);
+			continue;
+		}
+		connection->fd = fd;
+		connection->epoll_fd = epoll_fd;
+		struct epoll_event event;
+		event.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+		event.data.ptr = connection;
+		if(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1){
+			close(fd);
+			free(connection);
+		}
+	}
+}
+
+static int open_listener(const char *path){
+	struct sockaddr_un address;
+	if(fill_address(&address, path) == -1){
+		print_message("Error : Socket path %s is too long\n", path);
+		return -1;
+	}
+	int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if(probe != -1){
+		int in_use = connect(probe, (struct sockaddr *)&address, sizeof(address)) == 0;
+		close(probe);
+		if(in_use){
+			print_message("Error : A server is already listening on %s\n", path);
+			return -1;
+		}
+	}
+	unlink(path);
+
+	int listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if(listen_fd == -1){
+		print_message("Error : Could not create the socket\n");
+		return -1;
+	}
+	mode_t old_mask = umask(0177);
+	int bound = bind(listen_fd, (struct sockaddr *)&address, sizeof(address));
+	umask(old_mask);
+	if(bound == -1 || listen(listen_fd, SOMAXCONN) == -1){
+		print_message("Error : Could not listen on %s (%s)\n", path, strerror(errno));
+		close(listen_fd);
+		return -1;
+	}
+	return listen_fd;
+}
+
+void serve(char *args[], size_t argc){
+	const char *override;
+	size_t consumed = parse_socket_option(args, argc, &override);
+	if(consumed != argc){
+		print_message("Error : Unknown option %s\n", args[consumed]);
+		return;
+	}
+	char path[sizeof(((struct sockaddr_un *)0)->sun_path) + 1];
+	if(socket_path(override, path, sizeof(path)) == -1){
+		print_message("Error : Socket path is too long\n");
+		return;
+	}
+	int listen_fd = open_listener(path);
+	if(listen_fd == -1){
+		return;
+	}
+
+	/* Blocked before any thread starts, so only the signalfd ever sees them. */
+	signal(SIGPIPE, SIG_IGN);
+	sigset_t signals;
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGINT);
+	sigaddset(&signals, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &signals, NULL);
+	if(logger_open() == -1){
+		print_message("Error : Could not open the logs file\n");
+	}
+	int signal_fd = signalfd(-1, &signals, SFD_CLOEXEC);
+	int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	ThreadPool *pool = pool_create(pool_default_threads());
+	if(signal_fd == -1 || epoll_fd == -1 || pool == NULL){
+		print_message("Error : Could not start the server\n");
+		close(listen_fd);
+		unlink(path);
+		return;
+	}
+	struct epoll_event event;
+	event.events = EPOLLIN;
+	event.data.ptr = &listen_fd;
+	epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &event);
+	event.data.ptr = &signal_fd;
+	epoll_ctl(epoll_fd, EPOLL_CTL_ADD, signal_fd, &event);
+	print_message("Listening on %s\n", path);
+	fflush(stdout);
+
+	int running = 1;
+	struct epoll_event events[SERVER_MAX_EVENTS];
+	while(running){
+		int num_events = epoll_wait(epoll_fd, events, SERVER_MAX_EVENTS, -1);
+		if(num_events == -1){
+			if(errno == EINTR){
+				continue;
+			}
+			break;
+		}
+		for(int i = 0; i < num_events; ++i){
+			if(events[i].data.ptr == &listen_fd){
+				accept_connections(listen_fd, epoll_fd);
+			}else if(events[i].data.ptr == &signal_fd){
+				running = 0;
+			}else if(pool_submit(pool, serve_connection, events[i].data.ptr) == -1){
+				serve_connection(events[i].data.ptr);
+			}
+		}
+	}
+
+	close(listen_fd);
+	unlink(path);
+	pool_wait(pool);
+	pool_destroy(pool);
+	close(epoll_fd);
+	close(signal_fd);
+	print_message("Server on %s stopped\n", path);
+}
+
+void client(char *args[], size_t argc){
+	const char *override;
+	size_t consumed = parse_socket_option(args, argc, &override);
+	args += consumed;
+	argc -= consumed;
+	if(argc == 0){
+		print_message("Error : Command name is not provided\n");
+		exit(SERVER_STATUS_BAD_REQUEST);
+	}
+	char path[sizeof(((struct sockaddr_un *)0)->sun_path) + 1];
+	struct sockaddr_un address;
+	if(socket_path(override, path, sizeof(path)) == -1 || fill_address(&address, path) == -1){
+		print_message("Error : Socket path is too long\n");
+		exit(SERVER_STATUS_BAD_REQUEST);
+	}
+	char *cwd = getcwd(NULL, 0);
+	size_t length = cwd ? strlen(cwd) + 1 : 0;
+	for(size_t i = 0; i < argc; ++i){
+		length += strlen(args[i]) + 1;
+	}
+	if(cwd == NULL || length > SERVER_MAX_REQUEST){
+		print_message("Error : Request is too large\n");
+		exit(SERVER_STATUS_BAD_REQUEST);
+	}
+	char *request = malloc(sizeof(RequestHeader) + length);
+	if(request == NULL){
+		print_message("Memory allocation failed!\n");
+		exit(SERVER_STATUS_BAD_REQUEST);
+	}
+	RequestHeader header = {SERVER_REQUEST_MAGIC, (uint32_t)length};
+	memcpy(request, &header, sizeof(header));
+	size_t cursor = sizeof(header);
+	memcpy(request + cursor, cwd, strlen(cwd) + 1);
+	cursor += strlen(cwd) + 1;
+	for(size_t i = 0; i < argc; ++i){
+		memcpy(request + cursor, args[i], strlen(args[i]) + 1);
+		cursor += strlen(args[i]) + 1;
+	}
+	free(cwd);
+
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if(fd == -1 || connect(fd, (struct sockaddr *)&address, sizeof(address)) == -1){
+		print_message("Error : Could not connect to the server at %s\n", path);
+		exit(SERVER_STATUS_BAD_REQUEST);
+	}
+	ResponseHeader response;
+	if(write_all(fd, request, cursor) == -1 || read_full(fd, &response, sizeof(response)) == -1 || response.magic != SERVER_RESPONSE_MAGIC){
+		print_message("Error : The server did not answer\n");
+		exit(SERVER_STATUS_BAD_REQUEST);
+	}
+	free(request);
+
+	char buffer[SERVER_COPY_BUFFER_SIZE];
+	uint64_t remaining = response.length;
+	while(remaining > 0){
+		size_t chunk = remaining < sizeof(buffer) ? (size_t)remaining : sizeof(buffer);
+		ssize_t bytes_read = read(fd, buffer, chunk);
+		if(bytes_read == -1 && errno == EINTR){
+			continue;
+		}
+		if(bytes_read <= 0 || write_all(STDOUT_FILENO, buffer, (size_t)bytes_read) == -1){
+			exit(SERVER_STATUS_BAD_REQUEST);
+		}
+		remaining -= (uint64_t)bytes_read;
+	}
+	close(fd);
+	exit((int)response.status);
+}
@@ -0,0 +1,39 @@
+#include <stddef.h>
+#include <stdint.h>
+#ifndef SERVER_H
+#define SERVER_H
+
+#define SERVER_SOCKET_NAME "fileManager.sock"
+#define SERVER_REQUEST_MAGIC 0x464d5251u
+#define SERVER_RESPONSE_MAGIC 0x464d5250u
+#define SERVER_MAX_REQUEST (1024 * 1024)
+#define SERVER_MAX_EVENTS 64
+#define SERVER_IO_TIMEOUT_SECONDS 10
+#define SERVER_COPY_BUFFER_SIZE (64 * 1024)
+
+/*
+ * A request is a header followed by NUL terminated strings: the client's
+ * working directory, the command name and its arguments. The response is a
+ * header followed by exactly length bytes of command output.
+ */
+typedef struct{
+	uint32_t magic;
+	uint32_t length;
+} RequestHeader;
+
+typedef struct{
+	uint32_t magic;
+	uint32_t status;
+	uint64_t length;
+} ResponseHeader;
+
+enum{
+	SERVER_STATUS_OK,
+	SERVER_STATUS_UNKNOWN_COMMAND,
+	SERVER_STATUS_BAD_REQUEST
+};
+
+void serve(char *args[], size_t argc);
+void client(char *args[], size_t argc);
+
+#endif
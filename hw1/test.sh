@@ -0,0 +1,47 @@
+#!/bin/sh
+# Regression checks for fileManager commands whose arguments depend on each
+# other. Run from the hw1 directory with `make test`.
+
+FILE_MANAGER="$(pwd)/fileManager"
+WORK_DIR=$(mktemp -d) || exit 1
+trap 'rm -rf "$WORK_DIR"' EXIT
+cd "$WORK_DIR" || exit 1
+
+failures=0
+
+check(){
+	if [ "$2" = "$3" ]; then
+		echo "ok   $1"
+	else
+		echo "FAIL $1"
+		echo "  expected: $3"
+		echo "  got:      $2"
+		failures=$((failures + 1))
+	fi
+}
+
+# A nested directory given before its parent is deleted first, every time
+nested_errors=0
+for i in $(seq 50); do
+	mkdir -p x/y
+	output=$(FILEMANAGER_THREADS=8 "$FILE_MANAGER" deleteDir x/y x)
+	if [ -n "$output" ] || [ -e x ]; then
+		nested_errors=$((nested_errors + 1))
+	fi
+done
+check "deleteDir x/y x in argument order" "$nested_errors" "0"
+
+mkdir -p a b c
+output=$(FILEMANAGER_THREADS=8 "$FILE_MANAGER" deleteDir a b c)
+check "deleteDir of independent directories" "$output$(ls -d a b c 2>/dev/null)" ""
+
+touch f
+output=$(FILEMANAGER_THREADS=8 "$FILE_MANAGER" deleteFile f ./f)
+check "deleteFile of one file named twice" "$output" "Error : File ./f not found"
+
+mkdir -p d/sub
+echo same > d/sub/one
+output=$("$FILE_MANAGER" findDuplicates d d/sub ./d | head -n 1)
+check "findDuplicates of repeated and nested roots" "$output" "No duplicate files found"
+
+[ "$failures" -eq 0 ]
@@ -0,0 +1,278 @@
+#include "threadPool.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+
+typedef struct Job{
+	void (*func)(void *);
+	void *arg;
+	struct Job *next;
+} Job;
+
+struct ThreadPool{
+	pthread_t *threads;
+	size_t num_threads;
+	Job *head;
+	Job *tail;
+	size_t pending;
+	int stopping;
+	int output_fd;
+	pthread_mutex_t mutex;
+	pthread_cond_t has_job;
+	pthread_cond_t all_done;
+};
+
+typedef struct OrderedRun{
+	TaskFunc func;
+	char **args;
+	size_t args_per_task;
+	size_t num_tasks;
+	void *context;
+	OutputBuffer *outputs;
+	int *done;
+	size_t next;
+	pthread_mutex_t mutex;
+} OrderedRun;
+
+typedef struct{
+	OrderedRun *run;
+	size_t index;
+} OrderedTask;
+
+static void *pool_worker(void *arg){
+	ThreadPool *pool = (ThreadPool *)arg;
+	set_output_fd(pool->output_fd);
+	for(;;){
+		pthread_mutex_lock(&pool->mutex);
+		while(pool->head == NULL && !pool->stopping){
+			pthread_cond_wait(&pool->has_job, &pool->mutex);
+		}
+		if(pool->head == NULL){
+			pthread_mutex_unlock(&pool->mutex);
+			return NULL;
+		}
+		Job *job = pool->head;
+		pool->head = job->next;
+		if(pool->head == NULL){
+			pool->tail = NULL;
+		}
+		pthread_mutex_unlock(&pool->mutex);
+
+		job->func(job->arg);
+		free(job);
+
+		pthread_mutex_lock(&pool->mutex);
+		if(--pool->pending == 0){
+			pthread_cond_broadcast(&pool->all_done);
+		}
+		pthread_mutex_unlock(&pool->mutex);
+	}
+}
+
+ThreadPool *pool_create(size_t num_threads){
+	if(num_threads == 0){
+		num_threads = 1;
+	}
+	ThreadPool *pool = calloc(1, sizeof(ThreadPool));
+	if(pool == NULL){
+		return NULL;
+	}
+	pool->threads = calloc(num_threads, sizeof(pthread_t));
+	if(pool->threads == NULL){
+		free(pool);
+		return NULL;
+	}
+	pool->output_fd = output_fd();
+	pthread_mutex_init(&pool->mutex, NULL);
+	pthread_cond_init(&pool->has_job, NULL);
+	pthread_cond_init(&pool->all_done, NULL);
+
+	for(size_t i = 0; i < num_threads; ++i){
+		if(pthread_create(&pool->threads[i], NULL, pool_worker, pool) != 0){
+			break;
+		}
+		pool->num_threads++;
+	}
+	if(pool->num_threads == 0){
+		pool_destroy(pool);
+		return NULL;
+	}
+	return pool;
+}
+
+int pool_submit(ThreadPool *pool, void (*func)(void *), void *arg){
+	Job *job = malloc(sizeof(Job));
+	if(job == NULL){
+		return -1;
+	}
+	job->func = func;
+	job->arg = arg;
+	job->next = NULL;
+
+	pthread_mutex_lock(&pool->mutex);
+	if(pool->tail){
+		pool->tail->next = job;
+	}else{
+		pool->head = job;
+	}
+	pool->tail = job;
+	pool->pending++;
+	pthread_cond_signal(&pool->has_job);
+	pthread_mutex_unlock(&pool->mutex);
+	return 0;
+}
+
+void pool_wait(ThreadPool *pool){
+	pthread_mutex_lock(&pool->mutex);
+	while(pool->pending > 0){
+		pthread_cond_wait(&pool->all_done, &pool->mutex);
+	}
+	pthread_mutex_unlock(&pool->mutex);
+}
+
+void pool_destroy(ThreadPool *pool){
+	if(pool == NULL){
+		return;
+	}
+	pthread_mutex_lock(&pool->mutex);
+	pool->stopping = 1;
+	pthread_cond_broadcast(&pool->has_job);
+	pthread_mutex_unlock(&pool->mutex);
+
+	for(size_t i = 0; i < pool->num_threads; ++i){
+		pthread_join(pool->threads[i], NULL);
+	}
+	pthread_mutex_destroy(&pool->mutex);
+	pthread_cond_destroy(&pool->has_job);
+	pthread_cond_destroy(&pool->all_done);
+	free(pool->threads);
+	free(pool);
+}
+
+size_t pool_default_threads(void){
+	char *env = getenv("FILEMANAGER_THREADS");
+	long threads = 0;
+	if(env){
+		threads = strtol(env, NULL, 10);
+	}
+	if(threads <= 0){
+		threads = sysconf(_SC_NPROCESSORS_ONLN);
+	}
+	if(threads <= 0){
+		threads = 1;
+	}
+	if(threads > MAX_POOL_THREADS){
+		threads = MAX_POOL_THREADS;
+	}
+	return (size_t)threads;
+}
+
+static void ordered_drain(OrderedRun *run){
+	while(run->next < run->num_tasks && run->done[run->next]){
+		out_flush(&run->outputs[run->next]);
+		out_free(&run->outputs[run->next]);
+		run->next++;
+	}
+}
+
+void ordered_try_flush(OutputBuffer *out){
+	OrderedRun *run = out->owner;
+	pthread_mutex_lock(&run->mutex);
+	if(run->next == out->index){
+		out_flush(out);
+	}
+	pthread_mutex_unlock(&run->mutex);
+}
+
+static void ordered_task(void *arg){
+	OrderedTask *task = (OrderedTask *)arg;
+	OrderedRun *run = task->run;
+	size_t index = task->index;
+
+	run->func(&run->args[index * run->args_per_task], run->context, &run->outputs[index]);
+
+	pthread_mutex_lock(&run->mutex);
+	run->done[index] = 1;
+	if(run->next == index){
+		ordered_drain(run);
+	}
+	pthread_mutex_unlock(&run->mutex);
+}
+
+static void run_sequential(TaskFunc func, char *args[], size_t num_tasks, size_t args_per_task, void *context){
+	OutputBuffer out;
+	out_init(&out, output_fd());
+	for(size_t i = 0; i < num_tasks; ++i){
+		func(&args[i * args_per_task], context, &out);
+		out_flush(&out);
+	}
+	out_free(&out);
+}
+
+/* For tasks whose effects depend on one another, run one after the other on the calling thread. */
+void run_tasks_in_order(TaskFunc func, char *args[], size_t num_tasks, size_t args_per_task, void *context){
+	run_sequential(func, args, num_tasks, args_per_task, context);
+}
+
+void run_tasks(TaskFunc func, char *args[], size_t num_tasks, size_t args_per_task, void *context){
+	size_t num_threads = pool_default_threads();
+	if(num_threads > num_tasks){
+		num_threads = num_tasks;
+	}
+
+	if(num_threads <= 1){
+		run_sequential(func, args, num_tasks, args_per_task, context);
+		return;
+	}
+
+	OrderedRun run;
+	run.func = func;
+	run.args = args;
+	run.args_per_task = args_per_task;
+	run.num_tasks = num_tasks;
+	run.context = context;
+	run.next = 0;
+	run.outputs = calloc(num_tasks, sizeof(OutputBuffer));
+	run.done = calloc(num_tasks, sizeof(int));
+	OrderedTask *tasks = calloc(num_tasks, sizeof(OrderedTask));
+	ThreadPool *pool = NULL;
+	if(run.outputs && run.done && tasks){
+		pool = pool_create(num_threads);
+	}
+	if(pool == NULL){
+		free(run.outputs);
+		free(run.done);
+		free(tasks);
+		print_message("Error : Could not start worker threads, running sequentially\n");
+		fflush(stdout);
+		run_sequential(func, args, num_tasks, args_per_task, context);
+		return;
+	}
+	pthread_mutex_init(&run.mutex, NULL);
+	fflush(stdout);
+
+	for(size_t i = 0; i < num_tasks; ++i){
+		out_init(&run.outputs[i], output_fd());
+		run.outputs[i].owner = &run;
+		run.outputs[i].index = i;
+		tasks[i].run = &run;
+		tasks[i].index = i;
+	}
+	for(size_t i = 0; i < num_tasks; ++i){
+		if(pool_submit(pool, ordered_task, &tasks[i]) == -1){
+			ordered_task(&tasks[i]);
+		}
+	}
+	pool_wait(pool);
+	pool_destroy(pool);
+
+	pthread_mutex_lock(&run.mutex);
+	ordered_drain(&run);
+	pthread_mutex_unlock(&run.mutex);
+
+	pthread_mutex_destroy(&run.mutex);
+	free(run.outputs);
+	free(run.done);
+	free(tasks);
+}
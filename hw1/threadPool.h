@@ -0,0 +1,21 @@
+#include <stddef.h>
+#include "outputBuffer.h"
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#define MAX_POOL_THREADS 64
+
+typedef struct ThreadPool ThreadPool;
+typedef void (*TaskFunc)(char *args[], void *context, OutputBuffer *out);
+
+ThreadPool *pool_create(size_t num_threads);
+int pool_submit(ThreadPool *pool, void (*func)(void *), void *arg);
+void pool_wait(ThreadPool *pool);
+void pool_destroy(ThreadPool *pool);
+size_t pool_default_threads(void);
+
+void run_tasks(TaskFunc func, char *args[], size_t num_tasks, size_t args_per_task, void *context);
+void run_tasks_in_order(TaskFunc func, char *args[], size_t num_tasks, size_t args_per_task, void *context);
+void ordered_try_flush(OutputBuffer *out);
+
+#endif
@@ -0,0 +1,344 @@
+#define _GNU_SOURCE
+#include "treeWalk.h"
+#include "threadPool.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/resource.h>
+
+#define WALK_IDLE_WAIT_NS 2000000L
+
+typedef struct{
+	WalkDir **items;
+	size_t top;
+	size_t bottom;
+	size_t capacity;
+	pthread_mutex_t mutex;
+} WalkDeque;
+
+typedef struct{
+	const WalkOptions *options;
+	WalkWorker *workers;
+	WalkDeque *deques;
+	size_t num_threads;
+	atomic_size_t outstanding;
+	atomic_int idle;
+	pthread_mutex_t idle_mutex;
+	pthread_cond_t idle_cond;
+} WalkState;
+
+typedef struct{
+	WalkState *state;
+	size_t index;
+} WalkThread;
+
+void raise_open_file_limit(void){
+	struct rlimit limit;
+	if(getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max){
+		limit.rlim_cur = limit.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &limit);
+	}
+}
+
+static WalkDir *walk_dir_create(WalkDir *parent, const char *name, size_t data_size){
+	size_t name_len = strlen(name);
+	WalkDir *dir = malloc(sizeof(WalkDir) + name_len + 1);
+	if(dir == NULL){
+		return NULL;
+	}
+	memcpy(dir->name, name, name_len + 1);
+	dir->parent = parent;
+	dir->fd = -1;
+	dir->depth = parent ? parent->depth + 1 : 0;
+	atomic_init(&dir->open_refs, 1);
+	atomic_init(&dir->pending, 1);
+	dir->data = NULL;
+	if(data_size > 0 && (dir->data = calloc(1, data_size)) == NULL){
+		free(dir);
+		return NULL;
+	}
+	if(parent == NULL){
+		dir->path = strdup(name);
+	}else{
+		size_t parent_len = strlen(parent->path);
+		int needs_slash = parent_len > 0 && parent->path[parent_len - 1] != '/';
+		dir->path = malloc(parent_len + needs_slash + name_len + 1);
+		if(dir->path){
+			memcpy(dir->path, parent->path, parent_len);
+			if(needs_slash){
+				dir->path[parent_len] = '/';
+			}
+			memcpy(dir->path + parent_len + needs_slash, name, name_len + 1);
+		}
+	}
+	if(dir->path == NULL){
+		free(dir->data);
+		free(dir);
+		return NULL;
+	}
+	return dir;
+}
+
+static void walk_dir_free(WalkDir *dir){
+	free(dir->path);
+	free(dir->data);
+	free(dir);
+}
+
+static int deque_push(WalkDeque *deque, WalkDir *dir){
+	pthread_mutex_lock(&deque->mutex);
+	if(deque->bottom == deque->capacity){
+		if(deque->top > 0){
+			memmove(deque->items, deque->items + deque->top, (deque->bottom - deque->top) * sizeof(WalkDir *));
+			deque->bottom -= deque->top;
+			deque->top = 0;
+		}else{
+			size_t new_capacity = deque->capacity ? deque->capacity * 2 : WALK_DEQUE_INITIAL_CAPACITY;
+			WalkDir **items = realloc(deque->items, new_capacity * sizeof(WalkDir *));
+			if(items == NULL){
+				pthread_mutex_unlock(&deque->mutex);
+				return -1;
+			}
+			deque->items = items;
+			deque->capacity = new_capacity;
+		}
+	}
+	deque->items[deque->bottom++] = dir;
+	pthread_mutex_unlock(&deque->mutex);
+	return 0;
+}
+
+static WalkDir *deque_pop(WalkDeque *deque){
+	WalkDir *dir = NULL;
+	pthread_mutex_lock(&deque->mutex);
+	if(deque->bottom > deque->top){
+		dir = deque->items[--deque->bottom];
+		if(deque->bottom == deque->top){
+			deque->top = deque->bottom = 0;
+		}
+	}
+	pthread_mutex_unlock(&deque->mutex);
+	return dir;
+}
+
+static WalkDir *deque_steal(WalkDeque *deque){
+	WalkDir *dir = NULL;
+	pthread_mutex_lock(&deque->mutex);
+	if(deque->bottom > deque->top){
+		dir = deque->items[deque->top++];
+		if(deque->bottom == deque->top){
+			deque->top = deque->bottom = 0;
+		}
+	}
+	pthread_mutex_unlock(&deque->mutex);
+	return dir;
+}
+
+static void release_open_ref(WalkDir *dir){
+	if(dir && atomic_fetch_sub(&dir->open_refs, 1) == 1 && dir->fd != -1){
+		close(dir->fd);
+		dir->fd = -1;
+	}
+}
+
+static void finish_pending(WalkState *state, WalkWorker *worker, WalkDir *dir){
+	while(dir && atomic_fetch_sub(&dir->pending, 1) == 1){
+		WalkDir *parent = dir->parent;
+		if(state->options->on_dir_done){
+			state->options->on_dir_done(worker, dir, state->options->user);
+		}
+		walk_dir_free(dir);
+		dir = parent;
+	}
+}
+
+static void schedule_dir(WalkState *state, size_t index, WalkDir *dir){
+	atomic_fetch_add(&state->outstanding, 1);
+	if(deque_push(&state->deques[index], dir) == -1){
+		atomic_fetch_sub(&state->outstanding, 1);
+		release_open_ref(dir->parent);
+		finish_pending(state, &state->workers[index], dir);
+		return;
+	}
+	if(atomic_load(&state->idle) > 0){
+		pthread_mutex_lock(&state->idle_mutex);
+		pthread_cond_signal(&state->idle_cond);
+		pthread_mutex_unlock(&state->idle_mutex);
+	}
+}
+
+static void process_dir(WalkState *state, size_t index, WalkDir *dir){
+	const WalkOptions *options = state->options;
+	WalkWorker *worker = &state->workers[index];
+	int parent_fd = dir->parent ? dir->parent->fd : AT_FDCWD;
+	const char *open_name = dir->parent ? dir->name : dir->path;
+
+	// The root may be a symlink to a directory, entries below it are never followed
+	int flags = O_RDONLY | O_DIRECTORY | O_CLOEXEC;
+	if(dir->parent){
+		flags |= O_NOFOLLOW;
+	}
+	int fd = openat(parent_fd, open_name, flags);
+	int open_error = errno;
+	release_open_ref(dir->parent);
+
+	DirReader reader;
+	if(fd == -1 || dir_reader_from_fd(&reader, fd) == -1){
+		if(fd != -1){
+			close(fd);
+			open_error = ENOMEM;
+		}
+		if(options->on_error){
+			options->on_error(worker, dir->path, open_error, options->user);
+		}
+	}else{
+		dir->fd = fd;
+		if(options->on_dir_open){
+			options->on_dir_open(worker, dir, options->user);
+		}
+		DirEntry *entry;
+		while((entry = dir_reader_next(&reader)) != NULL){
+			if(is_dot_entry(entry->d_name)){
+				continue;
+			}
+			unsigned char type = resolve_entry_type(fd, entry->d_name, entry->d_type);
+			int descend = options->on_entry ? options->on_entry(worker, dir, entry->d_name, type, options->user) : 1;
+			if(!descend || type != DT_DIR){
+				continue;
+			}
+			WalkDir *child = walk_dir_create(dir, entry->d_name, options->dir_data_size);
+			if(child == NULL){
+				if(options->on_error){
+					options->on_error(worker, dir->path, ENOMEM, options->user);
+				}
+				continue;
+			}
+			atomic_fetch_add(&dir->open_refs, 1);
+			atomic_fetch_add(&dir->pending, 1);
+			schedule_dir(state, index, child);
+		}
+		if(reader.error && options->on_error){
+			options->on_error(worker, dir->path, reader.error, options->user);
+		}
+		dir_reader_close(&reader);
+	}
+	release_open_ref(dir);
+	finish_pending(state, worker, dir);
+}
+
+static WalkDir *steal_work(WalkState *state, size_t index){
+	for(size_t i = 1; i < state->num_threads; ++i){
+		WalkDir *dir = deque_steal(&state->deques[(index + i) % state->num_threads]);
+		if(dir){
+			return dir;
+		}
+	}
+	return NULL;
+}
+
+static void walk_worker(void *arg){
+	WalkThread *thread = (WalkThread *)arg;
+	WalkState *state = thread->state;
+	size_t index = thread->index;
+
+	for(;;){
+		WalkDir *dir = deque_pop(&state->deques[index]);
+		if(dir == NULL){
+			dir = steal_work(state, index);
+		}
+		if(dir){
+			process_dir(state, index, dir);
+			if(atomic_fetch_sub(&state->outstanding, 1) == 1){
+				pthread_mutex_lock(&state->idle_mutex);
+				pthread_cond_broadcast(&state->idle_cond);
+				pthread_mutex_unlock(&state->idle_mutex);
+			}
+			continue;
+		}
+
+		pthread_mutex_lock(&state->idle_mutex);
+		if(atomic_load(&state->outstanding) == 0){
+			pthread_mutex_unlock(&state->idle_mutex);
+			return;
+		}
+		struct timespec deadline;
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_nsec += WALK_IDLE_WAIT_NS;
+		if(deadline.tv_nsec >= 1000000000L){
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000L;
+		}
+		atomic_fetch_add(&state->idle, 1);
+		pthread_cond_timedwait(&state->idle_cond, &state->idle_mutex, &deadline);
+		atomic_fetch_sub(&state->idle, 1);
+		pthread_mutex_unlock(&state->idle_mutex);
+	}
+}
+
+int tree_walk(char *roots[], size_t num_roots, const WalkOptions *options, WalkWorker *workers){
+	size_t num_threads = options->num_threads ? options->num_threads : 1;
+	WalkState state;
+	state.options = options;
+	state.workers = workers;
+	state.num_threads = num_threads;
+	atomic_init(&state.outstanding, 0);
+	atomic_init(&state.idle, 0);
+	state.deques = calloc(num_threads, sizeof(WalkDeque));
+	WalkThread *threads = calloc(num_threads, sizeof(WalkThread));
+	if(state.deques == NULL || threads == NULL){
+		free(state.deques);
+		free(threads);
+		return -1;
+	}
+	pthread_mutex_init(&state.idle_mutex, NULL);
+	pthread_cond_init(&state.idle_cond, NULL);
+	for(size_t i = 0; i < num_threads; ++i){
+		pthread_mutex_init(&state.deques[i].mutex, NULL);
+		workers[i].index = i;
+		threads[i].state = &state;
+		threads[i].index = i;
+	}
+	raise_open_file_limit();
+
+	for(size_t i = 0; i < num_roots; ++i){
+		WalkDir *root = walk_dir_create(NULL, roots[i], options->dir_data_size);
+		if(root == NULL){
+			if(options->on_error){
+				options->on_error(&workers[0], roots[i], ENOMEM, options->user);
+			}
+			continue;
+		}
+		schedule_dir(&state, i % num_threads, root);
+	}
+
+	ThreadPool *pool = num_threads > 1 ? pool_create(num_threads) : NULL;
+	if(pool == NULL){
+		for(size_t i = 0; i < num_threads; ++i){
+			walk_worker(&threads[i]);
+		}
+	}else{
+		for(size_t i = 0; i < num_threads; ++i){
+			if(pool_submit(pool, walk_worker, &threads[i]) == -1){
+				walk_worker(&threads[i]);
+			}
+		}
+		pool_wait(pool);
+		pool_destroy(pool);
+	}
+
+	for(size_t i = 0; i < num_threads; ++i){
+		pthread_mutex_destroy(&state.deques[i].mutex);
+		free(state.deques[i].items);
+	}
+	pthread_mutex_destroy(&state.idle_mutex);
+	pthread_cond_destroy(&state.idle_cond);
+	free(state.deques);
+	free(threads);
+	return 0;
+}
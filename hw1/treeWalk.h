@@ -0,0 +1,41 @@
+#include <stddef.h>
+#include <stdatomic.h>
+#include "dirListing.h"
+#ifndef TREEWALK_H
+#define TREEWALK_H
+
+#define WALK_DEQUE_INITIAL_CAPACITY 256
+
+typedef struct WalkDir{
+	struct WalkDir *parent;
+	char *path;
+	int fd;
+	int depth;
+	atomic_int open_refs;
+	atomic_int pending;
+	void *data;
+	char name[];
+} WalkDir;
+
+typedef struct{
+	size_t index;
+	void *data;
+} WalkWorker;
+
+typedef struct{
+	size_t num_threads;
+	size_t dir_data_size;
+	void *user;
+	/* Called once a directory is open, before any of its entries. */
+	void (*on_dir_open)(WalkWorker *worker, WalkDir *dir, void *user);
+	/* Called for every entry except . and ..; the return value decides whether a directory is descended into. */
+	int (*on_entry)(WalkWorker *worker, WalkDir *dir, const char *name, unsigned char type, void *user);
+	/* Called once a directory and everything below it has been visited. */
+	void (*on_dir_done)(WalkWorker *worker, WalkDir *dir, void *user);
+	void (*on_error)(WalkWorker *worker, const char *path, int error, void *user);
+} WalkOptions;
+
+int tree_walk(char *roots[], size_t num_roots, const WalkOptions *options, WalkWorker *workers);
+void raise_open_file_limit(void);
+
+#endif
@@ -0,0 +1,145 @@
+#define _GNU_SOURCE
+#include "uring.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *params){
+	return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags){
+	return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args){
+	return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+int uring_init(Uring *ring, unsigned entries){
+	struct io_uring_params params;
+	memset(ring, 0, sizeof(Uring));
+	memset(&params, 0, sizeof(params));
+	ring->fd = sys_io_uring_setup(entries, &params);
+	if(ring->fd == -1){
+		return -1;
+	}
+
+	ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	if(params.features & IORING_FEAT_SINGLE_MMAP){
+		if(ring->cq_ring_size > ring->sq_ring_size){
+			ring->sq_ring_size = ring->cq_ring_size;
+		}
+		ring->cq_ring_size = ring->sq_ring_size;
+	}
+	ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+	if(ring->sq_ring == MAP_FAILED){
+		close(ring->fd);
+		return -1;
+	}
+	if(params.features & IORING_FEAT_SINGLE_MMAP){
+		ring->cq_ring = ring->sq_ring;
+	}else{
+		ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+		if(ring->cq_ring == MAP_FAILED){
+			munmap(ring->sq_ring, ring->sq_ring_size);
+			close(ring->fd);
+			return -1;
+		}
+	}
+	ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+	if(ring->sqes == MAP_FAILED){
+		if(ring->cq_ring != ring->sq_ring){
+			munmap(ring->cq_ring, ring->cq_ring_size);
+		}
+		munmap(ring->sq_ring, ring->sq_ring_size);
+		close(ring->fd);
+		return -1;
+	}
+
+	char *sq = ring->sq_ring;
+	char *cq = ring->cq_ring;
+	ring->sq_head = (unsigned *)(sq + params.sq_off.head);
+	ring->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+	ring->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+	ring->sq_array = (unsigned *)(sq + params.sq_off.array);
+	ring->cq_head = (unsigned *)(cq + params.cq_off.head);
+	ring->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+	ring->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+	ring->sq_entries = params.sq_entries;
+	ring->sqe_tail = *ring->sq_tail;
+	ring->submitted_tail = ring->sqe_tail;
+	return 0;
+}
+
+void uring_exit(Uring *ring){
+	munmap(ring->sqes, ring->sqes_size);
+	if(ring->cq_ring != ring->sq_ring){
+		munmap(ring->cq_ring, ring->cq_ring_size);
+	}
+	munmap(ring->sq_ring, ring->sq_ring_size);
+	close(ring->fd);
+}
+
+struct io_uring_sqe *uring_get_sqe(Uring *ring){
+	unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+	if(ring->sqe_tail - head >= ring->sq_entries){
+		return NULL;
+	}
+	unsigned index = ring->sqe_tail & *ring->sq_mask;
+	struct io_uring_sqe *sqe = &ring->sqes[index];
+	memset(sqe, 0, sizeof(*sqe));
+	ring->sq_array[index] = index;
+	ring->sqe_tail++;
+	return sqe;
+}
+
+int uring_submit_and_wait(Uring *ring, unsigned wait_nr){
+	__atomic_store_n(ring->sq_tail, ring->sqe_tail, __ATOMIC_RELEASE);
+	unsigned to_submit = ring->sqe_tail - ring->submitted_tail;
+	for(;;){
+		int submitted = sys_io_uring_enter(ring->fd, to_submit, wait_nr, wait_nr ? IORING_ENTER_GETEVENTS : 0);
+		if(submitted == -1){
+			if(errno == EINTR){
+				continue;
+			}
+			return -1;
+		}
+		ring->submitted_tail += (unsigned)submitted;
+		to_submit -= (unsigned)submitted;
+		if(to_submit == 0){
+			return 0;
+		}
+	}
+}
+
+struct io_uring_cqe *uring_peek_cqe(Uring *ring){
+	unsigned head = *ring->cq_head;
+	if(head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)){
+		return NULL;
+	}
+	return &ring->cqes[head & *ring->cq_mask];
+}
+
+void uring_cqe_seen(Uring *ring){
+	__atomic_store_n(ring->cq_head, *ring->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+int uring_register_sparse_files(Uring *ring, unsigned count){
+	int *fds = malloc(count * sizeof(int));
+	if(fds == NULL){
+		return -1;
+	}
+	for(unsigned i = 0; i < count; ++i){
+		fds[i] = -1;
+	}
+	int result = sys_io_uring_register(ring->fd, IORING_REGISTER_FILES, fds, count);
+	free(fds);
+	return result;
+}
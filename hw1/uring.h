@@ -0,0 +1,35 @@
+#include <stddef.h>
+#include <linux/io_uring.h>
+#ifndef URING_H
+#define URING_H
+
+typedef struct{
+	int fd;
+	unsigned *sq_head;
+	unsigned *sq_tail;
+	unsigned *sq_mask;
+	unsigned *sq_array;
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	void *sq_ring;
+	void *cq_ring;
+	size_t sq_ring_size;
+	size_t cq_ring_size;
+	size_t sqes_size;
+	unsigned sq_entries;
+	unsigned sqe_tail;
+	unsigned submitted_tail;
+} Uring;
+
+int uring_init(Uring *ring, unsigned entries);
+void uring_exit(Uring *ring);
+struct io_uring_sqe *uring_get_sqe(Uring *ring);
+int uring_submit_and_wait(Uring *ring, unsigned wait_nr);
+struct io_uring_cqe *uring_peek_cqe(Uring *ring);
+void uring_cqe_seen(Uring *ring);
+int uring_register_sparse_files(Uring *ring, unsigned count);
+
+#endif
@@ -1,3 +1,4 @@
+#define _XOPEN_SOURCE 700
 #include "utilities.h"
 #include <stdio.h>
 #include <time.h>
@@ -9,44 +10,122 @@ void print_command_manual(){
 	printf("Usage: fileManager <command> [arguments]\n");
 	printf("Commands:\n");
 	printf("createDir \"folderName\"                       -Create a new directory\n");
-	printf("createFile \"fileName\"                        -Create a new file\n");
-	printf("listDir                                      -List all files in a directory\n");
-	printf("listFilesByExtension \"folderName\" \".txt\"     -List files with specific extension\n");
-	printf("readFile \"fileName\"                          -Read a file's content\n");
-	printf("appendToFile \"fileName\" \"new content\"        -Append content to a file\n");
+	printf("createFile [--bulk] \"fileName\" ...           -Create new files, --bulk batches them through io_uring\n");
+	printf("listDir \"folderName\" [--type] [--size] [--sort] [--mem-budget=64M]\n");
+	printf("                                             -List all files in a directory\n");
+	printf("listFilesByExtension [-r|--cache] \"folderName\" \".txt[,.c]\"\n");
+	printf("                                             -List files with specific extensions, -r for subdirectories,\n");
+	printf("                                              --cache to answer from a per-directory index\n");
+	printf("readFile \"fileName\" [--offset N] [--length N] -Read a file's content\n");
+	printf("appendToFile [--sync] \"fileName\" \"new content\"\n");
+	printf("                                             -Append content to a file, --sync waits for fdatasync\n");
 	printf("deleteFile \"fileName\"                        -Delete a file\n");
 	printf("deleteDir \"folderName\"                       -Delete an empty directory\n");
-	printf("showlogs                                     -Display operation logs\n");
+	printf("copyFile \"source\" [...] \"target\"             -Copy files, into target if it is a directory\n");
+	printf("moveFile \"source\" [...] \"target\"             -Move files, into target if it is a directory\n");
+	printf("diskUsage [-s] [-h] [--apparent] [--max-depth=N] \"folderName\"\n");
+	printf("                                             -Show the space used by each directory, hardlinks counted once\n");
+	printf("watchDir \"folderName\" [\".txt[,.c]\"]          -List a directory, then print files created, deleted or renamed in it\n");
+	printf("findDuplicates \"folderName\" [...]           -List files with identical contents, hardlinks excluded\n");
+	printf("serve [--socket path]                        -Run commands sent by clients over a UNIX socket\n");
+	printf("client [--socket path] <command> [arguments]\n");
+	printf("                                             -Send a command to a running server\n");
+	printf("showlogs [--since T] [--until T] [--op createFile,...] [--prefix path] [--tail N]\n");
+	printf("                                             -Display operation logs\n");
 }
 
-char* get_timeStamp_string(){
-	time_t current_time;
-	struct tm *time_info;
-	time(&current_time);
-	time_info = localtime(&current_time);
-	static char timeStamp[25];
-	strftime(timeStamp, sizeof(timeStamp), "[%Y-%m-%d %H:%M:%S]", time_info);
-	return timeStamp;
+/* 1 when the canonical path is the ancestor itself or lies below it. */
+int path_within(const char *path, const char *ancestor){
+	size_t len = strlen(ancestor);
+	if(strncmp(path, ancestor, len) != 0){
+		return 0;
+	}
+	return path[len] == '\0' || path[len] == '/' || (len > 0 && ancestor[len - 1] == '/');
+}
+
+/* Sorting '/' before every other byte keeps each path right in front of its descendants. */
+static int compare_paths(const void *a, const void *b){
+	const unsigned char *left = *(const unsigned char **)a;
+	const unsigned char *right = *(const unsigned char **)b;
+	while(*left && *left == *right){
+		left++;
+		right++;
+	}
+	int l = *left == '/' ? 1 : (*left == '\0' ? 0 : *left + 1);
+	int r = *right == '/' ? 1 : (*right == '\0' ? 0 : *right + 1);
+	return l - r;
+}
+
+/*
+ * 1 when two of the paths name the same file or one lies inside another, so
+ * operations on them depend on their order. A path that cannot be resolved
+ * counts as overlapping, as its relation to the others is unknown.
+ */
+int paths_overlap(char *paths[], size_t count){
+	if(count < 2){
+		return 0;
+	}
+	char **resolved = calloc(count, sizeof(char *));
+	if(resolved == NULL){
+		return 1;
+	}
+	int overlap = 0;
+	for(size_t i = 0; i < count && !overlap; ++i){
+		resolved[i] = realpath(paths[i], NULL);
+		overlap = resolved[i] == NULL;
+	}
+	if(!overlap){
+		qsort(resolved, count, sizeof(char *), compare_paths);
+		for(size_t i = 1; i < count && !overlap; ++i){
+			overlap = path_within(resolved[i], resolved[i - 1]);
+		}
+	}
+	for(size_t i = 0; i < count; ++i){
+		free(resolved[i]);
+	}
+	free(resolved);
+	return overlap;
 }
 
-char* concatenate_strings(char *arr[], size_t size){
-	size_t total_length = 0;
-	for(size_t i = 0; i < size; ++i){
-		total_length += strlen(arr[i]);
-	}
-	total_length += size;
-	char *result = (char *)malloc(total_length * sizeof(char));
-	if(result == NULL){
-		printf("Memory allocation failed!\n");
-		return NULL;
-	}
-	result[0] = '\0';
-	
-	for(size_t i = 0; i < size; ++i){
-		strcat(result, arr[i]);
-		if(i < size){
-			strcat(result, " ");
+/*
+ * Drops every path that names the same file as an earlier one or lies inside
+ * another, keeping the rest in their order and spelling. Returns how many
+ * paths are kept, or -1 when memory runs out. Unresolvable paths are kept.
+ */
+int drop_nested_paths(char *paths[], size_t count){
+	char **resolved = calloc(count ? count : 1, sizeof(char *));
+	if(resolved == NULL){
+		return -1;
+	}
+	for(size_t i = 0; i < count; ++i){
+		resolved[i] = realpath(paths[i], NULL);
+	}
+	size_t kept = 0;
+	for(size_t i = 0; i < count; ++i){
+		int nested = 0;
+		for(size_t j = 0; j < count && !nested && resolved[i]; ++j){
+			if(j == i || resolved[j] == NULL || !path_within(resolved[i], resolved[j])){
+				continue;
+			}
+			nested = strcmp(resolved[i], resolved[j]) != 0 || j < i;
+		}
+		if(!nested){
+			paths[kept++] = paths[i];
 		}
 	}
-	return result;
+	for(size_t i = 0; i < count; ++i){
+		free(resolved[i]);
+	}
+	free(resolved);
+	return (int)kept;
+}
+
+char* get_timeStamp_string(){
+	time_t current_time;
+	struct tm time_info;
+	time(&current_time);
+	localtime_r(&current_time, &time_info);
+	static _Thread_local char timeStamp[25];
+	strftime(timeStamp, sizeof(timeStamp), "[%Y-%m-%d %H:%M:%S]", &time_info);
+	return timeStamp;
 }
@@ -4,6 +4,8 @@
 
 void print_command_manual();
 char* get_timeStamp_string();
-char* concatenate_strings(char *arr[], size_t size);
+int path_within(const char *path, const char *ancestor);
+int paths_overlap(char *paths[], size_t count);
+int drop_nested_paths(char *paths[], size_t count);
 
 #endif
@@ -0,0 +1,372 @@
+#define _GNU_SOURCE
+#include "watchDir.h"
+#include "directoryUtils.h"
+#include "dirListing.h"
+#include "extensionSet.h"
+#include "outputBuffer.h"
+#include "logger.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/signalfd.h>
+
+#define WATCH_EVENTS (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_CLOSE_WRITE | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR)
+#define TOMBSTONE ((char *)1)
+
+/* Names currently in the directory, so rescans can be turned back into events. */
+typedef struct{
+	char **slots;
+	size_t capacity;
+	size_t count;
+	size_t used;
+} NameSet;
+
+typedef struct{
+	const char *path;
+	ExtensionSet set;
+	int has_filter;
+	NameSet names;
+	OutputBuffer out;
+	char *moved_from;
+	uint32_t moved_cookie;
+} Watch;
+
+static size_t name_slot(const NameSet *names, const char *name, int *found){
+	size_t mask = names->capacity - 1;
+	size_t slot = hash_string(name, strlen(name)) & mask;
+	size_t first_free = (size_t)-1;
+	*found = 0;
+	while(names->slots[slot] != NULL){
+		if(names->slots[slot] == TOMBSTONE){
+			if(first_free == (size_t)-1){
+				first_free = slot;
+			}
+		}else if(strcmp(names->slots[slot], name) == 0){
+			*found = 1;
+			return slot;
+		}
+		slot = (slot + 1) & mask;
+	}
+	return first_free != (size_t)-1 ? first_free : slot;
+}
+
+static int names_init(NameSet *names){
+	names->capacity = WATCH_NAMES_INITIAL_CAPACITY;
+	names->count = 0;
+	names->used = 0;
+	names->slots = calloc(names->capacity, sizeof(char *));
+	return names->slots ? 0 : -1;
+}
+
+static void names_free(NameSet *names){
+	for(size_t i = 0; i < names->capacity; ++i){
+		if(names->slots[i] != NULL && names->slots[i] != TOMBSTONE){
+			free(names->slots[i]);
+		}
+	}
+	free(names->slots);
+}
+
+static int names_contains(const NameSet *names, const char *name){
+	int found;
+	name_slot(names, name, &found);
+	return found;
+}
+
+static int names_rehash(NameSet *names, size_t capacity){
+	char **old = names->slots;
+	size_t old_capacity = names->capacity;
+	names->slots = calloc(capacity, sizeof(char *));
+	if(names->slots == NULL){
+		names->slots = old;
+		return -1;
+	}
+	names->capacity = capacity;
+	names->used = names->count;
+	for(size_t i = 0; i < old_capacity; ++i){
+		if(old[i] != NULL && old[i] != TOMBSTONE){
+			int found;
+			names->slots[name_slot(names, old[i], &found)] = old[i];
+		}
+	}
+	free(old);
+	return 0;
+}
+
+/* Returns 1 if the name was added, 0 if it was already there. */
+static int names_add(NameSet *names, const char *name){
+	if((names->used + 1) * 4 > names->capacity * 3){
+		size_t capacity = names->count * 2 >= names->capacity / 2 ? names->capacity * 2 : names->capacity;
+		if(names_rehash(names, capacity) == -1){
+			return -1;
+		}
+	}
+	int found;
+	size_t slot = name_slot(names, name, &found);
+	if(found){
+		return 0;
+	}
+	char *copy = strdup(name);
+	if(copy == NULL){
+		return -1;
+	}
+	if(names->slots[slot] == NULL){
+		names->used++;
+	}
+	names->slots[slot] = copy;
+	names->count++;
+	return 1;
+}
+
+/* Returns 1 if the name was removed, 0 if it was not there. */
+static int names_remove(NameSet *names, const char *name){
+	int found;
+	size_t slot = name_slot(names, name, &found);
+	if(!found){
+		return 0;
+	}
+	free(names->slots[slot]);
+	names->slots[slot] = TOMBSTONE;
+	names->count--;
+	return 1;
+}
+
+static int watch_matches(const Watch *watch, const char *name){
+	return !watch->has_filter || ext_set_match(&watch->set, name) >= 0;
+}
+
+static void emit(Watch *watch, const char *kind, const char *name){
+	out_printf(&watch->out, "%s\t%s/%s\n", kind, watch->path, name);
+}
+
+static void on_created(Watch *watch, const char *name){
+	if(watch_matches(watch, name) && names_add(&watch->names, name) == 1){
+		emit(watch, "created", name);
+	}
+}
+
+static void on_deleted(Watch *watch, const char *name){
+	if(names_remove(&watch->names, name) == 1){
+		emit(watch, "deleted", name);
+	}
+}
+
+static void on_renamed(Watch *watch, const char *from, const char *to){
+	int had_from = names_contains(&watch->names, from);
+	int wants_to = watch_matches(watch, to);
+	if(had_from && wants_to){
+		names_remove(&watch->names, from);
+		names_add(&watch->names, to);
+		out_printf(&watch->out, "renamed\t%s/%s\t%s/%s\n", watch->path, from, watch->path, to);
+	}else if(had_from){
+		on_deleted(watch, from);
+	}else{
+		on_created(watch, to);
+	}
+}
+
+static void flush_moved_from(Watch *watch){
+	if(watch->moved_from){
+		on_deleted(watch, watch->moved_from);
+		free(watch->moved_from);
+		watch->moved_from = NULL;
+	}
+}
+
+/*
+ * Reads the directory and reports whatever differs from the known names.
+ * Used for the initial listing and after the kernel dropped events.
+ */
+static int rescan(Watch *watch, const char *kind){
+	DirReader reader;
+	if(dir_reader_open(&reader, AT_FDCWD, watch->path) == -1){
+		return -1;
+	}
+	NameSet seen;
+	if(names_init(&seen) == -1){
+		dir_reader_close(&reader);
+		return -1;
+	}
+	DirEntry *entry;
+	while((entry = dir_reader_next(&reader)) != NULL){
+		if(is_dot_entry(entry->d_name) || !watch_matches(watch, entry->d_name)){
+			continue;
+		}
+		names_add(&seen, entry->d_name);
+		if(names_add(&watch->names, entry->d_name) == 1){
+			emit(watch, kind, entry->d_name);
+		}
+	}
+	int result = reader.error ? -1 : 0;
+	dir_reader_close(&reader);
+	if(result == 0){
+		for(size_t i = 0; i < watch->names.capacity; ++i){
+			char *name = watch->names.slots[i];
+			if(name != NULL && name != TOMBSTONE && !names_contains(&seen, name)){
+				emit(watch, "deleted", name);
+				free(name);
+				watch->names.slots[i] = TOMBSTONE;
+				watch->names.count--;
+			}
+		}
+	}
+	names_free(&seen);
+	return result;
+}
+
+/* Returns 0 to keep watching, 1 once the directory itself went away. */
+static int handle_events(Watch *watch, const char *buffer, ssize_t length){
+	for(const char *cursor = buffer; cursor < buffer + length;){
+		const struct inotify_event *event = (const struct inotify_event *)cursor;
+		cursor += sizeof(struct inotify_event) + event->len;
+
+		if(watch->moved_from && !((event->mask & IN_MOVED_TO) && event->cookie == watch->moved_cookie)){
+			flush_moved_from(watch);
+		}
+		if(event->mask & IN_Q_OVERFLOW){
+			out_printf(&watch->out, "overflow\t%s\n", watch->path);
+			if(rescan(watch, "created") == -1){
+				return 1;
+			}
+			continue;
+		}
+		if(event->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)){
+			return 1;
+		}
+		if(event->len == 0){
+			continue;
+		}
+		const char *name = event->name;
+		if(event->mask & IN_MOVED_FROM){
+			watch->moved_from = strdup(name);
+			watch->moved_cookie = event->cookie;
+		}else if(event->mask & IN_MOVED_TO){
+			if(watch->moved_from){
+				on_renamed(watch, watch->moved_from, name);
+				free(watch->moved_from);
+				watch->moved_from = NULL;
+			}else{
+				on_created(watch, name);
+			}
+		}else if(event->mask & IN_CREATE){
+			on_created(watch, name);
+		}else if(event->mask & IN_DELETE){
+			on_deleted(watch, name);
+		}else if((event->mask & IN_CLOSE_WRITE) && names_contains(&watch->names, name)){
+			emit(watch, "written", name);
+		}
+	}
+	return 0;
+}
+
+static void watch_loop(Watch *watch, int inotify_fd, int signal_fd){
+	char *buffer = malloc(WATCH_BUFFER_SIZE);
+	if(buffer == NULL){
+		print_message("Memory allocation failed!\n");
+		return;
+	}
+	struct pollfd fds[2] = {{inotify_fd, POLLIN, 0}, {signal_fd, POLLIN, 0}};
+	for(;;){
+		/* A pending move waits briefly for its other half, otherwise it was a move out of the directory. */
+		int ready = poll(fds, 2, watch->moved_from ? WATCH_RENAME_WAIT_MS : -1);
+		if(ready == -1){
+			if(errno == EINTR){
+				continue;
+			}
+			break;
+		}
+		if(ready == 0){
+			flush_moved_from(watch);
+			out_flush(&watch->out);
+			continue;
+		}
+		if(fds[1].revents){
+			break;
+		}
+		ssize_t length = read(inotify_fd, buffer, WATCH_BUFFER_SIZE);
+		if(length == -1){
+			if(errno == EINTR || errno == EAGAIN){
+				continue;
+			}
+			break;
+		}
+		int gone = handle_events(watch, buffer, length);
+		out_flush(&watch->out);
+		if(gone){
+			flush_moved_from(watch);
+			print_message("Error : Directory %s is no longer available\n", watch->path);
+			break;
+		}
+	}
+	flush_moved_from(watch);
+	out_flush(&watch->out);
+	free(buffer);
+}
+
+void watch_dir(char *args[], size_t argc){
+	if(argc == 0){
+		no_directory_message();
+		return;
+	}
+	if(argc > 2){
+		print_message("Error : Invalid number of arguments\n");
+		return;
+	}
+	Watch watch;
+	memset(&watch, 0, sizeof(watch));
+	watch.path = args[0];
+	if(!directory_exists(args[0])){
+		print_message("Error : Directory %s not found\n", args[0]);
+		return;
+	}
+	if(argc == 2){
+		if(ext_set_init(&watch.set, args[1]) == -1){
+			print_message("Error : Invalid extension list %s\n", args[1]);
+			return;
+		}
+		watch.has_filter = 1;
+	}
+	if(names_init(&watch.names) == -1){
+		print_message("Memory allocation failed!\n");
+		ext_set_free(&watch.set);
+		return;
+	}
+	out_init(&watch.out, output_fd());
+
+	sigset_t signals;
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGINT);
+	sigaddset(&signals, SIGTERM);
+	sigset_t old_signals;
+	pthread_sigmask(SIG_BLOCK, &signals, &old_signals);
+	int signal_fd = signalfd(-1, &signals, SFD_CLOEXEC);
+	/* The watch goes in before the scan so nothing created in between is missed, the name set drops duplicates. */
+	int inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if(signal_fd == -1 || inotify_fd == -1 || inotify_add_watch(inotify_fd, watch.path, WATCH_EVENTS) == -1){
+		print_message("Error : Could not watch the directory %s (%s)\n", watch.path, strerror(errno));
+	}else if(rescan(&watch, "existing") == -1){
+		print_message("Could not read the directory %s\n", watch.path);
+	}else{
+		out_flush(&watch.out);
+		log_operation(LOG_OP_WATCH_DIR, 0, watch.path, argc == 2 ? args[1] : NULL);
+		watch_loop(&watch, inotify_fd, signal_fd);
+	}
+	if(inotify_fd != -1){
+		close(inotify_fd);
+	}
+	if(signal_fd != -1){
+		close(signal_fd);
+	}
+	pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+	out_free(&watch.out);
+	names_free(&watch.names);
+	if(watch.has_filter){
+		ext_set_free(&watch.set);
+	}
+}
@@ -0,0 +1,12 @@
+#include <stddef.h>
+#ifndef WATCHDIR_H
+#define WATCHDIR_H
+
+#define WATCH_BUFFER_SIZE (256 * 1024)
+#define WATCH_NAMES_INITIAL_CAPACITY 1024
+/* How long a moved-out name waits for its moved-in half before it is reported as deleted. */
+#define WATCH_RENAME_WAIT_MS 10
+
+void watch_dir(char *args[], size_t argc);
+
+#endif
@@ -0,0 +1,630 @@
+#define _GNU_SOURCE
+#include "channel.h"
+#include "ring.h"
+#include "histogram.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#define BENCH_DEFAULT_TRANSPORTS "fifo,pipe,socketpair,dgram,ring"
+#define BENCH_DEFAULT_SIZES "64,1024,16384"
+#define BENCH_DEFAULT_BATCHES "1,16,256"
+#define BENCH_DEFAULT_BYTES (32ULL * 1024 * 1024)
+#define BENCH_MIN_MESSAGES 4096
+#define BENCH_MAX_VALUES 16
+#define BENCH_MAX_BATCH 4096
+#define BENCH_SOCKET_BUFFER (4 * 1024 * 1024)
+#define BENCH_DEFAULT_LATENCY_MESSAGES 10000
+
+/*
+ * Runs the daemon topology, writer -> compute -> consumer in three
+ * processes, over one transport at a time. Every message is a header and
+ * pairs of integers. The compute stage replaces each pair with its larger
+ * value, the consumer checks sequence and checksum and records the latency
+ * since the writer filled the message. A batch of messages moves in one
+ * write, sendmmsg or ring reservation.
+ *
+ * The sweep keeps the links full, so its latency is mostly time spent
+ * queued behind earlier messages. The latency runs send one message at a
+ * time and the writer waits for the consumer to acknowledge it over a pipe
+ * before filling the next, which leaves only the cost of the hops.
+ */
+typedef enum{
+    LINK_FIFO,
+    LINK_PIPE,
+    LINK_SOCKETPAIR,
+    LINK_DGRAM,
+    LINK_RING,
+    LINK_KINDS
+} LinkKind;
+
+static const char *link_names[LINK_KINDS] = {"fifo", "pipe", "socketpair", "dgram", "ring"};
+
+typedef struct{
+    uint64_t sequence;
+    uint64_t sent_ns;
+} MessageHeader;
+
+typedef struct{
+    LinkKind kind;
+    int read_fd;
+    int write_fd;
+    Ring ring;
+    char path[64];
+} Link;
+
+typedef struct{
+    size_t message_size;
+    size_t batch;
+    uint64_t messages;
+    int paced;              // one batch in flight, acknowledged by the consumer
+} BenchCase;
+
+// Shared with the children, filled in by the writer and the consumer
+typedef struct{
+    Histogram latency;
+    uint64_t expected_checksum;
+    uint64_t checksum;
+    uint64_t elapsed_ns;
+    int failed;
+} BenchResult;
+
+static uint64_t now_ns(){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+static uint64_t next_random(uint64_t *state){
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545F4914F6CDD1DULL;
+}
+
+static size_t pairs_per_message(size_t message_size){
+    return (message_size - sizeof(MessageHeader)) / (2 * sizeof(int32_t));
+}
+
+static void set_socket_buffers(int fd){
+    int size = BENCH_SOCKET_BUFFER;
+    setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+}
+
+static int link_create(Link *link, LinkKind kind, size_t batch_size, int index){
+    memset(link, 0, sizeof(Link));
+    link->kind = kind;
+    link->read_fd = -1;
+    link->write_fd = -1;
+    int fds[2];
+    switch(kind){
+        case LINK_FIFO:
+            snprintf(link->path, sizeof(link->path), "/tmp/pipelineBench.%d.%d", getpid(), index);
+            if(mkfifo(link->path, 0600) == -1){
+                return -1;
+            }
+            // Opening the read end without blocking lets one process hold both
+            link->read_fd = open(link->path, O_RDONLY | O_NONBLOCK);
+            if(link->read_fd < 0){
+                return -1;
+            }
+            link->write_fd = open(link->path, O_WRONLY);
+            if(link->write_fd < 0){
+                return -1;
+            }
+            fcntl(link->read_fd, F_SETFL, 0);
+            set_pipe_size(link->write_fd);
+            return 0;
+        case LINK_PIPE:
+            if(pipe(fds) == -1){
+                return -1;
+            }
+            set_pipe_size(fds[1]);
+            break;
+        case LINK_SOCKETPAIR:
+        case LINK_DGRAM:
+            if(socketpair(AF_UNIX, kind == LINK_DGRAM ? SOCK_DGRAM : SOCK_STREAM, 0, fds) == -1){
+                return -1;
+            }
+            set_socket_buffers(fds[0]);
+            set_socket_buffers(fds[1]);
+            break;
+        case LINK_RING:{
+            size_t capacity = RING_DEFAULT_CAPACITY;
+            while(capacity < 4 * (batch_size + sizeof(uint64_t))){
+                capacity *= 2;
+            }
+            return ring_create(&link->ring, "bench-ring", capacity);
+        }
+        default:
+            errno = EINVAL;
+            return -1;
+    }
+    link->read_fd = fds[0];
+    link->write_fd = fds[1];
+    return 0;
+}
+
+static void link_destroy(Link *link){
+    if(link->kind == LINK_RING){
+        ring_destroy(&link->ring);
+        return;
+    }
+    if(link->read_fd >= 0){
+        close(link->read_fd);
+    }
+    if(link->write_fd >= 0){
+        close(link->write_fd);
+    }
+    if(link->path[0] != '\0'){
+        unlink(link->path);
+    }
+}
+
+// Room for one batch: in the ring itself, or the staging buffer otherwise
+static char *link_reserve(Link *link, char *staging, size_t batch_size){
+    if(link->kind == LINK_RING){
+        return ring_reserve(&link->ring, batch_size);
+    }
+    return staging;
+}
+
+static int link_send(Link *link, char *batch, const BenchCase *bench){
+    size_t batch_size = bench->batch * bench->message_size;
+    if(link->kind == LINK_RING){
+        ring_commit(&link->ring);
+        return 0;
+    }
+    if(link->kind != LINK_DGRAM){
+        return write_full(link->write_fd, batch, batch_size);
+    }
+    struct mmsghdr messages[bench->batch];
+    struct iovec iov[bench->batch];
+    memset(messages, 0, sizeof(messages));
+    for(size_t i = 0; i < bench->batch; i++){
+        iov[i].iov_base = batch + i * bench->message_size;
+        iov[i].iov_len = bench->message_size;
+        messages[i].msg_hdr.msg_iov = &iov[i];
+        messages[i].msg_hdr.msg_iovlen = 1;
+    }
+    for(size_t sent = 0; sent < bench->batch;){
+        int count = sendmmsg(link->write_fd, messages + sent, (unsigned int)(bench->batch - sent), 0);
+        if(count < 0){
+            if(errno == EINTR){
+                continue;
+            }
+            return -1;
+        }
+        sent += (size_t)count;
+    }
+    return 0;
+}
+
+// Returns the next batch, a ring hands it out in place until the next call
+static const char *link_receive(Link *link, char *staging, const BenchCase *bench){
+    size_t batch_size = bench->batch * bench->message_size;
+    if(link->kind == LINK_RING){
+        size_t size;
+        const char *batch = ring_next(&link->ring, &size);
+        if(batch != NULL && size != batch_size){
+            errno = EPROTO;
+            return NULL;
+        }
+        return batch;
+    }
+    if(link->kind != LINK_DGRAM){
+        return read_full(link->read_fd, staging, batch_size) == -1 ? NULL : staging;
+    }
+    struct mmsghdr messages[bench->batch];
+    struct iovec iov[bench->batch];
+    memset(messages, 0, sizeof(messages));
+    for(size_t i = 0; i < bench->batch; i++){
+        iov[i].iov_base = staging + i * bench->message_size;
+        iov[i].iov_len = bench->message_size;
+        messages[i].msg_hdr.msg_iov = &iov[i];
+        messages[i].msg_hdr.msg_iovlen = 1;
+    }
+    for(size_t received = 0; received < bench->batch;){
+        int count = recvmmsg(link->read_fd, messages + received, (unsigned int)(bench->batch - received), MSG_WAITFORONE, NULL);
+        if(count < 0){
+            if(errno == EINTR){
+                continue;
+            }
+            return NULL;
+        }
+        for(int i = 0; i < count; i++){
+            if(messages[received + i].msg_len != bench->message_size){
+                errno = EPROTO;
+                return NULL;
+            }
+        }
+        received += (size_t)count;
+    }
+    return staging;
+}
+
+// Each process keeps only the ends it uses
+static void keep_ends(Link *links, int read_link, int write_link){
+    for(int i = 0; i < 2; i++){
+        if(links[i].kind == LINK_RING){
+            continue;
+        }
+        if(i != read_link){
+            close(links[i].read_fd);
+        }
+        if(i != write_link){
+            close(links[i].write_fd);
+        }
+    }
+}
+
+static void writer_process(Link *links, const BenchCase *bench, BenchResult *result, int ack_fd){
+    keep_ends(links, -1, 0);
+    size_t batch_size = bench->batch * bench->message_size;
+    size_t pairs = pairs_per_message(bench->message_size);
+    char *staging = malloc(batch_size);
+    if(staging == NULL){
+        exit(EXIT_FAILURE);
+    }
+    uint64_t state = 0x9e3779b97f4a7c15ULL;
+    uint64_t checksum = 0;
+    for(uint64_t sequence = 0; sequence < bench->messages;){
+        char *batch = link_reserve(&links[0], staging, batch_size);
+        if(batch == NULL){
+            exit(EXIT_FAILURE);
+        }
+        for(size_t i = 0; i < bench->batch; i++, sequence++){
+            char *message = batch + i * bench->message_size;
+            int32_t *values = (int32_t *)(message + sizeof(MessageHeader));
+            for(size_t j = 0; j < pairs; j++){
+                uint64_t random = next_random(&state);
+                values[2 * j] = (int32_t)random;
+                values[2 * j + 1] = (int32_t)(random >> 32);
+                checksum += (uint64_t)(int64_t)(values[2 * j] > values[2 * j + 1] ? values[2 * j] : values[2 * j + 1]);
+            }
+            MessageHeader header = {sequence, now_ns()};
+            memcpy(message, &header, sizeof(header));
+        }
+        if(link_send(&links[0], batch, bench) == -1){
+            exit(EXIT_FAILURE);
+        }
+        char ack;
+        if(bench->paced && read_full(ack_fd, &ack, 1) == -1){
+            exit(EXIT_FAILURE);
+        }
+    }
+    result->expected_checksum = checksum;
+    exit(EXIT_SUCCESS);
+}
+
+static void compute_process(Link *links, const BenchCase *bench){
+    keep_ends(links, 0, 1);
+    size_t batch_size = bench->batch * bench->message_size;
+    size_t pairs = pairs_per_message(bench->message_size);
+    char *in_staging = malloc(batch_size);
+    char *out_staging = malloc(batch_size);
+    if(in_staging == NULL || out_staging == NULL){
+        exit(EXIT_FAILURE);
+    }
+    for(uint64_t done = 0; done < bench->messages; done += bench->batch){
+        const char *in = link_receive(&links[0], in_staging, bench);
+        char *out = in ? link_reserve(&links[1], out_staging, batch_size) : NULL;
+        if(out == NULL){
+            exit(EXIT_FAILURE);
+        }
+        for(size_t i = 0; i < bench->batch; i++){
+            const char *message = in + i * bench->message_size;
+            const int32_t *values = (const int32_t *)(message + sizeof(MessageHeader));
+            char *result = out + i * bench->message_size;
+            int32_t *larger = (int32_t *)(result + sizeof(MessageHeader));
+            memcpy(result, message, sizeof(MessageHeader));
+            for(size_t j = 0; j < pairs; j++){
+                larger[j] = values[2 * j] > values[2 * j + 1] ? values[2 * j] : values[2 * j + 1];
+            }
+        }
+        if(link_send(&links[1], out, bench) == -1){
+            exit(EXIT_FAILURE);
+        }
+    }
+    exit(EXIT_SUCCESS);
+}
+
+static void consumer_process(Link *links, const BenchCase *bench, BenchResult *result, uint64_t start_ns, int ack_fd){
+    keep_ends(links, 1, -1);
+    size_t pairs = pairs_per_message(bench->message_size);
+    char *staging = malloc(bench->batch * bench->message_size);
+    if(staging == NULL){
+        exit(EXIT_FAILURE);
+    }
+    uint64_t checksum = 0;
+    for(uint64_t sequence = 0; sequence < bench->messages;){
+        const char *batch = link_receive(&links[1], staging, bench);
+        if(batch == NULL){
+            exit(EXIT_FAILURE);
+        }
+        uint64_t now = now_ns();
+        for(size_t i = 0; i < bench->batch; i++, sequence++){
+            const char *message = batch + i * bench->message_size;
+            MessageHeader header;
+            memcpy(&header, message, sizeof(header));
+            if(header.sequence != sequence){
+                exit(EXIT_FAILURE);
+            }
+            histogram_record(&result->latency, now > header.sent_ns ? now - header.sent_ns : 0);
+            const int32_t *larger = (const int32_t *)(message + sizeof(MessageHeader));
+            for(size_t j = 0; j < pairs; j++){
+                checksum += (uint64_t)(int64_t)larger[j];
+            }
+        }
+        if(bench->paced && write_full(ack_fd, "", 1) == -1){
+            exit(EXIT_FAILURE);
+        }
+    }
+    result->elapsed_ns = now_ns() - start_ns;
+    result->checksum = checksum;
+    exit(EXIT_SUCCESS);
+}
+
+static int run_case(LinkKind kind, const BenchCase *bench, BenchResult *result){
+    memset(result, 0, sizeof(BenchResult));
+    Link links[2];
+    size_t batch_size = bench->batch * bench->message_size;
+    int created = 0;
+    for(; created < 2; created++){
+        if(link_create(&links[created], kind, batch_size, created) == -1){
+            break;
+        }
+    }
+    if(created < 2){
+        perror(link_names[kind]);
+        for(int i = 0; i <= created && i < 2; i++){
+            link_destroy(&links[i]);
+        }
+        return -1;
+    }
+
+    int ack[2] = {-1, -1};
+    if(bench->paced && pipe(ack) == -1){
+        perror("pipe");
+        link_destroy(&links[0]);
+        link_destroy(&links[1]);
+        return -1;
+    }
+
+    uint64_t start_ns = now_ns();
+    pid_t pids[3];
+    for(int i = 0; i < 3; i++){
+        pids[i] = fork();
+        if(pids[i] < 0){
+            perror("fork");
+            result->failed = 1;
+            break;
+        }
+        if(pids[i] == 0){
+            if(i == 0){
+                writer_process(links, bench, result, ack[0]);
+            }else if(i == 1){
+                compute_process(links, bench);
+            }
+            consumer_process(links, bench, result, start_ns, ack[1]);
+        }
+    }
+    if(bench->paced){
+        close(ack[0]);
+        close(ack[1]);
+    }
+    // A stage that fails would leave the others blocked on it forever
+    for(int i = 0; i < 3 && pids[i] > 0; i++){
+        int status;
+        pid_t pid = wait(&status);
+        if(pid < 0){
+            break;
+        }
+        if(!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS){
+            result->failed = 1;
+            for(int j = 0; j < 3; j++){
+                if(pids[j] > 0 && pids[j] != pid){
+                    kill(pids[j], SIGKILL);
+                }
+            }
+        }
+    }
+    link_destroy(&links[0]);
+    link_destroy(&links[1]);
+    if(result->checksum != result->expected_checksum){
+        result->failed = 1;
+    }
+    return result->failed ? -1 : 0;
+}
+
+static void print_row(LinkKind kind, const BenchCase *bench, const BenchResult *result){
+    if(result->failed){
+        printf("%-11s %9zu %6zu %9llu %10s\n", link_names[kind], bench->message_size, bench->batch,
+            (unsigned long long)bench->messages, "failed");
+        fflush(stdout);
+        return;
+    }
+    double seconds = (double)result->elapsed_ns / 1e9;
+    const Histogram *latency = &result->latency;
+    printf("%-11s %9zu %6zu %9llu %10.1f %12.0f %10.1f %10.1f %10.1f\n", link_names[kind], bench->message_size, bench->batch,
+        (unsigned long long)bench->messages,
+        (double)bench->messages * (double)bench->message_size / seconds / (1024.0 * 1024.0),
+        (double)bench->messages / seconds,
+        histogram_percentile(latency, 50) / 1e3, histogram_percentile(latency, 99) / 1e3,
+        histogram_percentile(latency, 99.9) / 1e3);
+    fflush(stdout);
+}
+
+static void print_latency_row(LinkKind kind, const BenchCase *bench, const BenchResult *result){
+    if(result->failed){
+        printf("%-11s %9zu %9llu %10s\n", link_names[kind], bench->message_size,
+            (unsigned long long)bench->messages, "failed");
+        fflush(stdout);
+        return;
+    }
+    const Histogram *latency = &result->latency;
+    printf("%-11s %9zu %9llu %10.1f %10.1f %10.1f %10.1f\n", link_names[kind], bench->message_size,
+        (unsigned long long)bench->messages,
+        histogram_percentile(latency, 50) / 1e3, histogram_percentile(latency, 99) / 1e3,
+        histogram_percentile(latency, 99.9) / 1e3, (double)latency->max / 1e3);
+    fflush(stdout);
+}
+
+static int parse_list(const char *text, size_t *values, int max_values){
+    int count = 0;
+    char *copy = strdup(text);
+    if(copy == NULL){
+        return -1;
+    }
+    char *saveptr;
+    for(char *token = strtok_r(copy, ",", &saveptr); token != NULL; token = strtok_r(NULL, ",", &saveptr)){
+        char *endptr;
+        long long value = strtoll(token, &endptr, 10);
+        if(*endptr != '\0' || value <= 0 || count == max_values){
+            free(copy);
+            return -1;
+        }
+        values[count++] = (size_t)value;
+    }
+    free(copy);
+    return count;
+}
+
+static int parse_transports(const char *text, int *kinds){
+    int count = 0;
+    char *copy = strdup(text);
+    if(copy == NULL){
+        return -1;
+    }
+    char *saveptr;
+    for(char *token = strtok_r(copy, ",", &saveptr); token != NULL; token = strtok_r(NULL, ",", &saveptr)){
+        int kind = 0;
+        while(kind < LINK_KINDS && strcmp(token, link_names[kind]) != 0){
+            kind++;
+        }
+        if(kind == LINK_KINDS || count == LINK_KINDS){
+            free(copy);
+            return -1;
+        }
+        kinds[count++] = kind;
+    }
+    free(copy);
+    return count;
+}
+
+int main(int argc, char *argv[]){
+    const char *transports = BENCH_DEFAULT_TRANSPORTS;
+    const char *sizes_text = BENCH_DEFAULT_SIZES;
+    const char *batches_text = BENCH_DEFAULT_BATCHES;
+    unsigned long long bytes = BENCH_DEFAULT_BYTES;
+    unsigned long long latency_messages = BENCH_DEFAULT_LATENCY_MESSAGES;
+    int run_sweep = 1;
+    int run_latency = 1;
+    int valid = argc % 2 == 1;
+    for(int i = 1; valid && i + 1 < argc; i += 2){
+        if(strcmp(argv[i], "--transports") == 0){
+            transports = argv[i + 1];
+        }else if(strcmp(argv[i], "--sizes") == 0){
+            sizes_text = argv[i + 1];
+        }else if(strcmp(argv[i], "--batches") == 0){
+            batches_text = argv[i + 1];
+        }else if(strcmp(argv[i], "--bytes") == 0){
+            bytes = strtoull(argv[i + 1], NULL, 10);
+        }else if(strcmp(argv[i], "--latency-messages") == 0){
+            latency_messages = strtoull(argv[i + 1], NULL, 10);
+        }else if(strcmp(argv[i], "--mode") == 0){
+            run_sweep = strcmp(argv[i + 1], "latency") != 0;
+            run_latency = strcmp(argv[i + 1], "sweep") != 0;
+            valid = strcmp(argv[i + 1], "sweep") == 0 || strcmp(argv[i + 1], "latency") == 0 || strcmp(argv[i + 1], "both") == 0;
+        }else{
+            valid = 0;
+        }
+    }
+
+    int kinds[LINK_KINDS];
+    size_t sizes[BENCH_MAX_VALUES];
+    size_t batches[BENCH_MAX_VALUES];
+    int num_kinds = valid ? parse_transports(transports, kinds) : -1;
+    int num_sizes = valid ? parse_list(sizes_text, sizes, BENCH_MAX_VALUES) : -1;
+    int num_batches = valid ? parse_list(batches_text, batches, BENCH_MAX_VALUES) : -1;
+    for(int i = 0; i < num_sizes; i++){
+        if(sizes[i] < sizeof(MessageHeader) + 2 * sizeof(int32_t)){
+            num_sizes = -1;
+        }
+    }
+    for(int i = 0; i < num_batches; i++){
+        if(batches[i] > BENCH_MAX_BATCH){
+            num_batches = -1;
+        }
+    }
+    if(num_kinds <= 0 || num_sizes <= 0 || num_batches <= 0 || bytes == 0 || latency_messages == 0){
+        printf("Usage %s [--transports %s] [--sizes <bytes,...>]\n"
+            "         [--batches <messages,...>] [--bytes <per run>]\n"
+            "         [--mode sweep|latency|both] [--latency-messages <per run>]\n", argv[0], BENCH_DEFAULT_TRANSPORTS);
+        return 1;
+    }
+
+    BenchResult *result = mmap(NULL, sizeof(BenchResult), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if(result == MAP_FAILED){
+        perror("mmap");
+        return 1;
+    }
+    int failures = 0;
+    if(run_sweep){
+        printf("Throughput sweep, links kept full\n");
+        printf("%-11s %9s %6s %9s %10s %12s %10s %10s %10s\n", "transport", "msg_bytes", "batch", "messages",
+            "MiB/s", "msgs/s", "p50_us", "p99_us", "p999_us");
+        // Forked stages must not inherit unwritten output
+        fflush(stdout);
+    }
+    for(int k = 0; run_sweep && k < num_kinds; k++){
+        for(int s = 0; s < num_sizes; s++){
+            for(int b = 0; b < num_batches; b++){
+                BenchCase bench;
+                bench.message_size = sizes[s];
+                bench.batch = batches[b];
+                bench.messages = bytes / sizes[s];
+                if(bench.messages < BENCH_MIN_MESSAGES){
+                    bench.messages = BENCH_MIN_MESSAGES;
+                }
+                bench.messages = (bench.messages + bench.batch - 1) / bench.batch * bench.batch;
+                bench.paced = 0;
+                if(run_case(kinds[k], &bench, result) == -1){
+                    failures++;
+                }
+                print_row(kinds[k], &bench, result);
+            }
+        }
+    }
+    if(run_latency){
+        printf("%sLatency, one message in flight\n", run_sweep ? "\n" : "");
+        printf("%-11s %9s %9s %10s %10s %10s %10s\n", "transport", "msg_bytes", "messages",
+            "p50_us", "p99_us", "p999_us", "max_us");
+        fflush(stdout);
+    }
+    for(int k = 0; run_latency && k < num_kinds; k++){
+        for(int s = 0; s < num_sizes; s++){
+            BenchCase bench;
+            bench.message_size = sizes[s];
+            bench.batch = 1;
+            bench.messages = latency_messages;
+            bench.paced = 1;
+            if(run_case(kinds[k], &bench, result) == -1){
+                failures++;
+            }
+            print_latency_row(kinds[k], &bench, result);
+        }
+    }
+    munmap(result, sizeof(BenchResult));
+    return failures > 0 ? 1 : 0;
+}
@@ -0,0 +1,230 @@
+#define _GNU_SOURCE
+#include "channel.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+int read_full(int fd, void *buffer, size_t size){
+    char *cursor = buffer;
+    while(size > 0){
+        ssize_t bytes_read = read(fd, cursor, size);
+        if(bytes_read < 0){
+            if(errno == EINTR){
+                continue;
+            }
+            return -1;
+        }
+        if(bytes_read == 0){
+            errno = EPIPE;
+            return -1;
+        }
+        cursor += bytes_read;
+        size -= (size_t)bytes_read;
+    }
+    return 0;
+}
+
+int write_full(int fd, const void *buffer, size_t size){
+    const char *cursor = buffer;
+    while(size > 0){
+        ssize_t bytes_written = write(fd, cursor, size);
+        if(bytes_written < 0){
+            if(errno == EINTR){
+                continue;
+            }
+            return -1;
+        }
+        cursor += bytes_written;
+        size -= (size_t)bytes_written;
+    }
+    return 0;
+}
+
+// A bigger pipe lets whole batches move in one syscall, failing is harmless
+void set_pipe_size(int fd){
+    if(fcntl(fd, F_GETPIPE_SZ) < PIPE_BUFFER_SIZE){
+        fcntl(fd, F_SETPIPE_SZ, PIPE_BUFFER_SIZE);
+    }
+}
+
+const char *transport_name(Transport transport){
+    return transport == TRANSPORT_RING ? "ring" : "fifo";
+}
+
+int channel_open_fifo(Channel *channel, int fd, size_t capacity){
+    memset(channel, 0, sizeof(Channel));
+    channel->transport = TRANSPORT_FIFO;
+    channel->fd = fd;
+    channel->capacity = capacity;
+    channel->buffer = malloc(capacity);
+    return channel->buffer ? 0 : -1;
+}
+
+void channel_open_ring(Channel *channel, Ring *ring){
+    memset(channel, 0, sizeof(Channel));
+    channel->transport = TRANSPORT_RING;
+    channel->fd = -1;
+    channel->ring = ring;
+}
+
+void channel_close(Channel *channel){
+    free(channel->buffer);
+    channel->buffer = NULL;
+    if(channel->fd >= 0){
+        close(channel->fd);
+        channel->fd = -1;
+    }
+}
+
+// Returns room for one batch of size bytes, valid until channel_commit
+void *channel_reserve(Channel *channel, size_t size){
+    if(channel->transport == TRANSPORT_RING){
+        return ring_reserve(channel->ring, size);
+    }
+    if(size > channel->capacity){
+        errno = EMSGSIZE;
+        return NULL;
+    }
+    if(channel->end + size > channel->capacity && channel_flush(channel) == -1){
+        return NULL;
+    }
+    return channel->buffer + channel->end;
+}
+
+void channel_commit(Channel *channel, size_t size){
+    if(channel->transport == TRANSPORT_RING){
+        ring_commit(channel->ring);
+    }else{
+        channel->end += size;
+    }
+}
+
+// Ring batches are visible as soon as they are committed, FIFO batches are
+// staged until the producer has nothing more to add right away.
+int channel_flush(Channel *channel){
+    if(channel->transport == TRANSPORT_RING || channel->end == 0){
+        return 0;
+    }
+    int result = write_full(channel->fd, channel->buffer, channel->end);
+    channel->end = 0;
+    return result;
+}
+
+static size_t buffered_batch_size(const Channel *channel, size_t record_size){
+    size_t available = channel->end - channel->start;
+    if(available < sizeof(BatchHeader)){
+        return 0;
+    }
+    BatchHeader header;
+    memcpy(&header, channel->buffer + channel->start, sizeof(header));
+    size_t needed = sizeof(BatchHeader) + (size_t)header.count * record_size;
+    return available >= needed ? needed : 0;
+}
+
+int channel_pending(const Channel *channel, size_t record_size){
+    if(channel->transport == TRANSPORT_RING){
+        return ring_pending(channel->ring);
+    }
+    return buffered_batch_size(channel, record_size) > 0;
+}
+
+static int parse_ring_batch(const char *message, size_t size, size_t record_size, BatchHeader *header, const void **records){
+    memcpy(header, message, sizeof(BatchHeader));
+    if(size < sizeof(BatchHeader) || size != sizeof(BatchHeader) + (size_t)header->count * record_size){
+        errno = EPROTO;
+        return -1;
+    }
+    *records = message + sizeof(BatchHeader);
+    return header->count > 0;
+}
+
+static int ring_next_batch(Channel *channel, size_t record_size, BatchHeader *header, const void **records){
+    size_t size;
+    const char *message = ring_next(channel->ring, &size);
+    if(message == NULL){
+        return 0;
+    }
+    return parse_ring_batch(message, size, record_size, header, records);
+}
+
+// Like channel_next, but fails with EAGAIN instead of waiting on an empty
+// ring. FIFOs always block.
+int channel_try_next(Channel *channel, size_t record_size, BatchHeader *header, const void **records){
+    if(channel->transport != TRANSPORT_RING){
+        return channel_next(channel, record_size, header, records);
+    }
+    size_t size;
+    const char *message = ring_try_next(channel->ring, &size);
+    if(message == NULL){
+        if(ring_drained(channel->ring)){
+            return 0;
+        }
+        errno = EAGAIN;
+        return -1;
+    }
+    return parse_ring_batch(message, size, record_size, header, records);
+}
+
+// Whether a batch of size bytes can be reserved without blocking
+int channel_has_space(const Channel *channel, size_t size){
+    if(channel->transport == TRANSPORT_RING){
+        return ring_has_space(channel->ring, size);
+    }
+    return channel->end + size <= channel->capacity;
+}
+
+// Returns 1 with the next batch, 0 at the end of the stream and -1 on error.
+// The previous batch is released, so records stay valid until the next call.
+// FIFOs are read as far as the pipe holds, so most batches cost no syscall.
+int channel_next(Channel *channel, size_t record_size, BatchHeader *header, const void **records){
+    if(channel->transport == TRANSPORT_RING){
+        return ring_next_batch(channel, record_size, header, records);
+    }
+    for(;;){
+        size_t available = channel->end - channel->start;
+        if(available == 0){
+            channel->start = 0;
+            channel->end = 0;
+        }
+        if(available >= sizeof(BatchHeader)){
+            memcpy(header, channel->buffer + channel->start, sizeof(BatchHeader));
+            size_t needed = sizeof(BatchHeader) + (size_t)header->count * record_size;
+            if(needed > channel->capacity){
+                errno = EMSGSIZE;
+                return -1;
+            }
+            if(available >= needed){
+                *records = channel->buffer + channel->start + sizeof(BatchHeader);
+                channel->start += needed;
+                return header->count > 0;
+            }
+            if(channel->start + needed > channel->capacity){
+                memmove(channel->buffer, channel->buffer + channel->start, available);
+                channel->start = 0;
+                channel->end = available;
+            }
+        }else if(channel->start > 0 && channel->end + sizeof(BatchHeader) > channel->capacity){
+            memmove(channel->buffer, channel->buffer + channel->start, available);
+            channel->start = 0;
+            channel->end = available;
+        }
+        ssize_t bytes_read = read(channel->fd, channel->buffer + channel->end, channel->capacity - channel->end);
+        if(bytes_read < 0){
+            if(errno == EINTR){
+                continue;
+            }
+            return -1;
+        }
+        if(bytes_read == 0){
+            if(available > 0){
+                errno = EPIPE;
+                return -1;
+            }
+            // The writer went away without an end marker
+            return 0;
+        }
+        channel->end += (size_t)bytes_read;
+    }
+}
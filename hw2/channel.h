@@ -0,0 +1,53 @@
+#include <stddef.h>
+#include <stdint.h>
+#include "ring.h"
+#ifndef CHANNEL_H
+#define CHANNEL_H
+
+#define PIPE_BUFFER_SIZE (1024 * 1024)
+
+typedef enum{
+    TRANSPORT_FIFO,
+    TRANSPORT_RING
+} Transport;
+
+// Every batch is a header followed by count records, a header with a count of 0 ends the stream
+typedef struct{
+    uint32_t count;
+    uint32_t sequence;
+    uint64_t sent_ns;
+} BatchHeader;
+
+/*
+ * One direction of a pipeline stage. Over a FIFO, batches are staged in
+ * buffer and moved with large reads and writes. Over a ring, producers build
+ * batches in place and consumers read them where they are.
+ */
+typedef struct{
+    Transport transport;
+    int fd;
+    char *buffer;
+    size_t capacity;
+    size_t start;
+    size_t end;
+    Ring *ring;
+} Channel;
+
+int read_full(int fd, void *buffer, size_t size);
+int write_full(int fd, const void *buffer, size_t size);
+void set_pipe_size(int fd);
+const char *transport_name(Transport transport);
+
+int channel_open_fifo(Channel *channel, int fd, size_t capacity);
+void channel_open_ring(Channel *channel, Ring *ring);
+void channel_close(Channel *channel);
+
+void *channel_reserve(Channel *channel, size_t size);
+void channel_commit(Channel *channel, size_t size);
+int channel_flush(Channel *channel);
+int channel_next(Channel *channel, size_t record_size, BatchHeader *header, const void **records);
+int channel_try_next(Channel *channel, size_t record_size, BatchHeader *header, const void **records);
+int channel_has_space(const Channel *channel, size_t size);
+int channel_pending(const Channel *channel, size_t record_size);
+
+#endif
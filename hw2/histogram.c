@@ -0,0 +1,48 @@
+#include "histogram.h"
+
+size_t histogram_bucket(uint64_t value){
+    if(value < HISTOGRAM_SUB_BUCKETS){
+        return (size_t)value;
+    }
+    int msb = 63 - __builtin_clzll(value);
+    size_t sub = (size_t)(value >> (msb - 4)) & (HISTOGRAM_SUB_BUCKETS - 1);
+    return (size_t)(msb - 3) * HISTOGRAM_SUB_BUCKETS + sub;
+}
+
+// Midpoint of the range of values that land in bucket
+uint64_t histogram_bucket_value(size_t bucket){
+    if(bucket < HISTOGRAM_SUB_BUCKETS){
+        return bucket;
+    }
+    int msb = (int)(bucket / HISTOGRAM_SUB_BUCKETS) + 3;
+    uint64_t sub = bucket % HISTOGRAM_SUB_BUCKETS;
+    uint64_t lower = (HISTOGRAM_SUB_BUCKETS + sub) << (msb - 4);
+    return lower + ((1ULL << (msb - 4)) >> 1);
+}
+
+void histogram_record(Histogram *histogram, uint64_t value){
+    histogram->counts[histogram_bucket(value)]++;
+    histogram->total++;
+    if(value > histogram->max){
+        histogram->max = value;
+    }
+}
+
+uint64_t histogram_percentile(const Histogram *histogram, double percentile){
+    if(histogram->total == 0){
+        return 0;
+    }
+    uint64_t rank = (uint64_t)(percentile / 100.0 * (double)histogram->total);
+    if(rank >= histogram->total){
+        rank = histogram->total - 1;
+    }
+    uint64_t seen = 0;
+    for(size_t i = 0; i < HISTOGRAM_BUCKETS; i++){
+        seen += histogram->counts[i];
+        if(seen > rank){
+            uint64_t value = histogram_bucket_value(i);
+            return value < histogram->max ? value : histogram->max;
+        }
+    }
+    return histogram->max;
+}
@@ -0,0 +1,22 @@
+#include <stddef.h>
+#include <stdint.h>
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+// Log-linear buckets: values below 16 are exact, larger values keep their
+// top 4 bits after the leading one, so every bucket is within ~6%.
+#define HISTOGRAM_SUB_BUCKETS 16
+#define HISTOGRAM_BUCKETS 1024
+
+typedef struct{
+    uint64_t counts[HISTOGRAM_BUCKETS];
+    uint64_t total;
+    uint64_t max;
+} Histogram;
+
+size_t histogram_bucket(uint64_t value);
+uint64_t histogram_bucket_value(size_t bucket);
+void histogram_record(Histogram *histogram, uint64_t value);
+uint64_t histogram_percentile(const Histogram *histogram, double percentile);
+
+#endif
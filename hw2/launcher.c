@@ -0,0 +1,235 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <sched.h>
+#include <sys/file.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <libgen.h>
+#include "runtime.h"
+
+#define MAX_INSTANCES 64
+#define MAX_DAEMON_ARGS 64
+
+// Starts one daemon per shard of the stream, each in its own runtime
+// directory and pinned to its own cores. The affinity is set before the
+// exec, so the supervisor and every process it forks inherit it.
+
+int instances = 0;
+int cpus_per_instance = 0;
+int wait_for_instances = 0;
+char daemon_path[PATH_MAX];
+char *daemon_args[MAX_DAEMON_ARGS];
+int daemon_argc = 0;
+int available_cpus[CPU_SETSIZE];
+int available_count = 0;
+
+int parse_arguments(int argc, char *argv[]);
+int find_daemon(const char *argv0);
+void instance_cpus(int instance, cpu_set_t *set, char *description, size_t size);
+int start_instance(int instance);
+int wait_instance(int instance);
+
+int main(int argc, char *argv[]){
+    if(parse_arguments(argc, argv) == -1){
+        printf("Usage %s --instances <n> [--cpus-per-instance <n>] [--wait] -- <daemon options>\n"
+            "      (the daemon options must not include --instance, --runtime-dir or --shard)\n", argv[0]);
+        return 1;
+    }
+    if(find_daemon(argv[0]) == -1){
+        return 1;
+    }
+
+    cpu_set_t allowed;
+    if(sched_getaffinity(0, sizeof(allowed), &allowed) == -1){
+        perror("sched_getaffinity failed");
+        return 1;
+    }
+    for(int cpu = 0; cpu < CPU_SETSIZE; cpu++){
+        if(CPU_ISSET(cpu, &allowed)){
+            available_cpus[available_count++] = cpu;
+        }
+    }
+    if(cpus_per_instance == 0){
+        cpus_per_instance = available_count / instances > 0 ? available_count / instances : 1;
+    }
+    if(cpus_per_instance > available_count){
+        cpus_per_instance = available_count;
+    }
+    if(instances * cpus_per_instance > available_count){
+        printf("Only %d CPUs for %d instances, some of them share cores\n", available_count, instances);
+    }
+
+    int failed = 0;
+    for(int i = 0; i < instances; i++){
+        if(start_instance(i) == -1){
+            failed++;
+        }
+    }
+    if(wait_for_instances){
+        for(int i = 0; i < instances; i++){
+            if(wait_instance(i) == -1){
+                failed++;
+            }
+        }
+    }
+    return failed ? 1 : 0;
+}
+
+int parse_arguments(int argc, char *argv[]){
+    int i = 1;
+    for(; i < argc && strcmp(argv[i], "--") != 0; i++){
+        if(strcmp(argv[i], "--wait") == 0){
+            wait_for_instances = 1;
+            continue;
+        }
+        if(i + 1 >= argc){
+            return -1;
+        }
+        char *endptr;
+        long value = strtol(argv[i + 1], &endptr, 10);
+        if(*endptr != '\0'){
+            return -1;
+        }
+        if(strcmp(argv[i], "--instances") == 0){
+            if(value < 1 || value > MAX_INSTANCES){
+                return -1;
+            }
+            instances = (int)value;
+        }else if(strcmp(argv[i], "--cpus-per-instance") == 0){
+            if(value < 1){
+                return -1;
+            }
+            cpus_per_instance = (int)value;
+        }else{
+            return -1;
+        }
+        i++;
+    }
+    if(instances == 0 || i >= argc){
+        return -1;
+    }
+    for(i++; i < argc; i++){
+        if(strcmp(argv[i], "--instance") == 0 || strcmp(argv[i], "--runtime-dir") == 0 || strcmp(argv[i], "--shard") == 0){
+            return -1;
+        }
+        // Room is left for the program name, the instance options and the NULL
+        if(daemon_argc >= MAX_DAEMON_ARGS - 6){
+            return -1;
+        }
+        daemon_args[daemon_argc++] = argv[i];
+    }
+    return daemon_argc > 0 ? 0 : -1;
+}
+
+// The daemon is expected next to the launcher
+int find_daemon(const char *argv0){
+    char self[PATH_MAX];
+    ssize_t length = readlink("/proc/self/exe", self, sizeof(self) - 1);
+    if(length < 0){
+        if(snprintf(self, sizeof(self), "%s", argv0) >= (int)sizeof(self)){
+            fprintf(stderr, "Launcher path too long\n");
+            return -1;
+        }
+    }else{
+        self[length] = '\0';
+    }
+    if(snprintf(daemon_path, sizeof(daemon_path), "%s/main", dirname(self)) >= (int)sizeof(daemon_path)){
+        fprintf(stderr, "Daemon path too long\n");
+        return -1;
+    }
+    if(access(daemon_path, X_OK) == -1){
+        fprintf(stderr, "Cannot run %s: %s\n", daemon_path, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+// Consecutive instances get consecutive blocks of the allowed CPUs, wrapping
+// around when there are more instances than blocks
+void instance_cpus(int instance, cpu_set_t *set, char *description, size_t size){
+    CPU_ZERO(set);
+    size_t used = 0;
+    description[0] = '\0';
+    for(int i = 0; i < cpus_per_instance; i++){
+        int cpu = available_cpus[(instance * cpus_per_instance + i) % available_count];
+        CPU_SET(cpu, set);
+        if(used < size){
+            used += (size_t)snprintf(description + used, size - used, "%s%d", i ? "," : "", cpu);
+        }
+    }
+}
+
+int start_instance(int instance){
+    char name[16];
+    char shard[32];
+    char cpus[128];
+    cpu_set_t set;
+    snprintf(name, sizeof(name), "%d", instance);
+    snprintf(shard, sizeof(shard), "%d/%d", instance, instances);
+    instance_cpus(instance, &set, cpus, sizeof(cpus));
+
+    char *args[MAX_DAEMON_ARGS];
+    int count = 0;
+    args[count++] = daemon_path;
+    for(int i = 0; i < daemon_argc; i++){
+        args[count++] = daemon_args[i];
+    }
+    args[count++] = "--instance";
+    args[count++] = name;
+    args[count++] = "--shard";
+    args[count++] = shard;
+    args[count] = NULL;
+
+    printf("Instance %d: shard %s on CPUs %s, runtime directory " INSTANCE_DIR_FORMAT "\n", instance, shard, cpus, name);
+    fflush(stdout);
+    pid_t pid = fork();
+    if(pid < 0){
+        perror("Fork failed");
+        return -1;
+    }
+    if(pid == 0){
+        if(sched_setaffinity(0, sizeof(set), &set) == -1){
+            perror("sched_setaffinity failed");
+            _exit(EXIT_FAILURE);
+        }
+        execv(daemon_path, args);
+        perror("execv failed");
+        _exit(EXIT_FAILURE);
+    }
+    // Returns as soon as the daemon has detached
+    int status;
+    if(waitpid(pid, &status, 0) == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS){
+        fprintf(stderr, "Instance %d failed to start\n", instance);
+        return -1;
+    }
+    return 0;
+}
+
+// A supervisor holds its lock until it exits, so a shared lock is granted
+// once the instance is done
+int wait_instance(int instance){
+    char path[RUNTIME_PATH_SIZE];
+    char name[16];
+    snprintf(name, sizeof(name), "%d", instance);
+    snprintf(path, sizeof(path), INSTANCE_DIR_FORMAT "/" LOCK_NAME, name);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if(fd < 0){
+        fprintf(stderr, "Cannot open %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    while(flock(fd, LOCK_SH) == -1){
+        if(errno != EINTR){
+            fprintf(stderr, "Cannot lock %s: %s\n", path, strerror(errno));
+            close(fd);
+            return -1;
+        }
+    }
+    close(fd);
+    printf("Instance %d finished, log in " INSTANCE_DIR_FORMAT "/" LOG_NAME "\n", instance, name);
+    return 0;
+}
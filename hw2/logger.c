@@ -0,0 +1,499 @@
+#define _GNU_SOURCE
+#include "logger.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <signal.h>
+#include <libgen.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+#define LOG_TEXT_SIZE (LOG_RECORD_SIZE - 2 * sizeof(uint64_t) - 8)
+#define LOG_PREFIX_SIZE 32
+#define LOG_PATH_SIZE 512
+#define IOPRIO_CLASS_IDLE 3
+#define IOPRIO_CLASS_SHIFT 13
+#define IOPRIO_WHO_PROCESS 1
+
+// A slot is free for position p when its sequence is p, and holds the
+// record of position p once the producer set it to p + 1.
+typedef struct{
+    _Atomic uint64_t sequence;
+    int64_t seconds;
+    uint16_t length;
+    uint8_t error;
+    char text[LOG_TEXT_SIZE];
+} LogRecord;
+
+_Static_assert(sizeof(LogRecord) == LOG_RECORD_SIZE, "log records must stay fixed-size");
+
+typedef struct{
+    _Alignas(64) _Atomic uint64_t enqueue;
+    _Alignas(64) _Atomic uint32_t wake_pending;
+    _Atomic uint64_t dropped;
+    _Alignas(64) LogRecord records[LOG_RING_SLOTS];
+} LogShared;
+
+static const char *log_path;
+static LogShared *shared;
+static int event_fd = -1;
+static pid_t owner;
+
+// Only touched by the owner while draining
+static uint64_t dequeue;
+static uint64_t dropped_reported;
+static uint64_t stalled_position = UINT64_MAX;
+static uint64_t stalled_since_ns;
+static time_t prefix_second = -1;
+static char prefix[LOG_PREFIX_SIZE];
+static size_t prefix_length;
+
+// Rotation, also owner only. A limit of 0 turns that trigger off.
+static uint64_t rotate_bytes = LOG_ROTATE_BYTES;
+static int rotate_seconds;
+static int rotate_keep = LOG_ROTATE_KEEP;
+static uint64_t file_bytes;
+static time_t file_opened;
+static pid_t compressors[LOG_MAX_COMPRESSORS];
+static int private_fd = -1;
+
+static uint64_t now_ns(){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+// localtime is only paid for once per second of log output
+static void update_prefix(time_t second){
+    if(second == prefix_second){
+        return;
+    }
+    struct tm tm_info;
+    localtime_r(&second, &tm_info);
+    prefix_length = strftime(prefix, sizeof(prefix), "[%Y-%m-%d %H:%M:%S] ", &tm_info);
+    prefix_second = second;
+}
+
+static void attach(int fd){
+    struct stat info;
+    file_bytes = fstat(fd, &info) == 0 ? (uint64_t)info.st_size : 0;
+    file_opened = time(NULL);
+    dup2(fd, STDOUT_FILENO);
+    dup2(fd, STDERR_FILENO);
+    if(fd > STDERR_FILENO){
+        close(fd);
+    }
+}
+
+static void logger_close_at_exit(){
+    logger_close();
+}
+
+int logger_open(const char *path){
+    log_path = path;
+    int fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if(fd < 0){
+        return -1;
+    }
+    attach(fd);
+
+    void *memory = mmap(NULL, sizeof(LogShared), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if(memory == MAP_FAILED){
+        return -1;
+    }
+    event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(event_fd < 0){
+        munmap(memory, sizeof(LogShared));
+        return -1;
+    }
+    shared = memory;
+    for(uint64_t i = 0; i < LOG_RING_SLOTS; i++){
+        atomic_init(&shared->records[i].sequence, i);
+    }
+    owner = getpid();
+    atexit(logger_close_at_exit);
+    return 0;
+}
+
+// The new file replaces the old one with dup2, and only the owner ever
+// writes, so no record can end up on a closed descriptor.
+int logger_reopen(){
+    int fd = open(log_path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if(fd < 0){
+        return -1;
+    }
+    logger_drain();
+    attach(fd);
+    return 0;
+}
+
+// A descriptor of the owner that compressors must not hold on to, such as
+// the lock on its runtime directory. They may outlive the owner.
+void logger_set_private_fd(int fd){
+    private_fd = fd;
+}
+
+void logger_set_rotation(uint64_t max_bytes, int interval_seconds, int keep){
+    rotate_bytes = max_bytes;
+    rotate_seconds = interval_seconds;
+    rotate_keep = keep > 0 ? keep : 1;
+}
+
+static int compare_names(const void *a, const void *b){
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+// Rotated files are named <log>.<timestamp>[.n][.gz]. Names sort by age, the
+// oldest ones beyond rotate_keep are removed together with their .gz.
+static void prune_rotated(const char *path){
+    char directory_buffer[LOG_PATH_SIZE];
+    char base_buffer[LOG_PATH_SIZE];
+    snprintf(directory_buffer, sizeof(directory_buffer), "%s", path);
+    snprintf(base_buffer, sizeof(base_buffer), "%s", path);
+    const char *directory = dirname(directory_buffer);
+    const char *base = basename(base_buffer);
+    size_t base_length = strlen(base);
+    DIR *dir = opendir(directory);
+    if(dir == NULL){
+        return;
+    }
+    char **names = NULL;
+    size_t count = 0;
+    size_t capacity = 0;
+    struct dirent *entry;
+    while((entry = readdir(dir)) != NULL){
+        if(strncmp(entry->d_name, base, base_length) != 0 || entry->d_name[base_length] != '.'){
+            continue;
+        }
+        size_t length = strlen(entry->d_name);
+        if(length > 3 && strcmp(entry->d_name + length - 3, ".gz") == 0){
+            length -= 3;
+        }
+        char *stamp = strndup(entry->d_name, length);
+        if(stamp == NULL){
+            break;
+        }
+        if(count == capacity){
+            capacity = capacity ? capacity * 2 : 16;
+            char **grown = realloc(names, capacity * sizeof(char *));
+            if(grown == NULL){
+                free(stamp);
+                break;
+            }
+            names = grown;
+        }
+        names[count++] = stamp;
+    }
+    closedir(dir);
+    qsort(names, count, sizeof(char *), compare_names);
+    // A file and its .gz share a stamp, count each stamp once
+    size_t unique = 0;
+    for(size_t i = 0; i < count; i++){
+        if(unique == 0 || strcmp(names[unique - 1], names[i]) != 0){
+            names[unique++] = names[i];
+        }else{
+            free(names[i]);
+        }
+    }
+    for(size_t i = 0; i < unique; i++){
+        if(i + (size_t)rotate_keep < unique){
+            char victim[LOG_PATH_SIZE + 8];
+            snprintf(victim, sizeof(victim), "%s/%s", directory, names[i]);
+            unlink(victim);
+            strncat(victim, ".gz", sizeof(victim) - strlen(victim) - 1);
+            unlink(victim);
+        }
+        free(names[i]);
+    }
+    free(names);
+}
+
+// Runs gzip on a rotated file and prunes old ones, at the lowest CPU and
+// IO priority so it never competes with the pipeline.
+static void compress_rotated(const char *rotated){
+    int slot = 0;
+    while(slot < LOG_MAX_COMPRESSORS && compressors[slot] != 0){
+        slot++;
+    }
+    if(slot == LOG_MAX_COMPRESSORS){
+        // Rotations outpace gzip, leave this one uncompressed
+        prune_rotated(log_path);
+        return;
+    }
+    pid_t pid = fork();
+    if(pid != 0){
+        compressors[slot] = pid > 0 ? pid : 0;
+        return;
+    }
+    if(private_fd >= 0){
+        close(private_fd);
+    }
+    sigset_t none;
+    sigemptyset(&none);
+    sigprocmask(SIG_SETMASK, &none, NULL);
+    setpriority(PRIO_PROCESS, 0, 19);
+    syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT);
+    pid_t gzip = fork();
+    if(gzip == 0){
+        execlp("gzip", "gzip", "-q", rotated, (char *)NULL);
+        _exit(127);
+    }
+    if(gzip > 0){
+        waitpid(gzip, NULL, 0);
+    }
+    prune_rotated(log_path);
+    _exit(EXIT_SUCCESS);
+}
+
+// Collects finished compressors, called when the owner sees SIGCHLD
+void logger_reap(){
+    for(int i = 0; i < LOG_MAX_COMPRESSORS; i++){
+        if(compressors[i] > 0 && waitpid(compressors[i], NULL, WNOHANG) == compressors[i]){
+            compressors[i] = 0;
+        }
+    }
+}
+
+// The rename is atomic, so the log is never missing, and the new file is
+// swapped in with dup2 between two batches. Producers keep queueing.
+static void rotate(){
+    char rotated[LOG_PATH_SIZE];
+    char stamp[32];
+    time_t now = time(NULL);
+    struct tm tm_info;
+    localtime_r(&now, &tm_info);
+    strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", &tm_info);
+    int length = snprintf(rotated, sizeof(rotated), "%s.%s", log_path, stamp);
+    for(int n = 1; n < 1000 && length > 0 && (size_t)length < sizeof(rotated) && access(rotated, F_OK) == 0; n++){
+        length = snprintf(rotated, sizeof(rotated), "%s.%s.%d", log_path, stamp, n);
+    }
+    if(length < 0 || (size_t)length >= sizeof(rotated) || rename(log_path, rotated) == -1){
+        // Retried on the next drain rather than spinning here
+        file_opened = now;
+        return;
+    }
+    int fd = open(log_path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if(fd < 0){
+        return;
+    }
+    attach(fd);
+    compress_rotated(rotated);
+}
+
+static int rotation_due(){
+    return (rotate_bytes > 0 && file_bytes >= rotate_bytes) ||
+        (rotate_seconds > 0 && time(NULL) - file_opened >= rotate_seconds);
+}
+
+// Becomes readable whenever records are waiting for logger_drain
+int logger_event_fd(){
+    return event_fd;
+}
+
+static void writev_full(struct iovec *iov, int count){
+    while(count > 0){
+        ssize_t written = writev(STDOUT_FILENO, iov, count);
+        if(written < 0){
+            if(errno == EINTR){
+                continue;
+            }
+            return;
+        }
+        file_bytes += (uint64_t)written;
+        while(count > 0 && (size_t)written >= iov->iov_len){
+            written -= (ssize_t)iov->iov_len;
+            iov++;
+            count--;
+        }
+        if(count > 0){
+            iov->iov_base = (char *)iov->iov_base + written;
+            iov->iov_len -= (size_t)written;
+        }
+    }
+}
+
+// A producer killed between claiming a slot and publishing it would block
+// the log forever, so a slot claimed for too long is skipped.
+static int abandon_slot(LogRecord *record, uint64_t position, int force){
+    uint64_t now = now_ns();
+    if(!force){
+        if(stalled_position != position){
+            stalled_position = position;
+            stalled_since_ns = now;
+            return 0;
+        }
+        if(now - stalled_since_ns < LOG_STALL_MS * 1000000ULL){
+            return 0;
+        }
+    }
+    uint64_t expected = position;
+    if(atomic_compare_exchange_strong(&record->sequence, &expected, position + LOG_RING_SLOTS)){
+        atomic_fetch_add(&shared->dropped, 1);
+    }
+    return 1;
+}
+
+static void drain(int force){
+    if(shared == NULL || getpid() != owner){
+        return;
+    }
+    uint64_t wakeups;
+    if(read(event_fd, &wakeups, sizeof(wakeups)) == -1 && errno != EAGAIN){
+        return;
+    }
+    // Cleared before draining, a record pushed from here on wakes us again
+    atomic_store(&shared->wake_pending, 0);
+
+    struct iovec iov[LOG_BATCH * 3];
+    char prefixes[LOG_BATCH][LOG_PREFIX_SIZE];
+    LogRecord *batch[LOG_BATCH];
+    for(;;){
+        int records = 0;
+        int count = 0;
+        int distinct = 0;
+        while(records < LOG_BATCH){
+            LogRecord *record = &shared->records[dequeue & (LOG_RING_SLOTS - 1)];
+            if(atomic_load_explicit(&record->sequence, memory_order_acquire) != dequeue + 1){
+                if(atomic_load(&shared->enqueue) == dequeue || !abandon_slot(record, dequeue, force)){
+                    break;
+                }
+                // Published after all, or skipped for good
+                if(atomic_load_explicit(&record->sequence, memory_order_acquire) != dequeue + 1){
+                    dequeue++;
+                    continue;
+                }
+            }
+            if(distinct == 0 || record->seconds != prefix_second){
+                update_prefix(record->seconds);
+                memcpy(prefixes[distinct++], prefix, prefix_length);
+            }
+            iov[count].iov_base = prefixes[distinct - 1];
+            iov[count++].iov_len = prefix_length;
+            if(record->error){
+                iov[count].iov_base = "ERROR: ";
+                iov[count++].iov_len = 7;
+            }
+            iov[count].iov_base = record->text;
+            iov[count++].iov_len = record->length;
+            batch[records++] = record;
+            dequeue++;
+        }
+        if(records == 0){
+            break;
+        }
+        writev_full(iov, count);
+        for(int i = 0; i < records; i++){
+            uint64_t sequence = atomic_load_explicit(&batch[i]->sequence, memory_order_relaxed);
+            atomic_store_explicit(&batch[i]->sequence, sequence - 1 + LOG_RING_SLOTS, memory_order_release);
+        }
+        if(records < LOG_BATCH){
+            break;
+        }
+    }
+
+    uint64_t dropped = atomic_load(&shared->dropped);
+    if(dropped != dropped_reported){
+        char line[96];
+        update_prefix(time(NULL));
+        int length = snprintf(line, sizeof(line), "%sERROR: Logger dropped %llu records\n", prefix, (unsigned long long)(dropped - dropped_reported));
+        if(write(STDOUT_FILENO, line, (size_t)length) < 0){
+            return;
+        }
+        file_bytes += (uint64_t)length;
+        dropped_reported = dropped;
+    }
+    if(rotation_due()){
+        rotate();
+    }
+}
+
+// Writes out everything queued so far. Only the owner drains, in every other
+// process this does nothing.
+void logger_drain(){
+    drain(0);
+}
+
+// Final drain once the children are gone, nothing can be published late
+void logger_close(){
+    drain(1);
+}
+
+// Claims a slot, formats into it and publishes it. Never blocks or
+// allocates, a full ring drops the record and counts it instead.
+static void log_push(int error, const char *format, va_list args){
+    if(shared == NULL){
+        vdprintf(error ? STDERR_FILENO : STDOUT_FILENO, format, args);
+        dprintf(error ? STDERR_FILENO : STDOUT_FILENO, "\n");
+        return;
+    }
+    uint64_t position = atomic_load_explicit(&shared->enqueue, memory_order_relaxed);
+    LogRecord *record;
+    for(;;){
+        record = &shared->records[position & (LOG_RING_SLOTS - 1)];
+        uint64_t sequence = atomic_load_explicit(&record->sequence, memory_order_acquire);
+        int64_t difference = (int64_t)(sequence - position);
+        if(difference == 0){
+            if(atomic_compare_exchange_weak(&shared->enqueue, &position, position + 1)){
+                break;
+            }
+        }else if(difference < 0){
+            atomic_fetch_add(&shared->dropped, 1);
+            return;
+        }else{
+            position = atomic_load_explicit(&shared->enqueue, memory_order_relaxed);
+        }
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    record->seconds = now.tv_sec;
+    record->error = (uint8_t)error;
+    int length = vsnprintf(record->text, LOG_TEXT_SIZE, format, args);
+    if(length < 0){
+        length = 0;
+    }else if(length > (int)LOG_TEXT_SIZE - 1){
+        length = LOG_TEXT_SIZE - 1;
+    }
+    record->text[length] = '\n';
+    record->length = (uint16_t)(length + 1);
+
+    uint64_t expected = position;
+    if(!atomic_compare_exchange_strong(&record->sequence, &expected, position + 1)){
+        // The owner gave up on this slot while it was being filled
+        atomic_fetch_add(&shared->dropped, 1);
+        return;
+    }
+    if(!atomic_exchange(&shared->wake_pending, 1)){
+        uint64_t one = 1;
+        if(write(event_fd, &one, sizeof(one)) < 0){
+            atomic_store(&shared->wake_pending, 0);
+        }
+    }
+}
+
+void log_message(const char *format, ...){
+    va_list args;
+    va_start(args, format);
+    log_push(0, format, args);
+    va_end(args);
+}
+
+void log_error(const char *format, ...){
+    va_list args;
+    va_start(args, format);
+    log_push(1, format, args);
+    va_end(args);
+}
@@ -0,0 +1,28 @@
+#include <stddef.h>
+#include <stdint.h>
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#define LOG_RING_SLOTS 1024
+#define LOG_RECORD_SIZE 256
+#define LOG_BATCH 256
+#define LOG_STALL_MS 1000
+#define LOG_ROTATE_BYTES (16ULL * 1024 * 1024)
+#define LOG_ROTATE_KEEP 8
+#define LOG_MAX_COMPRESSORS 4
+
+// The log is shared by the supervisor and every child forked after
+// logger_open. Any of them pushes fixed-size records without locks, only
+// the process that opened the logger writes them out.
+int logger_open(const char *path);
+int logger_reopen();
+void logger_set_rotation(uint64_t max_bytes, int interval_seconds, int keep);
+void logger_set_private_fd(int fd);
+void logger_reap();
+int logger_event_fd();
+void logger_drain();
+void logger_close();
+void log_message(const char *format, ...);
+void log_error(const char *format, ...);
+
+#endif
@@ -1,56 +1,122 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <sys/syscall.h>
+#include <sys/file.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <string.h>
 #include <signal.h>
 #include <errno.h>
 #include <time.h>
-#include <stdarg.h>
+#include "logger.h"
+#include "pipeline.h"
+#include "runtime.h"
 
-#define FIFO1 "/tmp/fifo1"
-#define FIFO2 "/tmp/fifo2"
-#define LOG_FILE "/tmp/daemon_log.txt"
 #define PROCESS_TIMEOUT 30  // timeout in seconds
+#define MAX_CHILDREN (MAX_WORKERS + 2)
+#define MAX_EVENTS 8
 
 #define ABORT_EVERYTHING(msg)                \
     do{                                      \
         log_error("%s: %s", msg, strerror(errno)); \
-        if(access(FIFO1, F_OK) == 0){        \
-            unlink(FIFO1);                   \
+        if(access(fifo1_path, F_OK) == 0){   \
+            unlink(fifo1_path);              \
         }                                    \
-        if(access(FIFO2, F_OK) == 0){        \
-            unlink(FIFO2);                   \
+        if(access(fifo2_path, F_OK) == 0){   \
+            unlink(fifo2_path);              \
         }                                    \
         exit(EXIT_FAILURE);                  \
     }while(0)
 
-volatile int exited_child_counter = 0;
-volatile int num_children = 0;
-volatile sig_atomic_t running = 1;
+typedef struct{
+    char name[32];
+    void (*body)();
+    pid_t pid;
+    int pidfd;
+    int exited;
+    int worker;             // index into the pool, -1 for the writer and child 2
+    int failures;           // consecutive, reset once a restarted worker makes progress
+    int restarts;
+    int restart_pending;
+    uint64_t restart_at_ns;
+    uint64_t batches_at_start;
+    uint64_t batches_seen;
+    uint64_t progress_ns;   // last time the worker was idle or finished a batch
+} Child;
+
+Child children[MAX_CHILDREN];
+int num_children = 0;
+int exited_child_counter = 0;
+int pending_restarts = 0;
+int running = 1;
+int epoll_fd = -1;
+int stats_fd = -1;
+int lock_fd = -1;
+
+char runtime_dir[RUNTIME_PATH_SIZE] = RUNTIME_DIR;
+char fifo1_path[RUNTIME_PATH_SIZE];
+char fifo2_path[RUNTIME_PATH_SIZE];
+char log_path[RUNTIME_PATH_SIZE];
+char stats_path[RUNTIME_PATH_SIZE];
+
+PipelineConfig config;
+Ring input_rings[MAX_WORKERS];
+Ring result_rings[MAX_WORKERS];
+PoolShared *pool;
+int current_worker = -1;
+int timeout_seconds = PROCESS_TIMEOUT;
+uint64_t log_rotate_bytes = LOG_ROTATE_BYTES;
+int log_rotate_seconds = 0;
+int log_keep = LOG_ROTATE_KEEP;
+int worker_timeout_ms = WORKER_TIMEOUT_MS;
+int draining = 0;
+sigset_t original_mask;
+struct timespec start_time;
 
 int string_to_int(const char *str);
+int string_to_uint64(const char *str, uint64_t *value);
+int runtime_path(char *path, const char *name);
+int claim_runtime_dir();
+int parse_runtime_option(char *argv[], int *index);
 int create_fifo(const char *path);
+void create_links();
+void open_link(int link, int worker, int writing, Channel *channel);
+void close_links(const Child *child);
+int parse_arguments(int argc, char *argv[]);
+void parent_writer_process();
 void first_child_process();
 void second_child_process();
-void sigchld_handler(int sig);
-void sigusr1_handler(int sig);
-void sighup_handler(int sig);
-void sigterm_handler(int sig);
-void log_message(const char *format, ...);
-void log_error(const char *format, ...);
+Child *spawn_child(const char *name, void (*body)(), int worker);
+void start_child(Child *child);
+void reap_child(Child *child);
+int can_restart_workers();
+void check_workers();
+void handle_signal(const struct signalfd_siginfo *info);
 void cleanup();
+size_t format_metrics(char *buffer, size_t size);
+void log_metrics();
 void monitor_children();
-
-pid_t pid1, pid2, pid_parent_write;
-time_t child1_start_time, child2_start_time;
-int log_fd;
+double elapsed_ms();
 
 int main(int argc, char *argv[]){
-    if(argc != 3){
-        printf("Invalid number of parameters.\nUsage %s <int1> <int2>\n", argv[0]);
+    if(parse_arguments(argc, argv) == -1){
+        printf("Invalid parameters.\nUsage %s <int1> <int2> [--instance <name> | --runtime-dir <path>]\n"
+            "      %s --stream <pairs> [--batch <pairs>] [--seed <n>] [--timeout <seconds>]\n"
+            "         [--transport fifo|ring] [--workers <n>] [--worker-timeout <ms>]\n"
+            "         [--bulk <window>] [--threads <n>] [--simd auto|scalar|sse4.1|avx2]\n"
+            "         [--log-size <KiB>] [--log-interval <seconds>] [--log-keep <files>]\n"
+            "         [--instance <name> | --runtime-dir <path>] [--shard <index>/<count>]\n"
+            "      (--stream 0 runs until SIGTERM)\n", argv[0], argv[0]);
+        return 1;
+    }
+    // Taken before daemonizing, so a clash is still reported on the terminal
+    if(claim_runtime_dir() == -1){
         return 1;
     }
 
@@ -82,118 +148,174 @@ int main(int argc, char *argv[]){
     chdir("/");
 
     for(int i = 0; i < sysconf(_SC_OPEN_MAX); i++){
-        close(i);
+        if(i != lock_fd){
+            close(i);
+        }
     }
-
-    log_fd = open(LOG_FILE, O_WRONLY | O_CREAT | O_APPEND, 0644);
-    if(log_fd < 0){
-        exit(EXIT_FAILURE);
+    // The lock file names the supervisor holding it
+    if(ftruncate(lock_fd, 0) == 0){
+        dprintf(lock_fd, "%d\n", getpid());
     }
-    dup2(log_fd, STDOUT_FILENO);
-    dup2(log_fd, STDERR_FILENO);
-    
+
     int dev_null = open("/dev/null", O_RDONLY);
-    if(dev_null >= 0){
+    if(dev_null >= 0 && dev_null != STDIN_FILENO){
         dup2(dev_null, STDIN_FILENO);
         close(dev_null);
     }
-    
-/*    int result = 0;*/
-/*    log_message("Daemon started. Result initialized to %d", result);*/
-
-    int num1 = string_to_int(argv[1]);
-    int num2 = string_to_int(argv[2]);
-
-    log_message("Numbers received %d and %d", num1, num2);
-    
-    struct sigaction sa;
-    memset(&sa, 0, sizeof(sa));
-    
-    sa.sa_handler = sigchld_handler;
-    sigemptyset(&sa.sa_mask);
-    sa.sa_flags = SA_RESTART | SA_NOCLDSTOP;
-    if(sigaction(SIGCHLD, &sa, NULL) == -1){
-        ABORT_EVERYTHING("sigaction for SIGCHLD failed");
-    }
-    
-    sa.sa_handler = sigusr1_handler;
-    sigemptyset(&sa.sa_mask);
-    sa.sa_flags = SA_RESTART;
-    if(sigaction(SIGUSR1, &sa, NULL) == -1){
-        ABORT_EVERYTHING("sigaction for SIGUSR1 failed");
-    }
-    
-    sa.sa_handler = sighup_handler;
-    sigemptyset(&sa.sa_mask);
-    sa.sa_flags = SA_RESTART;
-    if(sigaction(SIGHUP, &sa, NULL) == -1){
-        ABORT_EVERYTHING("sigaction for SIGHUP failed");
-    }
-    
-    sa.sa_handler = sigterm_handler;
-    sigemptyset(&sa.sa_mask);
-    sa.sa_flags = SA_RESTART;
-    if(sigaction(SIGTERM, &sa, NULL) == -1){
-        ABORT_EVERYTHING("sigaction for SIGTERM failed");
-    }
-    
-    log_message("Signal handlers set up");
-    
-    if(create_fifo(FIFO1) == -1 || create_fifo(FIFO2) == -1){
-        ABORT_EVERYTHING("Failed creating FIFOs");
+
+    if(logger_open(log_path) == -1){
+        exit(EXIT_FAILURE);
     }
-    log_message("FIFOs created successfully");
-    
-    pid_parent_write = fork();
-    if(pid_parent_write < 0){
-        ABORT_EVERYTHING("Fork failed for parent fifo write fork");
-    }else if (pid_parent_write == 0){
-        int fifo1_fd = open(FIFO1, O_WRONLY);
-        if(fifo1_fd < 0){
-            ABORT_EVERYTHING("Parent: Failed to open FIFO1");
-        }
-    
-        if(write(fifo1_fd, &num1, sizeof(num1)) == -1 ||
-            write(fifo1_fd, &num2, sizeof(num2)) == -1){
-            close(fifo1_fd);
-            ABORT_EVERYTHING("Parent: Failed to write to FIFO1");
-        }
-        close(fifo1_fd);
-        log_message("Parent writer: sent values %d and %d to FIFO1", num1, num2);
-        exit(EXIT_SUCCESS);
+    logger_set_rotation(log_rotate_bytes, log_rotate_seconds, log_keep);
+    logger_set_private_fd(lock_fd);
+
+    log_message("Instance runtime directory %s", runtime_dir);
+    if(config.streaming){
+        log_message("Streaming %llu pairs in batches of %u over %s to %d worker(s)", (unsigned long long)config.pairs, config.batch_pairs, transport_name(config.transport), config.workers);
+        log_message("Compute kernel %s with %d thread(s)%s", reduce_kernel_name(), reduce_threads(), config.bulk_window ? ", bulk mode" : "");
+    }else{
+        log_message("Numbers received %d and %d", config.num1, config.num2);
     }
-    num_children++;
-    
-    pid1 = fork();
-    if(pid1 < 0){
-        ABORT_EVERYTHING("Fork failed for child 1");
-    }else if (pid1 == 0){
-        first_child_process();
-        exit(EXIT_FAILURE); // Should not reach here
+
+    // Signals are consumed through a signalfd, so they stay blocked for the
+    // whole lifetime of the supervisor. Children restore the original mask.
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigaddset(&mask, SIGUSR1);
+    sigaddset(&mask, SIGHUP);
+    sigaddset(&mask, SIGTERM);
+    if(sigprocmask(SIG_BLOCK, &mask, &original_mask) == -1){
+        ABORT_EVERYTHING("sigprocmask failed");
     }
-    child1_start_time = time(NULL);
-    num_children++;
-    
-    pid2 = fork();
-    if(pid2 < 0){
-        ABORT_EVERYTHING("Fork failed for child 2");
-    }else if (pid2 == 0){
-        second_child_process();
-        exit(EXIT_FAILURE); // Should not reach here
+
+    config.metrics = metrics_create();
+    if(config.metrics == NULL){
+        ABORT_EVERYTHING("Failed creating the metrics segment");
+    }
+    create_links();
+
+    int signal_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if(signal_fd < 0){
+        ABORT_EVERYTHING("signalfd failed");
     }
-    child2_start_time = time(NULL);
-    num_children++;
-    
+    int timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    if(timer_fd < 0){
+        ABORT_EVERYTHING("timerfd_create failed");
+    }
+    struct itimerspec timeout;
+    memset(&timeout, 0, sizeof(timeout));
+    timeout.it_value.tv_sec = timeout_seconds;
+    if(timerfd_settime(timer_fd, 0, &timeout, NULL) == -1){
+        ABORT_EVERYTHING("timerfd_settime failed");
+    }
+
+    // Ticks while a pool is supervised, for hung workers and delayed restarts
+    int tick_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    if(tick_fd < 0){
+        ABORT_EVERYTHING("timerfd_create failed");
+    }
+    if(config.transport == TRANSPORT_RING){
+        struct itimerspec tick;
+        memset(&tick, 0, sizeof(tick));
+        tick.it_value.tv_nsec = POOL_TICK_MS * 1000000L;
+        tick.it_interval.tv_nsec = POOL_TICK_MS * 1000000L;
+        if(timerfd_settime(tick_fd, 0, &tick, NULL) == -1){
+            ABORT_EVERYTHING("timerfd_settime failed");
+        }
+    }
+
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if(epoll_fd < 0){
+        ABORT_EVERYTHING("epoll_create1 failed");
+    }
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.ptr = &signal_fd;
+    if(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, signal_fd, &event) == -1){
+        ABORT_EVERYTHING("epoll_ctl for signalfd failed");
+    }
+    event.data.ptr = &timer_fd;
+    if(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, timer_fd, &event) == -1){
+        ABORT_EVERYTHING("epoll_ctl for timerfd failed");
+    }
+    int log_fd = logger_event_fd();
+    event.data.ptr = &log_fd;
+    if(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, log_fd, &event) == -1){
+        ABORT_EVERYTHING("epoll_ctl for the logger failed");
+    }
+    // Stats are a convenience, the pipeline runs without them
+    stats_fd = metrics_listen(stats_path);
+    if(stats_fd < 0){
+        log_error("Stats socket %s unavailable: %s", stats_path, strerror(errno));
+    }else{
+        event.data.ptr = &stats_fd;
+        if(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, stats_fd, &event) == -1){
+            ABORT_EVERYTHING("epoll_ctl for the stats socket failed");
+        }
+    }
+    event.data.ptr = &tick_fd;
+    if(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, tick_fd, &event) == -1){
+        ABORT_EVERYTHING("epoll_ctl for timerfd failed");
+    }
+    log_message("Event loop set up");
+
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+    spawn_child("Parent writer", parent_writer_process, -1);
+    for(int i = 0; i < config.workers; i++){
+        char name[32];
+        if(config.workers == 1){
+            snprintf(name, sizeof(name), "Child 1");
+        }else{
+            snprintf(name, sizeof(name), "Worker %d", i + 1);
+        }
+        spawn_child(name, first_child_process, i);
+    }
+    spawn_child("Child 2", second_child_process, -1);
     log_message("Parent: Created %d child processes", num_children);
-    
-    while(running && exited_child_counter < num_children){
-        log_message("Parent: proceeding...");
-        monitor_children();
-        sleep(2);
-    }
-    
-    log_message("Parent: All children have exited or program terminating");
+
+    while(running && (exited_child_counter < num_children || pending_restarts > 0)){
+        struct epoll_event events[MAX_EVENTS];
+        int ready = epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
+        if(ready < 0){
+            if(errno == EINTR){
+                continue;
+            }
+            ABORT_EVERYTHING("epoll_wait failed");
+        }
+        for(int i = 0; i < ready; i++){
+            if(events[i].data.ptr == &signal_fd){
+                struct signalfd_siginfo info;
+                while(read(signal_fd, &info, sizeof(info)) == sizeof(info)){
+                    handle_signal(&info);
+                }
+            }else if(events[i].data.ptr == &timer_fd){
+                uint64_t expirations;
+                if(read(timer_fd, &expirations, sizeof(expirations)) == sizeof(expirations)){
+                    monitor_children();
+                }
+            }else if(events[i].data.ptr == &log_fd){
+                logger_drain();
+            }else if(events[i].data.ptr == &stats_fd){
+                char dump[METRICS_DUMP_SIZE];
+                metrics_serve(stats_fd, dump, format_metrics(dump, sizeof(dump)));
+            }else if(events[i].data.ptr == &tick_fd){
+                uint64_t expirations;
+                if(read(tick_fd, &expirations, sizeof(expirations)) == sizeof(expirations)){
+                    check_workers();
+                }
+            }else{
+                reap_child(events[i].data.ptr);
+            }
+        }
+    }
+
+    log_message("Parent: All children have exited or program terminating after %.3f ms", elapsed_ms());
     cleanup();
+    close(epoll_fd);
+    close(tick_fd);
+    close(timer_fd);
+    close(signal_fd);
     return 0;
 }
 
@@ -207,6 +329,224 @@ int string_to_int(const char *str){
     return num;
 }
 
+// Stream lengths and seeds span the whole 64-bit range, so they are parsed
+// unsigned and anything that does not fit is rejected instead of wrapped
+int string_to_uint64(const char *str, uint64_t *value){
+    char *endptr;
+    errno = 0;
+    unsigned long long num = strtoull(str, &endptr, 10);
+    if(str[0] < '0' || str[0] > '9' || *endptr != '\0' || errno == ERANGE){
+        log_error("Error: '%s' is not a valid unsigned 64-bit number", str);
+        return -1;
+    }
+    *value = (uint64_t)num;
+    return 0;
+}
+
+int parse_arguments(int argc, char *argv[]){
+    config.batch_pairs = DEFAULT_BATCH_PAIRS;
+    config.workers = 1;
+    // Two values may only be followed by where the instance runs
+    if(argc >= 3 && strncmp(argv[1], "--", 2) != 0){
+        config.pairs = 1;
+        config.num1 = string_to_int(argv[1]);
+        config.num2 = string_to_int(argv[2]);
+        for(int i = 3; i < argc; i++){
+            if(parse_runtime_option(argv, &i) != 1){
+                return -1;
+            }
+        }
+        return 0;
+    }
+    int custom_timeout = 0;
+    int threads = 1;
+    const char *kernel = "auto";
+    int shard = 0;
+    int shard_count = 1;
+    for(int i = 1; i < argc; i++){
+        if(i + 1 >= argc){
+            return -1;
+        }
+        if(strcmp(argv[i], "--transport") == 0){
+            if(strcmp(argv[i + 1], "fifo") == 0){
+                config.transport = TRANSPORT_FIFO;
+            }else if(strcmp(argv[i + 1], "ring") == 0){
+                config.transport = TRANSPORT_RING;
+            }else{
+                return -1;
+            }
+            i++;
+            continue;
+        }
+        if(strcmp(argv[i], "--simd") == 0){
+            kernel = argv[++i];
+            continue;
+        }
+        int runtime = parse_runtime_option(argv, &i);
+        if(runtime == -1){
+            return -1;
+        }
+        if(runtime == 1){
+            continue;
+        }
+        if(strcmp(argv[i], "--shard") == 0){
+            char *endptr;
+            shard = (int)strtol(argv[++i], &endptr, 10);
+            if(*endptr != '/'){
+                return -1;
+            }
+            shard_count = (int)strtol(endptr + 1, &endptr, 10);
+            if(*endptr != '\0' || shard_count < 1 || shard < 0 || shard >= shard_count){
+                return -1;
+            }
+            continue;
+        }
+        if(strcmp(argv[i], "--stream") == 0){
+            if(string_to_uint64(argv[++i], &config.pairs) == -1){
+                return -1;
+            }
+            config.streaming = 1;
+            continue;
+        }
+        if(strcmp(argv[i], "--seed") == 0){
+            if(string_to_uint64(argv[++i], &config.seed) == -1){
+                return -1;
+            }
+            continue;
+        }
+        int value = string_to_int(argv[i + 1]);
+        if(value < 0){
+            return -1;
+        }
+        if(strcmp(argv[i], "--batch") == 0){
+            if(value < 1 || value > MAX_BATCH_PAIRS){
+                return -1;
+            }
+            config.batch_pairs = (uint32_t)value;
+        }else if(strcmp(argv[i], "--timeout") == 0){
+            timeout_seconds = value;
+            custom_timeout = 1;
+        }else if(strcmp(argv[i], "--workers") == 0){
+            if(value < 1 || value > MAX_WORKERS){
+                return -1;
+            }
+            config.workers = value;
+        }else if(strcmp(argv[i], "--worker-timeout") == 0){
+            if(value < 1){
+                return -1;
+            }
+            worker_timeout_ms = value;
+        }else if(strcmp(argv[i], "--bulk") == 0){
+            if(value < 1){
+                return -1;
+            }
+            config.bulk_window = (uint32_t)value;
+        }else if(strcmp(argv[i], "--threads") == 0){
+            threads = value;
+        }else if(strcmp(argv[i], "--log-size") == 0){
+            log_rotate_bytes = (uint64_t)value * 1024;
+        }else if(strcmp(argv[i], "--log-interval") == 0){
+            log_rotate_seconds = value;
+        }else if(strcmp(argv[i], "--log-keep") == 0){
+            if(value < 1){
+                return -1;
+            }
+            log_keep = value;
+        }else{
+            return -1;
+        }
+        i++;
+    }
+    // A stream may legitimately run for longer than PROCESS_TIMEOUT
+    if(!custom_timeout){
+        timeout_seconds = 0;
+    }
+    // A FIFO is a byte stream that cannot be handed over to a restarted
+    // reader in the middle of a batch, so the pool runs on rings only.
+    if(config.workers > 1 && config.transport != TRANSPORT_RING){
+        return -1;
+    }
+    // A bounded stream is cut into contiguous ranges of the same sequence, so
+    // the shards together see exactly the pairs a single instance would. An
+    // unbounded one is cut into equal ranges of the whole 2^64 period.
+    if(shard_count > 1){
+        if(config.pairs > 0){
+            // Widened, as a length near 2^64 times the shard number overflows
+            uint64_t first = (uint64_t)((unsigned __int128)config.pairs * (unsigned)shard / (unsigned)shard_count);
+            config.skip = first;
+            config.pairs = (uint64_t)((unsigned __int128)config.pairs * (unsigned)(shard + 1) / (unsigned)shard_count) - first;
+            if(config.pairs == 0){
+                return -1;
+            }
+        }else{
+            config.skip = UINT64_MAX / (uint64_t)shard_count * (uint64_t)shard;
+        }
+    }
+    // Chosen before the workers are forked, so they all inherit the kernel
+    if(reduce_init(kernel, threads) == -1){
+        return -1;
+    }
+    return config.streaming ? 0 : -1;
+}
+
+// Returns 1 and steps over the value when argv[*index] picks the runtime
+// directory, 0 for any other option and -1 for a missing or bad value.
+int parse_runtime_option(char *argv[], int *index){
+    const char *value = argv[*index + 1];
+    if(strcmp(argv[*index], "--instance") == 0){
+        if(value == NULL || value[0] == '\0' || strchr(value, '/') != NULL){
+            return -1;
+        }
+        snprintf(runtime_dir, sizeof(runtime_dir), INSTANCE_DIR_FORMAT, value);
+    }else if(strcmp(argv[*index], "--runtime-dir") == 0){
+        if(value == NULL || snprintf(runtime_dir, sizeof(runtime_dir), "%s", value) >= (int)sizeof(runtime_dir)){
+            return -1;
+        }
+    }else{
+        return 0;
+    }
+    (*index)++;
+    return 1;
+}
+
+int runtime_path(char *path, const char *name){
+    if(snprintf(path, RUNTIME_PATH_SIZE, "%s/%s", runtime_dir, name) >= RUNTIME_PATH_SIZE){
+        return -1;
+    }
+    return 0;
+}
+
+// Two supervisors in one runtime directory would delete each other's FIFOs,
+// so each holds a lock on it for as long as it runs
+int claim_runtime_dir(){
+    char path[RUNTIME_PATH_SIZE];
+    if(runtime_path(fifo1_path, FIFO1_NAME) == -1 || runtime_path(fifo2_path, FIFO2_NAME) == -1 ||
+        runtime_path(log_path, LOG_NAME) == -1 || runtime_path(stats_path, STATS_SOCKET_NAME) == -1 ||
+        runtime_path(path, LOCK_NAME) == -1){
+        fprintf(stderr, "Runtime directory %s is too long\n", runtime_dir);
+        return -1;
+    }
+    if(mkdir(runtime_dir, 0755) == -1 && errno != EEXIST){
+        fprintf(stderr, "Cannot create runtime directory %s: %s\n", runtime_dir, strerror(errno));
+        return -1;
+    }
+    lock_fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if(lock_fd < 0){
+        fprintf(stderr, "Cannot open %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    if(flock(lock_fd, LOCK_EX | LOCK_NB) == -1){
+        if(errno == EWOULDBLOCK){
+            fprintf(stderr, "Runtime directory %s is used by another instance, see %s\n", runtime_dir, path);
+        }else{
+            fprintf(stderr, "Cannot lock %s: %s\n", path, strerror(errno));
+        }
+        close(lock_fd);
+        return -1;
+    }
+    return 0;
+}
+
 int create_fifo(const char *path){
     if(access(path, F_OK) == 0){
         log_message("FIFO %s already exists, removing it...", path);
@@ -222,246 +562,374 @@ int create_fifo(const char *path){
     return 0;
 }
 
-void first_child_process(){
-    log_message("Child 1 (PID: %d) started", getpid());
-    log_message("Child 1: Sleeping for 10 seconds...");
-    sleep(10);
-    log_message("Child 1: Woke up after sleeping");
-    
-    int fifo1_fd = open(FIFO1, O_RDONLY | O_NONBLOCK);
-    if (fifo1_fd < 0) {
-        log_error("Child 1: Failed to open FIFO1");
-        exit(EXIT_FAILURE);
+Child *spawn_child(const char *name, void (*body)(), int worker){
+    Child *child = &children[num_children++];
+    memset(child, 0, sizeof(Child));
+    snprintf(child->name, sizeof(child->name), "%s", name);
+    child->body = body;
+    child->worker = worker;
+    start_child(child);
+    return child;
+}
+
+void start_child(Child *child){
+    current_worker = child->worker;
+    child->exited = 0;
+    child->pid = fork();
+    if(child->pid < 0){
+        ABORT_EVERYTHING("Fork failed");
+    }else if(child->pid == 0){
+        // Only the supervisor holds the runtime directory
+        close(lock_fd);
+        sigprocmask(SIG_SETMASK, &original_mask, NULL);
+        child->body();
+        exit(EXIT_FAILURE); // Should not reach here
     }
-    
-    int num1, num2;
-    int retry_count = 0;
-    const int max_retries = 5;
-    ssize_t bytes_read1 = 0;
-    ssize_t bytes_read2 = 0;
-    
-    while((bytes_read1 <= 0 || bytes_read2 <= 0) && retry_count < max_retries){
-        if(bytes_read1 <= 0){
-            bytes_read1 = read(fifo1_fd, &num1, sizeof(num1));
-            if(bytes_read1 < 0 && errno != EAGAIN){
-                close(fifo1_fd);
-                log_error("Child 1: Error reading num1 from FIFO1");
-                exit(EXIT_FAILURE);
-            }
+    // Without pidfd support the child is reaped when SIGCHLD arrives
+    child->pidfd = (int)syscall(SYS_pidfd_open, child->pid, 0);
+    if(child->pidfd < 0){
+        log_message("Parent: pidfd_open unavailable for %s (%s), falling back to SIGCHLD", child->name, strerror(errno));
+        return;
+    }
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.ptr = child;
+    if(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, child->pidfd, &event) == -1){
+        ABORT_EVERYTHING("epoll_ctl for pidfd failed");
+    }
+}
+
+void create_links(){
+    if(config.transport == TRANSPORT_RING){
+        // Mapped before the children are forked, so every process, restarted
+        // workers included, shares them
+        pool = pool_shared_create();
+        if(pool == NULL){
+            ABORT_EVERYTHING("Failed creating the worker pool state");
+        }
+        size_t capacity = RING_DEFAULT_CAPACITY / (size_t)config.workers;
+        if(capacity < RING_MIN_CAPACITY){
+            capacity = RING_MIN_CAPACITY;
+        }
+        // Room for two result batches, so a worker is not serialised on child 2
+        size_t result_capacity = capacity;
+        if(result_capacity < 2 * result_batch_size(&config)){
+            result_capacity = 2 * result_batch_size(&config);
         }
-        
-        if(bytes_read1 > 0 && bytes_read2 <= 0){
-            bytes_read2 = read(fifo1_fd, &num2, sizeof(num2));
-            if(bytes_read2 < 0 && errno != EAGAIN){
-                close(fifo1_fd);
-                log_error("Child 1: Error reading num2 from FIFO1");
-                exit(EXIT_FAILURE);
+        for(int i = 0; i < config.workers; i++){
+            if(ring_create(&input_rings[i], "fifo1-ring", capacity) == -1 ||
+                ring_create(&result_rings[i], "fifo2-ring", result_capacity) == -1){
+                ABORT_EVERYTHING("Failed creating shared memory rings");
+            }
+            if(config.workers > 1){
+                ring_share_data_wait(&result_rings[i], &pool->results);
             }
         }
-        
-        if(bytes_read1 <= 0 || bytes_read2 <= 0){
-            retry_count++;
-            log_message("Child 1: Retry %d of %d for reading from FIFO1", retry_count, max_retries);
-            sleep(1);
+        log_message("Shared memory rings created successfully");
+        return;
+    }
+    if(create_fifo(fifo1_path) == -1 || create_fifo(fifo2_path) == -1){
+        ABORT_EVERYTHING("Failed creating FIFOs");
+    }
+    log_message("FIFOs created successfully");
+}
+
+void open_link(int link, int worker, int writing, Channel *channel){
+    if(config.transport == TRANSPORT_RING){
+        channel_open_ring(channel, link == 1 ? &input_rings[worker] : &result_rings[worker]);
+        return;
+    }
+    // Blocks until the other end of the FIFO is opened as well
+    const char *path = link == 1 ? fifo1_path : fifo2_path;
+    int fd = open(path, writing ? O_WRONLY : O_RDONLY);
+    if(fd < 0){
+        ABORT_EVERYTHING(writing ? "Failed to open FIFO for writing" : "Failed to open FIFO for reading");
+    }
+    if(writing){
+        set_pipe_size(fd);
+    }
+    size_t capacity = PIPE_BUFFER_SIZE;
+    if(link == 2 && capacity < result_batch_size(&config)){
+        capacity = result_batch_size(&config);
+    }
+    if(channel_open_fifo(channel, fd, writing ? capacity : 2 * capacity) == -1){
+        ABORT_EVERYTHING("Failed to allocate FIFO buffer");
+    }
+}
+
+// A ring has no end of file, so once a process using it is gone for good its peers are told explicitly
+void close_links(const Child *child){
+    if(config.transport != TRANSPORT_RING){
+        return;
+    }
+    for(int i = 0; i < config.workers; i++){
+        if(child == &children[0] || child->worker == i){
+            ring_close(&input_rings[i]);
+        }
+        if(child == &children[num_children - 1] || child->worker == i){
+            ring_close(&result_rings[i]);
         }
     }
-    
-    close(fifo1_fd);
-    
-    if(bytes_read1 <= 0 || bytes_read2 <= 0){
-        log_error("Child 1: Failed to read from FIFO1 after %d retries", max_retries);
-        exit(EXIT_FAILURE);
+}
+
+void parent_writer_process(){
+    Channel outs[MAX_WORKERS];
+    for(int i = 0; i < config.workers; i++){
+        open_link(1, i, 1, &outs[i]);
     }
-    
-    log_message("Child 1: read integers %d and %d from FIFO1", num1, num2);
-    
-    int larger = (num1 > num2) ? num1 : num2;
-    log_message("Child 1: %d is the larger number", larger);
-    
-    if(access(FIFO2, F_OK) != 0){
-        log_error("Child 1: FIFO2 does not exist");
-        exit(EXIT_FAILURE);
+    if(stream_pairs(&config, outs, config.workers, pool) == -1){
+        ABORT_EVERYTHING("Parent: Failed to write the stream");
     }
-    
-    int fifo2_fd = open(FIFO2, O_WRONLY);
-    if(fifo2_fd < 0){
-        log_error("Child 1: Failed to open FIFO2 for writing");
-        exit(EXIT_FAILURE);
+    for(int i = 0; i < config.workers; i++){
+        channel_close(&outs[i]);
     }
-    
-    log_message("Child 1: Writing larger value %d to FIFO2", larger);
-    ssize_t bytes_written = write(fifo2_fd, &larger, sizeof(larger));
-    if(bytes_written < 0){
-        close(fifo2_fd);
-        log_error("Child 1: Failed to write to FIFO2");
+    exit(EXIT_SUCCESS);
+}
+
+// Body of every compute worker, child 1 when there is only one
+void first_child_process(){
+    int worker = current_worker;
+    const char *name = children[worker + 1].name;
+    log_message("%s (PID: %d) started", name, getpid());
+
+    Channel in;
+    Channel out;
+    open_link(1, worker, 0, &in);
+    open_link(2, worker, 1, &out);
+    int result = compute_larger(&config, name, &in, &out, pool ? &pool->workers[worker] : NULL);
+    channel_close(&in);
+    channel_close(&out);
+    if(result == -1){
         exit(EXIT_FAILURE);
     }
-        
-    close(fifo2_fd);
-    log_message("Child 1: Successfully wrote larger value %d to FIFO2", larger);
-    log_message("Child 1: Completed its task and exiting");
+    log_message("%s: Completed its task and exiting", name);
     exit(EXIT_SUCCESS);
 }
 
 void second_child_process(){
     log_message("Child 2 (PID: %d) started", getpid());
-    log_message("Child 2: Sleeping for 10 seconds...");
-    sleep(10);
-    log_message("Child 2: Woke up after sleeping");
-       
-    int fifo2_fd = open(FIFO2, O_RDONLY | O_NONBLOCK);         
-    if(fifo2_fd < 0){
-        log_error("Child 2: Failed to open FIFO2");
-        exit(EXIT_FAILURE);
+
+    Channel ins[MAX_WORKERS];
+    for(int i = 0; i < config.workers; i++){
+        open_link(2, i, 0, &ins[i]);
     }
-    
-    int larger;
-    int retry_count = 0;
-    const int max_retries = 5;
-    ssize_t bytes_read = 0;
-    
-    log_message("Child 2: Reading from FIFO2");
-    
-    while(bytes_read <= 0 && retry_count < max_retries){
-        bytes_read = read(fifo2_fd, &larger, sizeof(larger));
-        if(bytes_read < 0) {
-            if (errno != EAGAIN){
-                close(fifo2_fd);
-                log_error("Child 2: Error reading from FIFO2");
-                exit(EXIT_FAILURE);
-            }
-        }else if (bytes_read == 0){
-            log_message("Child 2: No data available yet on FIFO2");
-        }
-        
-        if(bytes_read <= 0){
-            retry_count++;
-            log_message("Child 2: Retry %d of %d for reading from FIFO2", retry_count, max_retries);
-            sleep(1);
-        }
+    log_message("Child 2: Reading from %s", config.transport == TRANSPORT_RING ? "ring 2" : "FIFO2");
+    int result = aggregate_results(&config, ins, config.workers, pool);
+    for(int i = 0; i < config.workers; i++){
+        channel_close(&ins[i]);
     }
-    
-    close(fifo2_fd);
-    
-    if(bytes_read <= 0){
-        log_error("Child 2: Failed to read from FIFO2 after %d retries", max_retries);
+    if(result == -1){
         exit(EXIT_FAILURE);
     }
-    
-    log_message("Child 2: The larger number is %d", larger);
     log_message("Child 2: Completed its task and exiting");
     exit(EXIT_SUCCESS);
 }
 
-void sigchld_handler(int sig){
-    (void)sig;
-    pid_t pid;
+void reap_child(Child *child){
+    if(child->exited){
+        return;
+    }
     int status;
+    pid_t pid = waitpid(child->pid, &status, WNOHANG);
+    if(pid <= 0){
+        return;
+    }
+    child->exited = 1;
+    exited_child_counter++;
+    if(child->pidfd >= 0){
+        close(child->pidfd);
+        child->pidfd = -1;
+    }
 
-    while((pid = waitpid(-1, &status, WNOHANG)) > 0){
-        exited_child_counter++;
-        
-        if(WIFEXITED(status)){
-            log_message("Child process %d exited with status %d", pid, WEXITSTATUS(status));
-        }else if (WIFSIGNALED(status)){
-            log_message("Child process %d terminated by signal %d", pid, WTERMSIG(status));
+    if(!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS){
+        atomic_fetch_add(&config.metrics->failures, 1);
+    }
+    if(WIFEXITED(status)){
+        log_message("%s (PID: %d) exited with status %d after %.3f ms", child->name, pid, WEXITSTATUS(status), elapsed_ms());
+    }else if (WIFSIGNALED(status)){
+        log_message("%s (PID: %d) terminated by signal %d", child->name, pid, WTERMSIG(status));
+    }
+
+    if(child->worker >= 0 && pool){
+        WorkerSlot *slot = &pool->workers[child->worker];
+        atomic_store(&slot->ready, 0);
+        atomic_store(&slot->busy_since_ns, 0);
+        atomic_store(&slot->output_blocked, 0);
+        int failed = !WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS;
+        if(failed && can_restart_workers()){
+            child->failures++;
+            if(child->failures <= WORKER_MAX_FAILURES){
+                uint64_t delay = pool_backoff_ns(child->failures);
+                child->restart_pending = 1;
+                child->restart_at_ns = monotonic_ns() + delay;
+                pending_restarts++;
+                log_message("%s: restarting in %llu ms (failure %d of %d)", child->name,
+                    (unsigned long long)(delay / 1000000), child->failures, WORKER_MAX_FAILURES);
+                return;
+            }
+            log_error("%s: failed %d times in a row, giving up on it", child->name, child->failures - 1);
         }
     }
+    close_links(child);
 }
 
-void sigusr1_handler(int sig){
-    (void)sig;
-    log_message("Received SIGUSR1 signal");
+// Restarting is pointless once nobody is left to read the results
+int can_restart_workers(){
+    return running && config.transport == TRANSPORT_RING && !children[num_children - 1].exited;
 }
 
-void sighup_handler(int sig){
-    (void)sig;
-    log_message("Received SIGHUP signal - reconfiguring");
-    
-    close(log_fd);
-    log_fd = open(LOG_FILE, O_WRONLY | O_CREAT | O_APPEND, 0644);
-    if(log_fd >= 0){
-        dup2(log_fd, STDOUT_FILENO);
-        dup2(log_fd, STDERR_FILENO);
-    }
-    log_message("Log file reopened after SIGHUP");
+void check_workers(){
+    uint64_t now = monotonic_ns();
+    for(int i = 0; i < num_children; i++){
+        Child *child = &children[i];
+        if(child->worker < 0){
+            continue;
+        }
+        WorkerSlot *slot = &pool->workers[child->worker];
+        if(child->restart_pending){
+            if(now < child->restart_at_ns){
+                continue;
+            }
+            child->restart_pending = 0;
+            pending_restarts--;
+            if(!can_restart_workers()){
+                close_links(child);
+                continue;
+            }
+            child->restarts++;
+            atomic_fetch_add(&config.metrics->restarts, 1);
+            child->batches_at_start = atomic_load(&slot->batches);
+            child->batches_seen = child->batches_at_start;
+            child->progress_ns = now;
+            start_child(child);
+            exited_child_counter--;
+            log_message("%s restarted with PID %d", child->name, child->pid);
+            continue;
+        }
+        if(child->exited){
+            continue;
+        }
+        // A worker is hung when it has work queued or in hand but finishes
+        // nothing, whether it spins in a batch or stopped between two. One
+        // held back by a full result ring is waiting on child 2, not hung.
+        uint64_t batches = atomic_load(&slot->batches);
+        int idle = (atomic_load(&slot->busy_since_ns) == 0 && !ring_pending(&input_rings[child->worker])) ||
+            atomic_load(&slot->output_blocked);
+        if(idle || batches != child->batches_seen || child->progress_ns == 0){
+            child->batches_seen = batches;
+            child->progress_ns = now;
+        }else if(now - child->progress_ns > (uint64_t)worker_timeout_ms * 1000000ULL){
+            log_message("%s (PID: %d) made no progress for more than %d ms. Killing it.", child->name, child->pid, worker_timeout_ms);
+            child->progress_ns = now;
+            atomic_fetch_add(&config.metrics->timeouts, 1);
+            kill(child->pid, SIGKILL);
+        }
+        if(child->failures > 0 && batches > child->batches_at_start){
+            child->failures = 0;
+        }
+    }
 }
 
-void sigterm_handler(int sig){
-    (void)sig;
-    log_message("Received SIGTERM signal - shutting down gracefully");
-    running = 0;
+void handle_signal(const struct signalfd_siginfo *info){
+    switch(info->ssi_signo){
+        case SIGCHLD:
+            for(int i = 0; i < num_children; i++){
+                if(children[i].pidfd < 0){
+                    reap_child(&children[i]);
+                }
+            }
+            logger_reap();
+            break;
+        case SIGUSR1:
+            log_message("Received SIGUSR1 signal - dumping metrics");
+            log_metrics();
+            break;
+        case SIGHUP:
+            log_message("Received SIGHUP signal - reconfiguring");
+            logger_reopen();
+            log_message("Log file reopened after SIGHUP");
+            break;
+        case SIGTERM:
+            // A stream is drained first: the writer sends its end marker and
+            // the children finish what is in flight. A second SIGTERM forces it.
+            if(config.streaming && !draining && !children[0].exited){
+                log_message("Received SIGTERM signal - draining the stream");
+                draining = 1;
+                kill(children[0].pid, SIGTERM);
+                break;
+            }
+            log_message("Received SIGTERM signal - shutting down gracefully");
+            running = 0;
+            break;
+    }
 }
 
 void cleanup(){
     log_message("Cleaning up resources");
-    
-    if(pid1 > 0){
-        kill(pid1, SIGTERM);
+
+    for(int i = 0; i < num_children; i++){
+        if(!children[i].exited){
+            kill(children[i].pid, SIGTERM);
+            waitpid(children[i].pid, NULL, 0);
+        }
+        if(children[i].pidfd >= 0){
+            close(children[i].pidfd);
+        }
     }
-    if(pid2 > 0){
-        kill(pid2, SIGTERM);
+
+    if(config.transport == TRANSPORT_RING){
+        for(int i = 0; i < config.workers; i++){
+            if(config.workers > 1){
+                log_message("%s handled %llu batches and was restarted %d times", children[i + 1].name,
+                    (unsigned long long)atomic_load(&pool->workers[i].batches), children[i + 1].restarts);
+            }
+            ring_destroy(&input_rings[i]);
+            ring_destroy(&result_rings[i]);
+        }
+        pool_shared_destroy(pool);
     }
-    if(pid_parent_write > 0){
-        kill(pid_parent_write, SIGTERM);
+    if(access(fifo1_path, F_OK) == 0){
+        unlink(fifo1_path);
     }
-    
-    if(access(FIFO1, F_OK) == 0){
-        unlink(FIFO1);
+    if(access(fifo2_path, F_OK) == 0){
+        unlink(fifo2_path);
     }
-    if(access(FIFO2, F_OK) == 0){
-        unlink(FIFO2);
+    if(stats_fd >= 0){
+        close(stats_fd);
+        unlink(stats_path);
     }
-    
+    metrics_destroy(config.metrics);
+
     log_message("Cleanup complete. Daemon exiting.");
 }
 
-void monitor_children(){
-    time_t current_time = time(NULL);
-    
-    if(pid1 > 0 && (current_time - child1_start_time) > PROCESS_TIMEOUT){
-        log_message("Child 1 (PID: %d) timed out after %d seconds. Terminating.", pid1, PROCESS_TIMEOUT);
-        kill(pid1, SIGTERM);
-        pid1 = -1;
-    }
-    
-    if(pid2 > 0 && (current_time - child2_start_time) > PROCESS_TIMEOUT){
-        log_message("Child 2 (PID: %d) timed out after %d seconds. Terminating.", pid2, PROCESS_TIMEOUT);
-        kill(pid2, SIGTERM);
-        pid2 = -1;
+size_t format_metrics(char *buffer, size_t size){
+    int ring = config.transport == TRANSPORT_RING;
+    return metrics_format(config.metrics, ring ? "ring1" : "fifo1", ring ? "ring2" : "fifo2", buffer, size);
+}
+
+// Same dump as the stats socket, one log line per metric
+void log_metrics(){
+    char dump[METRICS_DUMP_SIZE];
+    format_metrics(dump, sizeof(dump));
+    char *saveptr;
+    for(char *line = strtok_r(dump, "\n", &saveptr); line != NULL; line = strtok_r(NULL, "\n", &saveptr)){
+        log_message("metrics: %s", line);
     }
 }
 
-void log_message(const char *format, ...){
-    time_t now = time(NULL);
-    struct tm *tm_info = localtime(&now);
-    
-    char timestamp[26];
-    strftime(timestamp, sizeof(timestamp), "%Y-%m-%d %H:%M:%S", tm_info);
-    
-    dprintf(STDOUT_FILENO, "[%s] ", timestamp);
-    
-    va_list args;
-    va_start(args, format);
-    vdprintf(STDOUT_FILENO, format, args);
-    va_end(args);
-    
-    dprintf(STDOUT_FILENO, "\n");
+void monitor_children(){
+    for(int i = 0; i < num_children; i++){
+        if(!children[i].exited){
+            log_message("%s (PID: %d) timed out after %d seconds. Terminating.", children[i].name, children[i].pid, timeout_seconds);
+            atomic_fetch_add(&config.metrics->timeouts, 1);
+            kill(children[i].pid, SIGTERM);
+        }
+    }
 }
 
-void log_error(const char *format, ...){
-    time_t now = time(NULL);
-    struct tm *tm_info = localtime(&now);
-    
-    char timestamp[26];
-    strftime(timestamp, sizeof(timestamp), "%Y-%m-%d %H:%M:%S", tm_info);
-    
-    dprintf(STDERR_FILENO, "[%s] ERROR: ", timestamp);
-    
-    va_list args;
-    va_start(args, format);
-    vdprintf(STDERR_FILENO, format, args);
-    va_end(args);
-    
-    dprintf(STDERR_FILENO, "\n");
+double elapsed_ms(){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start_time.tv_sec) * 1e3 + (now.tv_nsec - start_time.tv_nsec) / 1e6;
 }
@@ -0,0 +1,138 @@
+#define _GNU_SOURCE
+#include "metrics.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+static const char *stage_names[STAGE_COUNT] = {"queue", "compute", "end_to_end"};
+
+static uint64_t now_ns(){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+Metrics *metrics_create(){
+    Metrics *metrics = mmap(NULL, sizeof(Metrics), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if(metrics == MAP_FAILED){
+        return NULL;
+    }
+    metrics->started_ns = now_ns();
+    return metrics;
+}
+
+void metrics_destroy(Metrics *metrics){
+    if(metrics){
+        munmap(metrics, sizeof(Metrics));
+    }
+}
+
+void metrics_count(StageCounters *counters, uint64_t pairs, uint64_t bytes){
+    atomic_fetch_add_explicit(&counters->pairs, pairs, memory_order_relaxed);
+    atomic_fetch_add_explicit(&counters->batches, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&counters->bytes, bytes, memory_order_relaxed);
+}
+
+void metrics_record(Metrics *metrics, MetricsStage stage, uint64_t value_ns){
+    AtomicHistogram *histogram = &metrics->stages[stage];
+    atomic_fetch_add_explicit(&histogram->counts[histogram_bucket(value_ns)], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&histogram->total, 1, memory_order_relaxed);
+    uint64_t max = atomic_load_explicit(&histogram->max, memory_order_relaxed);
+    while(value_ns > max && !atomic_compare_exchange_weak_explicit(&histogram->max, &max, value_ns, memory_order_relaxed, memory_order_relaxed)){
+    }
+}
+
+static void snapshot(const AtomicHistogram *shared, Histogram *histogram){
+    histogram->total = 0;
+    for(size_t i = 0; i < HISTOGRAM_BUCKETS; i++){
+        histogram->counts[i] = atomic_load_explicit(&shared->counts[i], memory_order_relaxed);
+        histogram->total += histogram->counts[i];
+    }
+    histogram->max = atomic_load_explicit(&shared->max, memory_order_relaxed);
+}
+
+static uint64_t load(const _Atomic uint64_t *counter){
+    return atomic_load_explicit(counter, memory_order_relaxed);
+}
+
+// One "name value" line per metric, latencies in microseconds
+size_t metrics_format(const Metrics *metrics, const char *link1, const char *link2, char *buffer, size_t size){
+    size_t length = 0;
+    // A line that does not fit ends the dump, the lines before it are kept whole
+    int full = size == 0;
+#define APPEND(...) \
+    do{ \
+        if(!full){ \
+            int written = snprintf(buffer + length, size - length, __VA_ARGS__); \
+            if(written < 0 || (size_t)written >= size - length){ \
+                buffer[length] = '\0'; \
+                full = 1; \
+            }else{ \
+                length += (size_t)written; \
+            } \
+        } \
+    }while(0)
+
+    APPEND("uptime_ms %llu\n", (unsigned long long)((now_ns() - metrics->started_ns) / 1000000));
+    APPEND("pairs_written %llu\n", (unsigned long long)load(&metrics->writer.pairs));
+    APPEND("pairs_computed %llu\n", (unsigned long long)load(&metrics->compute.pairs));
+    APPEND("pairs_aggregated %llu\n", (unsigned long long)load(&metrics->aggregate.pairs));
+    APPEND("batches_replayed %llu\n", (unsigned long long)load(&metrics->duplicates));
+    APPEND("%s_batches %llu\n", link1, (unsigned long long)load(&metrics->writer.batches));
+    APPEND("%s_bytes %llu\n", link1, (unsigned long long)load(&metrics->writer.bytes));
+    APPEND("%s_batches %llu\n", link2, (unsigned long long)load(&metrics->compute.batches));
+    APPEND("%s_bytes %llu\n", link2, (unsigned long long)load(&metrics->compute.bytes));
+    APPEND("child_failures %llu\n", (unsigned long long)load(&metrics->failures));
+    APPEND("worker_restarts %llu\n", (unsigned long long)load(&metrics->restarts));
+    APPEND("timeouts %llu\n", (unsigned long long)load(&metrics->timeouts));
+    Histogram histogram;
+    for(int stage = 0; stage < STAGE_COUNT; stage++){
+        snapshot(&metrics->stages[stage], &histogram);
+        APPEND("latency_%s_us count %llu p50 %.1f p99 %.1f p999 %.1f max %.1f\n", stage_names[stage],
+            (unsigned long long)histogram.total,
+            histogram_percentile(&histogram, 50) / 1e3, histogram_percentile(&histogram, 99) / 1e3,
+            histogram_percentile(&histogram, 99.9) / 1e3, histogram.max / 1e3);
+    }
+#undef APPEND
+    return length;
+}
+
+int metrics_listen(const char *path){
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if(strlen(path) >= sizeof(address.sun_path)){
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(address.sun_path, path);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(fd < 0){
+        return -1;
+    }
+    // A socket left behind by a daemon that was killed would fail the bind
+    unlink(path);
+    if(bind(fd, (struct sockaddr *)&address, sizeof(address)) == -1 || listen(fd, 16) == -1){
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Every pending client gets the dump and is disconnected. The dump is far
+// smaller than a socket buffer, so the write does not wait on the client.
+void metrics_serve(int listen_fd, const char *dump, size_t length){
+    for(;;){
+        int client = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if(client < 0){
+            return;
+        }
+        send(client, dump, length, MSG_NOSIGNAL);
+        close(client);
+    }
+}
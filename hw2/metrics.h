@@ -0,0 +1,56 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include "histogram.h"
+#ifndef METRICS_H
+#define METRICS_H
+
+#define METRICS_DUMP_SIZE 4096
+
+typedef enum{
+    STAGE_QUEUE,            // writer commit to a worker picking the batch up
+    STAGE_COMPUTE,          // a worker computing one batch
+    STAGE_END_TO_END,       // writer commit to child 2 aggregating the results
+    STAGE_COUNT
+} MetricsStage;
+
+// Same buckets as Histogram, but any process can record into it
+typedef struct{
+    _Atomic uint64_t counts[HISTOGRAM_BUCKETS];
+    _Atomic uint64_t total;
+    _Atomic uint64_t max;
+} AtomicHistogram;
+
+// What one stage pushed through its link. Each stage gets its own cache line.
+typedef struct{
+    _Alignas(64) _Atomic uint64_t pairs;
+    _Atomic uint64_t batches;
+    _Atomic uint64_t bytes;
+} StageCounters;
+
+/*
+ * Lives in shared memory mapped before the children are forked. Every
+ * update is a single relaxed atomic, readers take a snapshot that may be a
+ * few batches behind but never block the data path.
+ */
+typedef struct{
+    uint64_t started_ns;
+    StageCounters writer;   // into link 1
+    StageCounters compute;  // into link 2
+    StageCounters aggregate;
+    _Alignas(64) _Atomic uint64_t duplicates;
+    _Alignas(64) _Atomic uint64_t restarts;
+    _Atomic uint64_t timeouts;
+    _Atomic uint64_t failures;
+    AtomicHistogram stages[STAGE_COUNT];
+} Metrics;
+
+Metrics *metrics_create();
+void metrics_destroy(Metrics *metrics);
+void metrics_count(StageCounters *counters, uint64_t pairs, uint64_t bytes);
+void metrics_record(Metrics *metrics, MetricsStage stage, uint64_t value_ns);
+size_t metrics_format(const Metrics *metrics, const char *link1, const char *link2, char *buffer, size_t size);
+int metrics_listen(const char *path);
+void metrics_serve(int listen_fd, const char *dump, size_t length);
+
+#endif
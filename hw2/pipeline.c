@@ -0,0 +1,432 @@
+#define _GNU_SOURCE
+#include "pipeline.h"
+#include "histogram.h"
+#include "logger.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+static volatile sig_atomic_t stop_stream = 0;
+
+static void stop_stream_handler(int sig){
+    (void)sig;
+    stop_stream = 1;
+}
+
+static const char *link_name(const PipelineConfig *config, int link){
+    if(config->transport == TRANSPORT_RING){
+        return link == 1 ? "ring 1" : "ring 2";
+    }
+    return link == 1 ? "FIFO1" : "FIFO2";
+}
+
+uint64_t monotonic_ns(){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+// splitmix64: the state only advances by a constant and the output is a
+// mix of it, so the value at any index is reached without the ones before
+#define RANDOM_INCREMENT 0x9e3779b97f4a7c15ULL
+
+static uint64_t next_random(uint64_t *state){
+    uint64_t z = (*state += RANDOM_INCREMENT);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+static int send_end_marker(Channel *out, uint32_t sequence){
+    char *batch = channel_reserve(out, sizeof(BatchHeader));
+    if(batch == NULL){
+        return -1;
+    }
+    BatchHeader header;
+    memset(&header, 0, sizeof(header));
+    header.sequence = sequence;
+    header.sent_ns = monotonic_ns();
+    memcpy(batch, &header, sizeof(header));
+    channel_commit(out, sizeof(BatchHeader));
+    return channel_flush(out);
+}
+
+// Round robin over the workers, skipping any that is restarting or has no
+// room for the batch. When all of them are busy the writer blocks on the
+// next live one, which is what keeps it from running ahead of the pool.
+static int pick_output(Channel *outs, int count, const unsigned char *closed, PoolShared *pool, size_t size, int *next, uint64_t *stalls){
+    if(count == 1){
+        return closed[0] ? -1 : 0;
+    }
+    for(int pass = 0; pass < 3; pass++){
+        for(int i = 0; i < count; i++){
+            int index = (*next + i) % count;
+            if(closed[index]){
+                continue;
+            }
+            int ready = atomic_load(&pool->workers[index].ready);
+            if((pass == 0 && ready && channel_has_space(&outs[index], size)) || (pass == 1 && ready) || pass == 2){
+                if(pass > 0){
+                    (*stalls)++;
+                }
+                *next = (index + 1) % count;
+                return index;
+            }
+        }
+    }
+    return -1;
+}
+
+int stream_pairs(const PipelineConfig *config, Channel *outs, int count, PoolShared *pool){
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = stop_stream_handler;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGTERM, &sa, NULL);
+
+    size_t batch_pairs = config->streaming ? config->batch_pairs : 1;
+    unsigned char closed[MAX_WORKERS] = {0};
+    BatchHeader header;
+    uint64_t state = config->seed + config->skip * RANDOM_INCREMENT;
+    uint64_t sent = 0;
+    uint64_t stalls = 0;
+    uint32_t sequence = 0;
+    int next = 0;
+    int result = 0;
+
+    while(!stop_stream && (config->pairs == 0 || sent < config->pairs)){
+        size_t pairs = batch_pairs;
+        if(config->pairs != 0 && config->pairs - sent < pairs){
+            pairs = (size_t)(config->pairs - sent);
+        }
+        size_t size = sizeof(BatchHeader) + pairs * sizeof(PairRecord);
+        int index;
+        char *batch = NULL;
+        while(batch == NULL && (index = pick_output(outs, count, closed, pool, size, &next, &stalls)) >= 0){
+            batch = channel_reserve(&outs[index], size);
+            if(batch == NULL){
+                // The worker behind this link was given up on
+                log_error("Parent writer: dropping %s %d: %s", count > 1 ? "worker" : "link", index + 1, strerror(errno));
+                closed[index] = 1;
+            }
+        }
+        if(batch == NULL){
+            result = -1;
+            break;
+        }
+        PairRecord *records = (PairRecord *)(batch + sizeof(BatchHeader));
+        if(config->streaming){
+            for(size_t i = 0; i < pairs; i++){
+                uint64_t value = next_random(&state);
+                records[i].first = (int32_t)value;
+                records[i].second = (int32_t)(value >> 32);
+            }
+        }else{
+            records[0].first = config->num1;
+            records[0].second = config->num2;
+        }
+        header.count = (uint32_t)pairs;
+        header.sequence = sequence++;
+        header.sent_ns = monotonic_ns();
+        memcpy(batch, &header, sizeof(header));
+        channel_commit(&outs[index], size);
+        metrics_count(&config->metrics->writer, pairs, size);
+        if(channel_flush(&outs[index]) == -1){
+            result = -1;
+            break;
+        }
+        sent += pairs;
+    }
+
+    if(result == 0){
+        for(int i = 0; i < count; i++){
+            if(!closed[i] && send_end_marker(&outs[i], sequence) == -1 && count == 1){
+                result = -1;
+            }
+        }
+    }
+    if(config->streaming){
+        log_message("Parent writer: streamed %llu pairs in %u batches", (unsigned long long)sent, sequence);
+        if(count > 1){
+            log_message("Parent writer: blocked %llu times waiting for a worker with room", (unsigned long long)stalls);
+        }
+    }else{
+        log_message("Parent writer: sent values %d and %d to %s", config->num1, config->num2, link_name(config, 1));
+    }
+    return result;
+}
+
+// Over a FIFO, results are staged and only flushed once no complete batch
+// is left in the input, so a burst of input leaves in as few writes as
+// possible. Over a ring they are computed straight into the output ring, and
+// an input batch is only released once its results are published, so a
+// restarted worker picks up exactly where the previous one died.
+int compute_larger(const PipelineConfig *config, const char *name, Channel *in, Channel *out, WorkerSlot *slot){
+    uint64_t processed = 0;
+    BatchHeader header;
+    const void *data;
+    int status;
+    int result = 0;
+    // Bulk mode needs the larger values of a whole batch before windowing them
+    int32_t *scratch = NULL;
+    if(config->bulk_window){
+        scratch = malloc(MAX_BATCH_PAIRS * sizeof(int32_t));
+        if(scratch == NULL){
+            log_error("%s: Failed to allocate the bulk buffer", name);
+            return -1;
+        }
+    }
+
+    if(slot){
+        atomic_store(&slot->ready, 1);
+    }
+    while((status = channel_next(in, sizeof(PairRecord), &header, &data)) == 1){
+        const PairRecord *pairs = data;
+        uint32_t pair_count = header.count;
+        if(config->bulk_window){
+            header.count = (pair_count + config->bulk_window - 1) / config->bulk_window;
+        }
+        size_t size = sizeof(BatchHeader) + (size_t)header.count * (config->bulk_window ? sizeof(WindowResult) : sizeof(int32_t));
+        // Only this worker fills the result ring, so room seen here cannot go away
+        if(slot){
+            atomic_store(&slot->busy_since_ns, monotonic_ns());
+            atomic_store(&slot->output_blocked, !channel_has_space(out, size));
+        }
+        char *batch = channel_reserve(out, size);
+        if(slot){
+            atomic_store(&slot->output_blocked, 0);
+        }
+        if(batch == NULL){
+            result = -1;
+            break;
+        }
+        uint64_t started_ns = monotonic_ns();
+        metrics_record(config->metrics, STAGE_QUEUE, started_ns - header.sent_ns);
+        memcpy(batch, &header, sizeof(header));
+        int32_t *larger = (int32_t *)(batch + sizeof(BatchHeader));
+        if(config->bulk_window){
+            reduce_pair_max((const int32_t *)pairs, scratch, pair_count);
+            reduce_windows(scratch, pair_count, config->bulk_window, (WindowResult *)(batch + sizeof(BatchHeader)));
+        }else{
+            reduce_pair_max((const int32_t *)pairs, larger, pair_count);
+        }
+        channel_commit(out, size);
+        metrics_record(config->metrics, STAGE_COMPUTE, monotonic_ns() - started_ns);
+        metrics_count(&config->metrics->compute, pair_count, size);
+        if(slot){
+            atomic_store(&slot->busy_since_ns, 0);
+            atomic_fetch_add(&slot->batches, 1);
+        }
+        processed += pair_count;
+        if(!config->streaming){
+            log_message("%s: read integers %d and %d from %s", name, pairs[0].first, pairs[0].second, link_name(config, 1));
+            log_message("%s: %d is the larger number", name, larger[0]);
+        }
+        if(!channel_pending(in, sizeof(PairRecord)) && channel_flush(out) == -1){
+            result = -1;
+            break;
+        }
+    }
+    free(scratch);
+    if(status == -1){
+        log_error("%s: Error reading from %s: %s", name, link_name(config, 1), strerror(errno));
+        return -1;
+    }
+
+    if(result == 0){
+        result = send_end_marker(out, 0);
+    }
+    if(result == -1){
+        log_error("%s: Failed to write to %s: %s", name, link_name(config, 2), strerror(errno));
+        return -1;
+    }
+    log_message("%s: computed the larger value of %llu pairs", name, (unsigned long long)processed);
+    return 0;
+}
+
+static void report_progress(const char *label, uint64_t pairs, uint64_t elapsed_ns, const Histogram *latency){
+    double seconds = elapsed_ns / 1e9;
+    log_message("Child 2: %s %llu pairs in %.3f s (%.0f pairs/s), batch latency p50 %.1f us p99 %.1f us max %.1f us",
+        label, (unsigned long long)pairs, seconds, seconds > 0 ? pairs / seconds : 0.0,
+        histogram_percentile(latency, 50) / 1e3, histogram_percentile(latency, 99) / 1e3, latency->max / 1e3);
+}
+
+typedef struct{
+    const PipelineConfig *config;
+    Histogram latency;
+    uint64_t pairs;
+    uint64_t duplicates;
+    uint64_t first_sent_ns;
+    uint64_t next_progress_ns;
+    uint64_t windows;
+    int64_t sum;
+    int32_t maximum;
+    int32_t minimum;
+} Aggregate;
+
+static size_t result_size(const PipelineConfig *config){
+    return config->bulk_window ? sizeof(WindowResult) : sizeof(int32_t);
+}
+
+// Largest batch a worker publishes. With small windows it is larger than the
+// input batch it was computed from, a WindowResult being three times a pair.
+size_t result_batch_size(const PipelineConfig *config){
+    size_t count = config->streaming ? config->batch_pairs : 1;
+    if(config->bulk_window){
+        count = (count + config->bulk_window - 1) / config->bulk_window;
+    }
+    return sizeof(BatchHeader) + count * result_size(config);
+}
+
+static uint64_t aggregate_values(Aggregate *aggregate, const BatchHeader *header, const void *data){
+    if(aggregate->config->bulk_window){
+        const WindowResult *windows = data;
+        uint64_t pairs = 0;
+        for(uint32_t i = 0; i < header->count; i++){
+            aggregate->sum += windows[i].sum;
+            if(windows[i].max > aggregate->maximum){
+                aggregate->maximum = windows[i].max;
+            }
+            if(windows[i].min < aggregate->minimum){
+                aggregate->minimum = windows[i].min;
+            }
+            pairs += windows[i].count;
+        }
+        aggregate->windows += header->count;
+        return pairs;
+    }
+    const int32_t *larger = data;
+    for(uint32_t i = 0; i < header->count; i++){
+        aggregate->sum += larger[i];
+        if(larger[i] > aggregate->maximum){
+            aggregate->maximum = larger[i];
+        }
+    }
+    return header->count;
+}
+
+static void aggregate_batch(Aggregate *aggregate, const BatchHeader *header, const void *data){
+    uint64_t now = monotonic_ns();
+    if(aggregate->first_sent_ns == 0){
+        aggregate->first_sent_ns = header->sent_ns;
+        aggregate->next_progress_ns = now + PROGRESS_INTERVAL_NS;
+    }
+    histogram_record(&aggregate->latency, now - header->sent_ns);
+    metrics_record(aggregate->config->metrics, STAGE_END_TO_END, now - header->sent_ns);
+    uint64_t pairs = aggregate_values(aggregate, header, data);
+    metrics_count(&aggregate->config->metrics->aggregate, pairs, sizeof(BatchHeader) + header->count * result_size(aggregate->config));
+    aggregate->pairs += pairs;
+    if(!aggregate->config->streaming){
+        log_message("Child 2: The larger number is %d", *(const int32_t *)data);
+    }else if(now >= aggregate->next_progress_ns){
+        report_progress("processed", aggregate->pairs, now - aggregate->first_sent_ns, &aggregate->latency);
+        aggregate->next_progress_ns = now + PROGRESS_INTERVAL_NS;
+    }
+}
+
+// A worker that died after publishing a batch but before releasing its input
+// publishes that batch again once restarted. Per worker sequences stay
+// increasing, so such replays are recognised and dropped.
+static int is_replay(Aggregate *aggregate, const BatchHeader *header, uint32_t *last_sequence, unsigned char *seen){
+    if(*seen && (int32_t)(header->sequence - *last_sequence) <= 0){
+        aggregate->duplicates++;
+        atomic_fetch_add_explicit(&aggregate->config->metrics->duplicates, 1, memory_order_relaxed);
+        return 1;
+    }
+    *seen = 1;
+    *last_sequence = header->sequence;
+    return 0;
+}
+
+// Results of several workers are taken as they come
+static int aggregate_pool(Aggregate *aggregate, Channel *ins, int count, PoolShared *pool){
+    unsigned char done[MAX_WORKERS] = {0};
+    uint32_t last_sequence[MAX_WORKERS];
+    unsigned char seen[MAX_WORKERS] = {0};
+    Ring *waiting[MAX_WORKERS];
+    int remaining = count;
+    while(remaining > 0){
+        int progressed = 0;
+        for(int i = 0; i < count; i++){
+            if(done[i]){
+                continue;
+            }
+            BatchHeader header;
+            const void *data;
+            int status = channel_try_next(&ins[i], result_size(aggregate->config), &header, &data);
+            if(status == 1){
+                progressed = 1;
+                if(!is_replay(aggregate, &header, &last_sequence[i], &seen[i])){
+                    aggregate_batch(aggregate, &header, data);
+                }
+            }else if(status == 0){
+                done[i] = 1;
+                remaining--;
+            }else if(errno != EAGAIN){
+                return -1;
+            }
+        }
+        if(!progressed && remaining > 0){
+            int pending = 0;
+            for(int i = 0; i < count; i++){
+                if(!done[i]){
+                    waiting[pending++] = ins[i].ring;
+                }
+            }
+            ring_wait_any(waiting, pending, &pool->results);
+        }
+    }
+    return 0;
+}
+
+int aggregate_results(const PipelineConfig *config, Channel *ins, int count, PoolShared *pool){
+    Aggregate *aggregate = calloc(1, sizeof(Aggregate));
+    if(aggregate == NULL){
+        return -1;
+    }
+    aggregate->config = config;
+    aggregate->maximum = INT32_MIN;
+    aggregate->minimum = INT32_MAX;
+    int status = 0;
+    if(count > 1){
+        status = aggregate_pool(aggregate, ins, count, pool);
+    }else{
+        // A lone worker on a ring is restarted as well
+        BatchHeader header;
+        const void *data;
+        uint32_t last_sequence = 0;
+        unsigned char seen = 0;
+        while((status = channel_next(&ins[0], result_size(config), &header, &data)) == 1){
+            if(!is_replay(aggregate, &header, &last_sequence, &seen)){
+                aggregate_batch(aggregate, &header, data);
+            }
+        }
+    }
+    uint64_t finished_ns = monotonic_ns();
+    if(status == -1){
+        log_error("Child 2: Error reading from %s: %s", link_name(config, 2), strerror(errno));
+        free(aggregate);
+        return -1;
+    }
+
+    if(config->streaming){
+        report_progress("aggregated", aggregate->pairs, aggregate->pairs ? finished_ns - aggregate->first_sent_ns : 0, &aggregate->latency);
+        if(aggregate->pairs > 0){
+            log_message("Child 2: maximum %d, sum %lld", aggregate->maximum, (long long)aggregate->sum);
+        }
+        if(config->bulk_window && aggregate->windows > 0){
+            log_message("Child 2: reduced %llu windows of %u, minimum %d", (unsigned long long)aggregate->windows, config->bulk_window, aggregate->minimum);
+        }
+        if(aggregate->duplicates > 0){
+            log_message("Child 2: dropped %llu batches replayed by restarted workers", (unsigned long long)aggregate->duplicates);
+        }
+    }else{
+        log_message("Child 2: end-to-end latency %.1f us", aggregate->latency.max / 1e3);
+    }
+    free(aggregate);
+    return 0;
+}
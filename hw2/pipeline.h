@@ -0,0 +1,40 @@
+#include <stddef.h>
+#include <stdint.h>
+#include "channel.h"
+#include "pool.h"
+#include "metrics.h"
+#include "reduce.h"
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#define DEFAULT_BATCH_PAIRS 4096
+#define MAX_BATCH_PAIRS 65536
+#define PROGRESS_INTERVAL_NS 1000000000ULL
+
+typedef struct{
+    int32_t first;
+    int32_t second;
+} PairRecord;
+
+typedef struct{
+    int streaming;
+    uint64_t pairs;         // 0 streams until SIGTERM
+    uint32_t batch_pairs;
+    uint64_t seed;
+    uint64_t skip;          // pairs of the seeded sequence that belong to earlier shards
+    int32_t num1;
+    int32_t num2;
+    Transport transport;
+    int workers;
+    uint32_t bulk_window;   // 0 ships one larger value per pair, otherwise one WindowResult per window
+    Metrics *metrics;       // shared by all stages, set up before they are forked
+} PipelineConfig;
+
+uint64_t monotonic_ns();
+size_t result_batch_size(const PipelineConfig *config);
+
+int stream_pairs(const PipelineConfig *config, Channel *outs, int count, PoolShared *pool);
+int compute_larger(const PipelineConfig *config, const char *name, Channel *in, Channel *out, WorkerSlot *slot);
+int aggregate_results(const PipelineConfig *config, Channel *ins, int count, PoolShared *pool);
+
+#endif
@@ -0,0 +1,27 @@
+#define _GNU_SOURCE
+#include "pool.h"
+#include <sys/mman.h>
+
+// Anonymous shared memory survives fork, so every restarted worker sees it too
+PoolShared *pool_shared_create(){
+    void *memory = mmap(NULL, sizeof(PoolShared), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    return memory == MAP_FAILED ? NULL : memory;
+}
+
+void pool_shared_destroy(PoolShared *pool){
+    if(pool){
+        munmap(pool, sizeof(PoolShared));
+    }
+}
+
+// Doubles with every consecutive failure of the same worker
+uint64_t pool_backoff_ns(int failures){
+    uint64_t delay_ms = WORKER_BACKOFF_MS;
+    for(int i = 1; i < failures && delay_ms < WORKER_BACKOFF_MAX_MS; i++){
+        delay_ms *= 2;
+    }
+    if(delay_ms > WORKER_BACKOFF_MAX_MS){
+        delay_ms = WORKER_BACKOFF_MAX_MS;
+    }
+    return delay_ms * 1000000ULL;
+}
@@ -0,0 +1,32 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include "ring.h"
+#ifndef POOL_H
+#define POOL_H
+
+#define MAX_WORKERS 64
+#define WORKER_TIMEOUT_MS 5000
+#define WORKER_MAX_FAILURES 5
+#define WORKER_BACKOFF_MS 100
+#define WORKER_BACKOFF_MAX_MS 5000
+#define POOL_TICK_MS 50
+
+// Written by a worker, read by the supervisor and the writer
+typedef struct{
+    _Atomic uint32_t ready;            // cleared by the supervisor once the worker is gone
+    _Atomic uint64_t busy_since_ns;    // 0 unless a batch is in hand
+    _Atomic uint32_t output_blocked;   // waiting for room in the result ring, not hung
+    _Atomic uint64_t batches;
+} WorkerSlot;
+
+typedef struct{
+    RingWait results;                  // the aggregator sleeps here until any worker publishes
+    WorkerSlot workers[MAX_WORKERS];
+} PoolShared;
+
+PoolShared *pool_shared_create();
+void pool_shared_destroy(PoolShared *pool);
+uint64_t pool_backoff_ns(int failures);
+
+#endif
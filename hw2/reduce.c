@@ -0,0 +1,260 @@
+#define _GNU_SOURCE
+#include "reduce.h"
+#include <string.h>
+#include <pthread.h>
+#include <immintrin.h>
+
+typedef void (*PairMaxKernel)(const int32_t *pairs, int32_t *larger, size_t count);
+typedef void (*SpanKernel)(const int32_t *values, size_t count, WindowResult *result);
+
+typedef struct{
+    const int32_t *input;
+    int32_t *larger;
+    WindowResult *results;
+    size_t count;
+    size_t window;
+} ReduceJob;
+
+static void pair_max_scalar(const int32_t *pairs, int32_t *larger, size_t count){
+    for(size_t i = 0; i < count; i++){
+        larger[i] = pairs[2 * i] > pairs[2 * i + 1] ? pairs[2 * i] : pairs[2 * i + 1];
+    }
+}
+
+static void span_scalar(const int32_t *values, size_t count, WindowResult *result){
+    for(size_t i = 0; i < count; i++){
+        result->sum += values[i];
+        if(values[i] > result->max){
+            result->max = values[i];
+        }
+        if(values[i] < result->min){
+            result->min = values[i];
+        }
+    }
+    result->count += count;
+}
+
+// Pairs arrive interleaved, the shuffles split first and second values
+// into their own registers before a single max.
+__attribute__((target("sse4.1")))
+static void pair_max_sse41(const int32_t *pairs, int32_t *larger, size_t count){
+    size_t i = 0;
+    for(; i + 4 <= count; i += 4){
+        __m128 low = _mm_loadu_ps((const float *)(pairs + 2 * i));
+        __m128 high = _mm_loadu_ps((const float *)(pairs + 2 * i + 4));
+        __m128i first = _mm_castps_si128(_mm_shuffle_ps(low, high, _MM_SHUFFLE(2, 0, 2, 0)));
+        __m128i second = _mm_castps_si128(_mm_shuffle_ps(low, high, _MM_SHUFFLE(3, 1, 3, 1)));
+        _mm_storeu_si128((__m128i *)(larger + i), _mm_max_epi32(first, second));
+    }
+    pair_max_scalar(pairs + 2 * i, larger + i, count - i);
+}
+
+__attribute__((target("sse4.1")))
+static void span_sse41(const int32_t *values, size_t count, WindowResult *result){
+    __m128i max = _mm_set1_epi32(INT32_MIN);
+    __m128i min = _mm_set1_epi32(INT32_MAX);
+    __m128i sum = _mm_setzero_si128();
+    size_t i = 0;
+    for(; i + 4 <= count; i += 4){
+        __m128i v = _mm_loadu_si128((const __m128i *)(values + i));
+        max = _mm_max_epi32(max, v);
+        min = _mm_min_epi32(min, v);
+        sum = _mm_add_epi64(sum, _mm_cvtepi32_epi64(v));
+        sum = _mm_add_epi64(sum, _mm_cvtepi32_epi64(_mm_srli_si128(v, 8)));
+    }
+    int32_t maxes[4], mins[4];
+    int64_t sums[2];
+    _mm_storeu_si128((__m128i *)maxes, max);
+    _mm_storeu_si128((__m128i *)mins, min);
+    _mm_storeu_si128((__m128i *)sums, sum);
+    for(int lane = 0; lane < 4; lane++){
+        if(maxes[lane] > result->max){
+            result->max = maxes[lane];
+        }
+        if(mins[lane] < result->min){
+            result->min = mins[lane];
+        }
+    }
+    result->sum += sums[0] + sums[1];
+    result->count += i;
+    span_scalar(values + i, count - i, result);
+}
+
+__attribute__((target("avx2")))
+static void pair_max_avx2(const int32_t *pairs, int32_t *larger, size_t count){
+    size_t i = 0;
+    for(; i + 8 <= count; i += 8){
+        __m256 low = _mm256_loadu_ps((const float *)(pairs + 2 * i));
+        __m256 high = _mm256_loadu_ps((const float *)(pairs + 2 * i + 8));
+        __m256i first = _mm256_castps_si256(_mm256_shuffle_ps(low, high, _MM_SHUFFLE(2, 0, 2, 0)));
+        __m256i second = _mm256_castps_si256(_mm256_shuffle_ps(low, high, _MM_SHUFFLE(3, 1, 3, 1)));
+        // The shuffles stay within 128-bit lanes, which leaves the results
+        // as pairs 0-1, 4-5, 2-3, 6-7
+        __m256i result = _mm256_permute4x64_epi64(_mm256_max_epi32(first, second), _MM_SHUFFLE(3, 1, 2, 0));
+        _mm256_storeu_si256((__m256i *)(larger + i), result);
+    }
+    pair_max_scalar(pairs + 2 * i, larger + i, count - i);
+}
+
+__attribute__((target("avx2")))
+static void span_avx2(const int32_t *values, size_t count, WindowResult *result){
+    __m256i max = _mm256_set1_epi32(INT32_MIN);
+    __m256i min = _mm256_set1_epi32(INT32_MAX);
+    __m256i sum = _mm256_setzero_si256();
+    size_t i = 0;
+    for(; i + 8 <= count; i += 8){
+        __m256i v = _mm256_loadu_si256((const __m256i *)(values + i));
+        max = _mm256_max_epi32(max, v);
+        min = _mm256_min_epi32(min, v);
+        sum = _mm256_add_epi64(sum, _mm256_cvtepi32_epi64(_mm256_castsi256_si128(v)));
+        sum = _mm256_add_epi64(sum, _mm256_cvtepi32_epi64(_mm256_extracti128_si256(v, 1)));
+    }
+    int32_t maxes[8], mins[8];
+    int64_t sums[4];
+    _mm256_storeu_si256((__m256i *)maxes, max);
+    _mm256_storeu_si256((__m256i *)mins, min);
+    _mm256_storeu_si256((__m256i *)sums, sum);
+    for(int lane = 0; lane < 8; lane++){
+        if(maxes[lane] > result->max){
+            result->max = maxes[lane];
+        }
+        if(mins[lane] < result->min){
+            result->min = mins[lane];
+        }
+    }
+    result->sum += sums[0] + sums[1] + sums[2] + sums[3];
+    result->count += i;
+    span_scalar(values + i, count - i, result);
+}
+
+static PairMaxKernel pair_max = pair_max_scalar;
+static SpanKernel span = span_scalar;
+static const char *kernel_name = "scalar";
+static int thread_count = 1;
+
+// kernel is "auto" or NULL for the widest one the CPU supports, a named
+// kernel the CPU lacks is an error rather than a silent fallback.
+int reduce_init(const char *kernel, int threads){
+    if(threads < 1 || threads > REDUCE_MAX_THREADS){
+        return -1;
+    }
+    thread_count = threads;
+    __builtin_cpu_init();
+    int automatic = kernel == NULL || strcmp(kernel, "auto") == 0;
+    if((automatic || strcmp(kernel, "avx2") == 0) && __builtin_cpu_supports("avx2")){
+        pair_max = pair_max_avx2;
+        span = span_avx2;
+        kernel_name = "avx2";
+    }else if((automatic || strcmp(kernel, "sse4.1") == 0) && __builtin_cpu_supports("sse4.1")){
+        pair_max = pair_max_sse41;
+        span = span_sse41;
+        kernel_name = "sse4.1";
+    }else if(automatic || strcmp(kernel, "scalar") == 0){
+        pair_max = pair_max_scalar;
+        span = span_scalar;
+        kernel_name = "scalar";
+    }else{
+        return -1;
+    }
+    return 0;
+}
+
+const char *reduce_kernel_name(){
+    return kernel_name;
+}
+
+int reduce_threads(){
+    return thread_count;
+}
+
+static void *pair_max_job(void *arg){
+    ReduceJob *job = arg;
+    pair_max(job->input, job->larger, job->count);
+    return NULL;
+}
+
+static void *windows_job(void *arg){
+    ReduceJob *job = arg;
+    for(size_t start = 0, w = 0; start < job->count; start += job->window, w++){
+        WindowResult *result = &job->results[w];
+        result->sum = 0;
+        result->max = INT32_MIN;
+        result->min = INT32_MAX;
+        result->count = 0;
+        size_t length = job->count - start < job->window ? job->count - start : job->window;
+        span(job->input + start, length, result);
+    }
+    return NULL;
+}
+
+// The first job runs on the calling thread, a thread that cannot be
+// started leaves its job to the caller as well.
+static void run_jobs(void *(*body)(void *), ReduceJob *jobs, int count){
+    pthread_t threads[REDUCE_MAX_THREADS];
+    int started[REDUCE_MAX_THREADS] = {0};
+    for(int i = 1; i < count; i++){
+        started[i] = pthread_create(&threads[i], NULL, body, &jobs[i]) == 0;
+    }
+    body(&jobs[0]);
+    for(int i = 1; i < count; i++){
+        if(started[i]){
+            pthread_join(threads[i], NULL);
+        }else{
+            body(&jobs[i]);
+        }
+    }
+}
+
+static int jobs_for(size_t count){
+    if(thread_count == 1 || count < REDUCE_PARALLEL_MIN){
+        return 1;
+    }
+    size_t jobs = count / (REDUCE_PARALLEL_MIN / 2);
+    return jobs < (size_t)thread_count ? (int)jobs : thread_count;
+}
+
+// larger[i] is the larger of pairs[2 * i] and pairs[2 * i + 1]
+void reduce_pair_max(const int32_t *pairs, int32_t *larger, size_t count){
+    int jobs = jobs_for(count);
+    if(jobs == 1){
+        pair_max(pairs, larger, count);
+        return;
+    }
+    ReduceJob work[REDUCE_MAX_THREADS];
+    size_t chunk = (count + (size_t)jobs - 1) / (size_t)jobs;
+    for(int i = 0; i < jobs; i++){
+        size_t start = (size_t)i * chunk < count ? (size_t)i * chunk : count;
+        work[i].input = pairs + 2 * start;
+        work[i].larger = larger + start;
+        work[i].count = count - start < chunk ? count - start : chunk;
+    }
+    run_jobs(pair_max_job, work, jobs);
+}
+
+// Max, min and sum of every window of values, the last one may be shorter.
+// Returns the number of windows written.
+size_t reduce_windows(const int32_t *values, size_t count, size_t window, WindowResult *results){
+    size_t windows = (count + window - 1) / window;
+    int jobs = jobs_for(count);
+    if((size_t)jobs > windows){
+        jobs = windows > 0 ? (int)windows : 1;
+    }
+    ReduceJob work[REDUCE_MAX_THREADS];
+    // Whole windows per job, so no window is split between two threads
+    size_t per_job = (windows + (size_t)jobs - 1) / (size_t)jobs;
+    for(int i = 0; i < jobs; i++){
+        size_t first = (size_t)i * per_job < windows ? (size_t)i * per_job : windows;
+        size_t start = first * window < count ? first * window : count;
+        size_t end = (first + per_job) * window < count ? (first + per_job) * window : count;
+        work[i].input = values + start;
+        work[i].results = results + first;
+        work[i].count = end - start;
+        work[i].window = window;
+    }
+    if(jobs == 1){
+        windows_job(&work[0]);
+    }else{
+        run_jobs(windows_job, work, jobs);
+    }
+    return windows;
+}
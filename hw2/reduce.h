@@ -0,0 +1,23 @@
+#include <stddef.h>
+#include <stdint.h>
+#ifndef REDUCE_H
+#define REDUCE_H
+
+#define REDUCE_PARALLEL_MIN 32768   // smaller blocks are not worth a thread
+#define REDUCE_MAX_THREADS 16
+
+// Reduction of one window of the larger values, the unit child 2 gets in bulk mode
+typedef struct{
+    int64_t sum;
+    int32_t max;
+    int32_t min;
+    uint64_t count;
+} WindowResult;
+
+int reduce_init(const char *kernel, int threads);
+const char *reduce_kernel_name();
+int reduce_threads();
+void reduce_pair_max(const int32_t *pairs, int32_t *larger, size_t count);
+size_t reduce_windows(const int32_t *values, size_t count, size_t window, WindowResult *results);
+
+#endif
@@ -0,0 +1,93 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "reduce.h"
+
+// Checks every SIMD kernel the CPU supports against the scalar one, on sizes
+// around the 4 and 8 lane tails, with and without worker threads. Exits
+// non-zero on the first kind of mismatch so `make test` fails.
+
+#define MAX_PAIRS 100003
+
+const char *kernels[] = {"sse4.1", "avx2"};
+const int thread_counts[] = {1, 4};
+const size_t windows[] = {1, 5, 8, 4096};
+// Tails of 0 to 9 past a multiple of 4 and 8, then sizes past REDUCE_PARALLEL_MIN
+const size_t sizes[] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 11, 12, 13, 15, 16, 17, 31, 32, 33,
+    1000, 4095, 4096, 4097, REDUCE_PARALLEL_MIN, REDUCE_PARALLEL_MIN + 3, 65536, MAX_PAIRS};
+
+int32_t pairs[2 * MAX_PAIRS];
+int32_t expected_larger[MAX_PAIRS];
+int32_t larger[MAX_PAIRS];
+WindowResult expected_windows[MAX_PAIRS];
+WindowResult results[MAX_PAIRS];
+
+void fill_pairs(uint64_t seed);
+int check_kernel(const char *kernel, int threads);
+
+int main(){
+    fill_pairs(0x9e3779b97f4a7c15ULL);
+    int failures = 0;
+    int tested = 0;
+    for(size_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++){
+        for(size_t t = 0; t < sizeof(thread_counts) / sizeof(thread_counts[0]); t++){
+            if(reduce_init(kernels[k], thread_counts[t]) == -1){
+                printf("%-7s %d thread(s): not supported by this CPU, skipped\n", kernels[k], thread_counts[t]);
+                continue;
+            }
+            int mismatches = check_kernel(kernels[k], thread_counts[t]);
+            printf("%-7s %d thread(s): %s\n", kernels[k], thread_counts[t], mismatches ? "FAILED" : "ok");
+            failures += mismatches;
+            tested++;
+        }
+    }
+    printf("%d configuration(s) tested, %d mismatch(es)\n", tested, failures);
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+// Random values with the extremes planted where lanes and tails meet, so
+// signed comparisons and 64-bit sums are exercised
+void fill_pairs(uint64_t seed){
+    uint64_t state = seed;
+    for(size_t i = 0; i < 2 * MAX_PAIRS; i++){
+        state ^= state >> 12;
+        state ^= state << 25;
+        state ^= state >> 27;
+        pairs[i] = (int32_t)((state * 0x2545f4914f6cdd1dULL) >> 32);
+    }
+    for(size_t i = 0; i < 2 * MAX_PAIRS; i += 7){
+        pairs[i] = i % 2 ? INT32_MAX : INT32_MIN;
+    }
+    pairs[0] = INT32_MIN;
+    pairs[1] = INT32_MIN;
+}
+
+// The reference is the scalar kernel on the calling thread alone, so both the
+// kernel and the split between threads are checked
+int check_kernel(const char *kernel, int threads){
+    int mismatches = 0;
+    for(size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++){
+        size_t count = sizes[s];
+        reduce_init("scalar", 1);
+        reduce_pair_max(pairs, expected_larger, count);
+        reduce_init(kernel, threads);
+        memset(larger, 0, sizeof(larger));
+        reduce_pair_max(pairs, larger, count);
+        if(memcmp(expected_larger, larger, count * sizeof(int32_t)) != 0){
+            printf("  pair max differs for %zu pairs\n", count);
+            mismatches++;
+        }
+        for(size_t w = 0; w < sizeof(windows) / sizeof(windows[0]); w++){
+            reduce_init("scalar", 1);
+            size_t expected_count = reduce_windows(expected_larger, count, windows[w], expected_windows);
+            reduce_init(kernel, threads);
+            memset(results, 0, sizeof(results));
+            size_t result_count = reduce_windows(expected_larger, count, windows[w], results);
+            if(result_count != expected_count || memcmp(expected_windows, results, result_count * sizeof(WindowResult)) != 0){
+                printf("  windows of %zu differ for %zu values\n", windows[w], count);
+                mismatches++;
+            }
+        }
+    }
+    return mismatches;
+}
@@ -0,0 +1,276 @@
+#define _GNU_SOURCE
+#include "ring.h"
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#define RING_ALIGN 8
+#define RING_PREFIX sizeof(uint64_t)
+
+static size_t round_up(size_t size){
+    return (size + RING_ALIGN - 1) & ~(size_t)(RING_ALIGN - 1);
+}
+
+static void cpu_relax(){
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+// The mapping is shared between processes, so the futexes must not be private
+static void futex_wait(_Atomic uint32_t *word, uint32_t expected){
+    syscall(SYS_futex, word, FUTEX_WAIT, expected, NULL, NULL, 0);
+}
+
+static void futex_wake(_Atomic uint32_t *word, int count){
+    syscall(SYS_futex, word, FUTEX_WAKE, count, NULL, NULL, 0);
+}
+
+int ring_create(Ring *ring, const char *name, size_t capacity){
+    memset(ring, 0, sizeof(Ring));
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t header = (sizeof(RingShared) + page - 1) / page * page;
+    ring->capacity = 1;
+    while(ring->capacity < capacity){
+        ring->capacity *= 2;
+    }
+    ring->mapped_size = header + ring->capacity;
+    // Spinning only pays off when the peer can run at the same time
+    ring->spin_limit = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? RING_SPIN_LIMIT : 0;
+    ring->fd = memfd_create(name, MFD_CLOEXEC);
+    if(ring->fd < 0){
+        return -1;
+    }
+    if(ftruncate(ring->fd, (off_t)ring->mapped_size) == -1){
+        close(ring->fd);
+        return -1;
+    }
+    void *memory = mmap(NULL, ring->mapped_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, 0);
+    if(memory == MAP_FAILED){
+        close(ring->fd);
+        return -1;
+    }
+    ring->shared = memory;
+    ring->data_wait = &ring->shared->data;
+    ring->data = (char *)memory + header;
+    return 0;
+}
+
+void ring_destroy(Ring *ring){
+    if(ring->shared){
+        munmap(ring->shared, ring->mapped_size);
+        ring->shared = NULL;
+    }
+    if(ring->fd >= 0){
+        close(ring->fd);
+        ring->fd = -1;
+    }
+}
+
+// Marks the ring dead so that a peer blocked on it gives up, data already
+// published can still be drained by the consumer.
+void ring_close(Ring *ring){
+    RingShared *shared = ring->shared;
+    atomic_store(&shared->closed, 1);
+    atomic_fetch_add(&ring->data_wait->signal, 1);
+    futex_wake(&ring->data_wait->signal, INT32_MAX);
+    atomic_fetch_add(&shared->space.signal, 1);
+    futex_wake(&shared->space.signal, INT32_MAX);
+}
+
+// Only the first publish after the other side went to sleep pays for a wake
+static void notify(RingWait *wait){
+    if(atomic_load_explicit(&wait->waiting, memory_order_relaxed) && atomic_exchange(&wait->waiting, 0)){
+        atomic_fetch_add(&wait->signal, 1);
+        futex_wake(&wait->signal, 1);
+    }
+}
+
+static void publish_head(Ring *ring, uint64_t head){
+    atomic_store(&ring->shared->head, head);
+    notify(ring->data_wait);
+}
+
+static void publish_tail(Ring *ring, uint64_t tail){
+    atomic_store(&ring->shared->tail, tail);
+    notify(&ring->shared->space);
+}
+
+static int has_space(const Ring *ring, uint64_t head, size_t needed){
+    uint64_t tail = atomic_load_explicit(&ring->shared->tail, memory_order_acquire);
+    return ring->capacity - (head - tail) >= needed;
+}
+
+static int wait_for_space(Ring *ring, uint64_t head, size_t needed){
+    RingShared *shared = ring->shared;
+    for(int spins = 0;; spins++){
+        if(atomic_load_explicit(&shared->closed, memory_order_acquire)){
+            errno = EPIPE;
+            return -1;
+        }
+        if(has_space(ring, head, needed)){
+            return 0;
+        }
+        if(spins < ring->spin_limit){
+            cpu_relax();
+            continue;
+        }
+        // Announce the wait, then check again so a release that raced with
+        // the announcement is not missed.
+        uint32_t signal = atomic_load(&shared->space.signal);
+        atomic_store(&shared->space.waiting, 1);
+        if(!has_space(ring, head, needed) && !atomic_load(&shared->closed)){
+            futex_wait(&shared->space.signal, signal);
+        }
+        atomic_store(&shared->space.waiting, 0);
+    }
+}
+
+static size_t message_size(size_t size){
+    return RING_PREFIX + round_up(size);
+}
+
+// Whether a message of size bytes could be reserved without blocking
+int ring_has_space(const Ring *ring, size_t size){
+    uint64_t head = atomic_load_explicit(&ring->shared->head, memory_order_relaxed);
+    size_t offset = head & (ring->capacity - 1);
+    size_t to_end = ring->capacity - offset;
+    size_t needed = message_size(size);
+    return has_space(ring, head, to_end < needed ? to_end + needed : needed);
+}
+
+// Returns room for size bytes that stays valid until ring_commit, blocking
+// while the ring is full. NULL means the consumer is gone.
+void *ring_reserve(Ring *ring, size_t size){
+    RingShared *shared = ring->shared;
+    size_t needed = message_size(size);
+    if(needed > ring->capacity){
+        errno = EMSGSIZE;
+        return NULL;
+    }
+    uint64_t head = atomic_load_explicit(&shared->head, memory_order_relaxed);
+    size_t offset = head & (ring->capacity - 1);
+    size_t to_end = ring->capacity - offset;
+    if(to_end < needed){
+        if(wait_for_space(ring, head, to_end) == -1){
+            return NULL;
+        }
+        uint64_t skip = RING_SKIP;
+        memcpy(ring->data + offset, &skip, sizeof(skip));
+        head += to_end;
+        publish_head(ring, head);
+        offset = 0;
+    }
+    if(wait_for_space(ring, head, needed) == -1){
+        return NULL;
+    }
+    uint64_t length = size;
+    memcpy(ring->data + offset, &length, sizeof(length));
+    ring->reserved = needed;
+    return ring->data + offset + RING_PREFIX;
+}
+
+void ring_commit(Ring *ring){
+    uint64_t head = atomic_load_explicit(&ring->shared->head, memory_order_relaxed);
+    publish_head(ring, head + ring->reserved);
+    ring->reserved = 0;
+}
+
+// Releases the message handed out last and returns the next one, NULL when
+// nothing is published right now.
+const void *ring_try_next(Ring *ring, size_t *size){
+    RingShared *shared = ring->shared;
+    uint64_t tail = atomic_load_explicit(&shared->tail, memory_order_relaxed);
+    if(ring->consumed){
+        tail += ring->consumed;
+        publish_tail(ring, tail);
+        ring->consumed = 0;
+    }
+    while(atomic_load_explicit(&shared->head, memory_order_acquire) != tail){
+        size_t offset = tail & (ring->capacity - 1);
+        uint64_t length;
+        memcpy(&length, ring->data + offset, sizeof(length));
+        if(length == RING_SKIP){
+            tail += ring->capacity - offset;
+            publish_tail(ring, tail);
+            continue;
+        }
+        ring->consumed = message_size((size_t)length);
+        *size = (size_t)length;
+        return ring->data + offset + RING_PREFIX;
+    }
+    return NULL;
+}
+
+// Whether the ring is closed and everything published on it was consumed
+int ring_drained(const Ring *ring){
+    RingShared *shared = ring->shared;
+    if(!atomic_load_explicit(&shared->closed, memory_order_acquire)){
+        return 0;
+    }
+    uint64_t tail = atomic_load_explicit(&shared->tail, memory_order_relaxed) + ring->consumed;
+    return atomic_load_explicit(&shared->head, memory_order_acquire) == tail;
+}
+
+// Lets a consumer of several rings sleep on one futex that any of them wakes.
+// Must be set up before the producers are forked.
+void ring_share_data_wait(Ring *ring, RingWait *wait){
+    ring->data_wait = wait;
+}
+
+static int any_ready(Ring *const *rings, int count){
+    for(int i = 0; i < count; i++){
+        if(ring_pending(rings[i]) || atomic_load(&rings[i]->shared->closed)){
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Blocks until one of the rings has something published or is closed
+void ring_wait_any(Ring *const *rings, int count, RingWait *wait){
+    int spin_limit = count > 0 ? rings[0]->spin_limit : 0;
+    for(int spins = 0; spins < spin_limit; spins++){
+        if(any_ready(rings, count)){
+            return;
+        }
+        cpu_relax();
+    }
+    uint32_t signal = atomic_load(&wait->signal);
+    atomic_store(&wait->waiting, 1);
+    if(!any_ready(rings, count)){
+        futex_wait(&wait->signal, signal);
+    }
+    atomic_store(&wait->waiting, 0);
+}
+
+// Blocking form of ring_try_next. NULL once the ring is closed and
+// everything published before has been consumed.
+const void *ring_next(Ring *ring, size_t *size){
+    Ring *rings[1] = {ring};
+    for(int spins = 0;; spins++){
+        const void *message = ring_try_next(ring, size);
+        if(message != NULL){
+            return message;
+        }
+        if(atomic_load_explicit(&ring->shared->closed, memory_order_acquire)){
+            // A message may have been published right before the close
+            return ring_try_next(ring, size);
+        }
+        if(spins < ring->spin_limit){
+            cpu_relax();
+            continue;
+        }
+        ring_wait_any(rings, 1, ring->data_wait);
+    }
+}
+
+// Whether a message beyond the one currently handed out is already published
+int ring_pending(const Ring *ring){
+    RingShared *shared = ring->shared;
+    uint64_t tail = atomic_load_explicit(&shared->tail, memory_order_relaxed) + ring->consumed;
+    return atomic_load_explicit(&shared->head, memory_order_acquire) != tail;
+}
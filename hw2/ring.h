@@ -0,0 +1,57 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#ifndef RING_H
+#define RING_H
+
+#define RING_DEFAULT_CAPACITY (4 * 1024 * 1024)
+#define RING_MIN_CAPACITY (1024 * 1024)
+#define RING_SPIN_LIMIT 256
+#define RING_SKIP UINT64_MAX
+
+/*
+ * Single producer / single consumer message ring living in a memfd that is
+ * mapped before fork. Every message is a u64 length followed by the payload,
+ * padded to 8 bytes and never split across the end of the ring. Both sides
+ * only enter the kernel through a futex when the ring is empty or full and
+ * the other side has announced that it is waiting.
+ */
+typedef struct{
+    _Atomic uint32_t waiting;
+    _Atomic uint32_t signal;
+} RingWait;
+
+typedef struct{
+    _Alignas(64) _Atomic uint64_t head;
+    RingWait space;
+    _Alignas(64) _Atomic uint64_t tail;
+    RingWait data;
+    _Alignas(64) _Atomic uint32_t closed;
+} RingShared;
+
+typedef struct{
+    RingShared *shared;
+    RingWait *data_wait;    // shared->data unless the consumer waits on several rings
+    char *data;
+    size_t capacity;
+    size_t mapped_size;
+    int fd;
+    size_t reserved;    // producer: size of the message being written
+    size_t consumed;    // consumer: size of the message handed out last
+    int spin_limit;
+} Ring;
+
+int ring_create(Ring *ring, const char *name, size_t capacity);
+void ring_destroy(Ring *ring);
+void *ring_reserve(Ring *ring, size_t size);
+void ring_commit(Ring *ring);
+const void *ring_next(Ring *ring, size_t *size);
+const void *ring_try_next(Ring *ring, size_t *size);
+int ring_pending(const Ring *ring);
+int ring_has_space(const Ring *ring, size_t size);
+int ring_drained(const Ring *ring);
+void ring_share_data_wait(Ring *ring, RingWait *wait);
+void ring_wait_any(Ring *const *rings, int count, RingWait *wait);
+void ring_close(Ring *ring);
+
+#endif
@@ -0,0 +1,17 @@
+#include <stddef.h>
+#ifndef RUNTIME_H
+#define RUNTIME_H
+
+// Everything an instance creates on the file system lives in one runtime
+// directory. Without --instance or --runtime-dir it is /tmp, as it always was.
+#define RUNTIME_DIR "/tmp"
+#define INSTANCE_DIR_FORMAT "/tmp/daemon.%s"
+#define RUNTIME_PATH_SIZE 256
+
+#define FIFO1_NAME "fifo1"
+#define FIFO2_NAME "fifo2"
+#define LOG_NAME "daemon_log.txt"
+#define STATS_SOCKET_NAME "daemon_stats.sock"
+#define LOCK_NAME "daemon.lock"
+
+#endif